@@ -1,4 +1,6 @@
 ﻿using System;
+using System.Buffers;
+using System.Runtime.InteropServices;
 using libsmp;
 using System.Linq;
 
@@ -6,12 +8,159 @@ namespace Test
 {
     class Program
     {
-        static void Main(string[] args)
+        static int failed = 0;
+
+        static void Check(bool condition, string message)
+        {
+            if (!condition)
+            {
+                Console.WriteLine(message);
+                failed++;
+            }
+        }
+
+        static byte[] RandomPayload(Random rand, int length)
+        {
+            byte[] payload = new byte[length];
+            rand.NextBytes(payload);
+            for (int i = 0; i < length; i++)
+            {
+                if (rand.Next(8) == 0)
+                    payload[i] = 0xFF;
+            }
+            return payload;
+        }
+
+        /**
+         * @brief All three encoders create the same frame and the decoder returns the payload
+         * */
+        static void CheckRoundTrip(ManagedSMP smp, byte[] payload)
         {
+            var msg = smp.GenerateMessage(payload);
+            var span = new byte[smp.GetMessageLength(payload)];
+            int spanLength = smp.GenerateMessage(payload, span);
+            var writer = new ArrayBufferWriter<byte>();
+            int writerLength = smp.WriteMessage(payload, writer);
+            Check(msg.Length == span.Length && spanLength == msg.Length && msg.SequenceEqual(span), "GenerateMessage into a span differs");
+            Check(writerLength == msg.Length && writer.WrittenSpan.SequenceEqual(msg), "WriteMessage differs from GenerateMessage");
+
+            Check(smp.ProcessBytes(msg) == 1 && smp.StoredMessages == 1, string.Format("Message of {0} bytes was not received", payload.Length));
+            if (smp.StoredMessages > 0)
+            {
+                Check(smp.GetMessage().SequenceEqual(payload), string.Format("Received message of {0} bytes was not correct", payload.Length));
+            }
+        }
+
+        static void TestRoundTrips(Random rand)
+        {
+            using (var smp = new ManagedSMP())
+            {
+                for (int i = 0; i < 1000; i++)
+                {
+                    CheckRoundTrip(smp, RandomPayload(rand, rand.Next(0, 600)));
+                }
+                // The low byte of the length field is 0xFF and stuffed
+                foreach (int length in new[] { 253, 509, 765, 254, 508 })
+                {
+                    CheckRoundTrip(smp, RandomPayload(rand, length));
+                    CheckRoundTrip(smp, Enumerable.Repeat((byte)0xFF, length).ToArray());
+                }
+            }
+        }
+
+        /**
+         * @brief The frames are split into two calls at every position
+         * */
+        static void TestSplitFrames(Random rand)
+        {
+            using (var smp = new ManagedSMP())
+            {
+                foreach (int length in new[] { 1, 40, 253, 509 })
+                {
+                    var payload = RandomPayload(rand, length);
+                    var msg = smp.GenerateMessage(payload);
+                    for (int split = 0; split <= msg.Length; split++)
+                    {
+                        smp.ProcessBytes(msg.AsSpan(0, split));
+                        smp.ProcessBytes(msg.AsSpan(split));
+                        Check(smp.StoredMessages == 1 && smp.GetMessage().SequenceEqual(payload),
+                              string.Format("Message of {0} bytes split at {1} was not received", length, split));
+                        while (smp.StoredMessages > 0)
+                            smp.GetMessage();
+                    }
+                }
+            }
+        }
+
+        /**
+         * @brief Length fields above MaxMessageLength are rejected and the next frame is received
+         * */
+        static void TestOversizedLength(Random rand)
+        {
+            using (var smp = new ManagedSMP())
+            {
+                var oversized = smp.GenerateMessage(RandomPayload(rand, 200));
+                var valid = RandomPayload(rand, 50);
+                var next = smp.GenerateMessage(valid);
+                smp.MaxMessageLength = 100;
+                Check(smp.ProcessBytes(oversized) == -1 && smp.StoredMessages == 0, "Oversized length field was not rejected");
+                smp.ProcessBytes(next);
+                Check(smp.StoredMessages == 1 && smp.GetMessage().SequenceEqual(valid), "Message after the oversized frame was not received");
+            }
+        }
+
+        /**
+         * @brief Disposing the frame owner returns the buffer to the ArrayPool, so the next frame reuses it
+         * */
+        static void TestPooledFrames(Random rand)
+        {
+            using (var smp = new ManagedSMP())
+            {
+                var payload = RandomPayload(rand, 300);
+                var msg = smp.GenerateMessage(payload);
+                byte[] previous = null;
+                for (int i = 0; i < 10; i++)
+                {
+                    IMemoryOwner<byte> owner = null;
+                    smp.ProcessBytes(msg, frame => owner = frame);
+                    Check(owner != null && owner.Memory.Span.SequenceEqual(payload), "Pooled frame was not received");
+                    if (owner == null)
+                        return;
+                    MemoryMarshal.TryGetArray<byte>(owner.Memory, out var segment);
+                    Check(previous == null || ReferenceEquals(previous, segment.Array), "Buffer of the disposed frame was not reused");
+                    previous = segment.Array;
+                    owner.Dispose();
+                    bool disposed = false;
+                    try
+                    {
+                        var memory = owner.Memory;
+                    }
+                    catch (ObjectDisposedException)
+                    {
+                        disposed = true;
+                    }
+                    Check(disposed, "Disposed frame is still accessible");
+                }
+                Check(smp.StoredMessages == 0, "Pooled frames were also stored in the message queue");
+            }
+        }
+
+        static int Main(string[] args)
+        {
+            Random rand = new Random(22);
+            TestRoundTrips(rand);
+            TestSplitFrames(rand);
+            TestOversizedLength(rand);
+            TestPooledFrames(rand);
+            if (failed > 0)
+            {
+                Console.WriteLine("{0} checks failed", failed);
+                return 1;
+            }
+
             var watch = System.Diagnostics.Stopwatch.StartNew();
             using (var smp = new ManagedSMP())
             {
-                Random rand = new Random();
                 for (int i = 0; i < 500000; i++)
                 {
                     byte[] payload = new byte[rand.Next(20, 100)];
@@ -20,7 +169,7 @@ namespace Test
                     if (msg.Length == 0)
                     {
                         Console.WriteLine("Message was not created");
-                        return;
+                        return 1;
                     }
                     else
                     {
@@ -28,7 +177,7 @@ namespace Test
                         if(smp.StoredMessages > 1)
                         {
                             Console.WriteLine("Framing Error");
-                            return;
+                            return 1;
                         }
                         if (smp.StoredMessages == 0)
                         {
@@ -37,7 +186,7 @@ namespace Test
                             {
                                 Console.Write("{0:x} ", b);
                             }
-                            return;
+                            return 1;
                         }
                         else
                         {
@@ -68,7 +217,7 @@ namespace Test
                                 {
                                     Console.Write("{0:x} ", b);
                                 }
-                                return;
+                                return 1;
                             }
                         }
                     }
@@ -76,6 +225,7 @@ namespace Test
             }
             watch.Stop();
             Console.WriteLine("Elapsed Time: {0}ms", watch.ElapsedMilliseconds);
+            return 0;
         }
     }
 }
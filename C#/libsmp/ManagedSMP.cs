@@ -1,10 +1,16 @@
 using System;
+using System.Buffers;
 using System.Collections.Generic;
 
 namespace libsmp
 {
     public class ManagedSMP : SMP
     {
+        /**
+         * @brief Called for every received frame, the handler owns the frame and has to dispose it to return the buffer to the pool.
+         * The frame must not be used after it is disposed.
+         * */
+        public delegate void PooledFrameHandler(IMemoryOwner<byte> frame);
 
         public override uint ReceiveErrors { get; protected set; } = 0;
         public override uint ReceivedMessages { get; protected set; } = 0;
@@ -12,9 +18,19 @@ namespace libsmp
         private uint decoderstate = 0;
         private bool firstLengthbyteReceived = false;
         private uint currentcrc = 0;
-        private readonly List<byte> received = new List<byte>();
+        // Payload of the current frame, rented from the ArrayPool when the length is known
+        private byte[] received = null;
+        private int receivedLength = 0;
         private byte crcHighbyte = 0;
         private bool framestartReceivedLast = false;
+        // Set during ProcessBytes with a handler, otherwise the frames are copied into the message queue
+        private PooledFrameHandler frameHandler = null;
+
+        private const ushort DefaultPolynom = 0xA001;
+        private static readonly ushort[] defaultCrcTable = BuildCrcTable(DefaultPolynom);
+        private ushort[] crcTable = defaultCrcTable;
+        private ushort crcPolynom = DefaultPolynom;
+
         /***********************************************************************
         * @brief Private function definiton to calculate the crc checksum
         ***********************************************************************/
@@ -35,12 +51,40 @@ namespace libsmp
             return (_crc);
         }
 
+        /***********************************************************************
+        * @brief Lookup table with the crc of every byte value, the same as crc16 for one byte
+        ***********************************************************************/
+        private static ushort[] BuildCrcTable(ushort polynom)
+        {
+            var table = new ushort[256];
+            for (uint i = 0; i < table.Length; i++)
+            {
+                table[i] = (ushort)crc16(0, i, polynom);
+            }
+            return table;
+        }
+
+        private uint UpdateCrc(uint crc, byte data)
+        {
+            return (crc >> 8) ^ crcTable[(crc ^ data) & 0xFF];
+        }
+
+        private uint UpdateCrc(uint crc, ReadOnlySpan<byte> data)
+        {
+            ushort[] table = crcTable;
+            foreach (byte b in data)
+            {
+                crc = (crc >> 8) ^ table[(crc ^ b) & 0xFF];
+            }
+            return crc;
+        }
+
         protected void resetDecoderState(bool preserveReceivedDelimeter)
         {
             decoderstate = 0;
             firstLengthbyteReceived = false;
             currentcrc = 0;
-            received.Clear();
+            receivedLength = 0;
             crcHighbyte = 0;
             if(!preserveReceivedDelimeter)
             {
@@ -53,6 +97,16 @@ namespace libsmp
             resetDecoderState(false);
         }
 
+        public override void Dispose()
+        {
+            base.Dispose();
+            if (received != null)
+            {
+                ArrayPool<byte>.Shared.Return(received);
+                received = null;
+            }
+        }
+
         /**
          * @brief The number that is selected as the Framestart
          * */
@@ -66,84 +120,210 @@ namespace libsmp
         /**
          * @brief The crc polynom to use
          * */
-        public ushort CRCPolynom { get; set; } = 0xA001;
+        public ushort CRCPolynom
+        {
+            get => crcPolynom;
+            set
+            {
+                crcPolynom = value;
+                crcTable = value == DefaultPolynom ? defaultCrcTable : BuildCrcTable(value);
+            }
+        }
 
-        /************************************************************************      
-         * @brief Generates a full SMP paket with the specified payload
-        /************************************************************************/
-        public override byte[] GenerateMessage(byte[] payload)
+        /************************************************************************
+         * @brief Length of the SMP paket with the specified payload
+         ************************************************************************/
+        public int GetMessageLength(ReadOnlySpan<byte> payload)
         {
-            uint i = 2;
+            int length = 3 + payload.Length + 2;
+            int packedLength = payload.Length + 2;
             uint crc = 0;
-            var payloadBuffer = new List<byte>();
+            foreach (byte b in payload)
+            {
+                if (b == Framestart)
+                    length++;
+                crc = UpdateCrc(crc, b);
+            }
+            length += ((packedLength & 0xFF) == Framestart ? 1 : 0) + (((packedLength >> 8) & 0xFF) == Framestart ? 1 : 0);
+            length += (((crc >> 8) & 0xFF) == Framestart ? 1 : 0) + ((crc & 0xFF) == Framestart ? 1 : 0);
+            return length;
+        }
+
+        private static int PutStuffed(Span<byte> destination, int index, byte data, byte framestart)
+        {
+            destination[index++] = data;
+            if (data == framestart)
+            {
+                destination[index++] = framestart;
+            }
+            return index;
+        }
+
+        /************************************************************************
+         * @brief Writes the SMP paket with the specified payload into destination
+         * @return The length of the paket, destination must hold GetMessageLength(payload) bytes
+         ************************************************************************/
+        public int GenerateMessage(ReadOnlySpan<byte> payload, Span<byte> destination)
+        {
             if (payload.Length > MaxMessageLength)
                 throw new ArgumentException("The message length must not be bigger than the MaxMessageLength");
+            if (destination.Length < GetMessageLength(payload))
+                throw new ArgumentException("The destination is too short for the message");
+            return Encode(payload, destination);
+        }
+
+        private int Encode(ReadOnlySpan<byte> payload, Span<byte> destination)
+        {
+            int packedLength = payload.Length + 2;
+            int index = 0;
+            destination[index++] = Framestart;
+            index = PutStuffed(destination, index, (byte)(packedLength & 0xFF), Framestart); //Lowbyte
+            index = PutStuffed(destination, index, (byte)((packedLength >> 8) & 0xFF), Framestart); //Highbyte
 
-            for (i = 0; i < payload.Length; i++)
+            uint crc = 0;
+            while (!payload.IsEmpty)
             {
-                if (payload[i] == Framestart)
+                // Copy the runs between the framestarts in one block
+                int run = payload.IndexOf(Framestart);
+                if (run < 0)
+                    run = payload.Length;
+                payload.Slice(0, run).CopyTo(destination.Slice(index));
+                crc = UpdateCrc(crc, payload.Slice(0, run));
+                index += run;
+                payload = payload.Slice(run);
+                if (!payload.IsEmpty)
                 {
-                    payloadBuffer.Add(Framestart);
+                    destination[index++] = Framestart;
+                    destination[index++] = Framestart;
+                    crc = UpdateCrc(crc, Framestart);
+                    payload = payload.Slice(1);
                 }
-
-                payloadBuffer.Add(payload[i]);
-                crc = crc16(crc, payload[i], CRCPolynom);
             }
+            index = PutStuffed(destination, index, (byte)((crc >> 8) & 0xFF), Framestart); //CRC high byte
+            index = PutStuffed(destination, index, (byte)(crc & 0xFF), Framestart); //CRC low byte
+            return index;
+        }
 
-            byte crcbyte = (byte)((crc >> 8) & 0xFF);
-            payloadBuffer.Add(crcbyte); //CRC high byte
+        /************************************************************************
+         * @brief Writes the SMP paket with the specified payload into a buffer writer, e.g. a PipeWriter
+         * @return The length of the paket
+         ************************************************************************/
+        public int WriteMessage(ReadOnlySpan<byte> payload, IBufferWriter<byte> writer)
+        {
+            if (payload.Length > MaxMessageLength)
+                throw new ArgumentException("The message length must not be bigger than the MaxMessageLength");
+            int length = Encode(payload, writer.GetSpan(GetMessageLength(payload)));
+            writer.Advance(length);
+            return length;
+        }
 
-            if (crcbyte == Framestart)
-            {
-                payloadBuffer.Add(Framestart);
-            }
-            crcbyte = (byte)(crc & 0xFF); //CRC low byte
-            payloadBuffer.Add(crcbyte);
-            if (crcbyte == Framestart)
-            {
-                payloadBuffer.Add(Framestart);
-            }
-            int packedLength = payload.Length + 2;
-            var header = new List<byte>
-            {
-                Framestart
-            };
-            byte lengthbyte = (byte)(packedLength & 0xFF); //Lowbyte
-            header.Add(lengthbyte);
-            if (lengthbyte == Framestart)
-            {
-                header.Add(Framestart);
-            }
-            lengthbyte = (byte)((packedLength >> 8) & 0xFF); //Highbyte
-            header.Add(lengthbyte);
-            if (lengthbyte == Framestart)
-            {
-                header.Add(Framestart);
-            }
-            var smpmessage = new byte[header.Count + payloadBuffer.Count];
-            header.CopyTo(smpmessage);
-            payloadBuffer.CopyTo(smpmessage, header.Count);
-            return smpmessage;            
+        /************************************************************************
+         * @brief Generates a full SMP paket with the specified payload
+        /************************************************************************/
+        public override byte[] GenerateMessage(byte[] payload)
+        {
+            if (payload.Length > MaxMessageLength)
+                throw new ArgumentException("The message length must not be bigger than the MaxMessageLength");
+            var smpmessage = new byte[GetMessageLength(payload)];
+            Encode(payload, smpmessage);
+            return smpmessage;
         }
 
         /************************************************************************
          * @brief  Parse multiple bytes
-         * This function calls SMP_RecieveInByte for every byte in the buffer
+         * The runs of payload bytes between the framestarts are copied in one block,
+         * all other bytes are passed to SMP_RecieveInByte
          ************************************************************************/
         public override sbyte ProcessBytes(Span<byte> data)
         {
-            uint i;
+            return ProcessBytes((ReadOnlySpan<byte>)data);
+        }
+
+        /************************************************************************
+         * @brief  Parse multiple bytes and pass every frame to handler as a pooled buffer
+         * Without allocations once the ArrayPool and the frame pool are warmed up
+         ************************************************************************/
+        public sbyte ProcessBytes(ReadOnlySpan<byte> data, PooledFrameHandler handler)
+        {
+            frameHandler = handler;
+            try
+            {
+                return ProcessBytes(data);
+            }
+            finally
+            {
+                frameHandler = null;
+            }
+        }
+
+        private sbyte ProcessBytes(ReadOnlySpan<byte> data)
+        {
             int ret = 0;
             int smpRet;
-            for (i = 0; i < data.Length; i++)
+            while (!data.IsEmpty)
             {
-                smpRet = SMP_RecieveInByte(data[(int)i]);
+                if (decoderstate == 2 && !framestartReceivedLast)
+                {
+                    int run = Math.Min(data.Length, (int)BytesToReceive - 2);
+                    int framestart = data.Slice(0, run).IndexOf(Framestart);
+                    if (framestart >= 0)
+                        run = framestart;
+                    if (run > 0)
+                    {
+                        ReadOnlySpan<byte> block = data.Slice(0, run);
+                        block.CopyTo(received.AsSpan(receivedLength));
+                        receivedLength += run;
+                        currentcrc = UpdateCrc(currentcrc, block);
+                        BytesToReceive -= (uint)run;
+                        if (BytesToReceive == 2) //If we only have two bytes to receive we switch to the reception of the crc data
+                        {
+                            decoderstate = 3;
+                        }
+                        data = data.Slice(run);
+                        continue;
+                    }
+                }
+                smpRet = SMP_RecieveInByte(data[0]);
                 if (smpRet != 0)
                     ret = smpRet;
+                data = data.Slice(1);
             }
             return (sbyte)ret;
         }
 
+        /**
+         * @brief Rent the buffer for the payload, the last buffer is reused if it is large enough
+         * */
+        private void PrepareBuffer(int length)
+        {
+            if (received != null && received.Length < length)
+            {
+                ArrayPool<byte>.Shared.Return(received);
+                received = null;
+            }
+            if (received == null)
+            {
+                received = ArrayPool<byte>.Shared.Rent(Math.Max(length, 1));
+            }
+            receivedLength = 0;
+        }
+
+        private void DeliverFrame()
+        {
+            if (frameHandler != null)
+            {
+                // The handler owns the buffer now, the next frame rents a new one
+                var frame = PooledFrame.Create(received, receivedLength);
+                received = null;
+                receivedLength = 0;
+                frameHandler(frame);
+            }
+            else
+            {
+                receivedmessages.Enqueue(received.AsSpan(0, receivedLength).ToArray());
+            }
+        }
+
         /**
          *  @brief Private function to process the received bytes without the bytestuffing
          * **/
@@ -165,15 +345,21 @@ namespace libsmp
                     else
                     {
                         BytesToReceive |= (uint)data << 8;
+                        if (BytesToReceive < 2 || BytesToReceive - 2 > MaxMessageLength)
+                        {
+                            Receiving = false;
+                            resetDecoderState(true);
+                            return -1;
+                        }
                         decoderstate = 2;
                         currentcrc = 0;
-                        received.Clear();
+                        PrepareBuffer((int)BytesToReceive - 2);
                     }
                     break;
                 case 2:
                     BytesToReceive--;
-                    received.Add(data);
-                    currentcrc = crc16(currentcrc, data, CRCPolynom);
+                    received[receivedLength++] = data;
+                    currentcrc = UpdateCrc(currentcrc, data);
                     if (BytesToReceive == 2) //If we only have two bytes to receive we switch to the reception of the crc data
                     {
                         decoderstate = 3;
@@ -198,9 +384,9 @@ namespace libsmp
                         {
                             //Data ready
                             ReceivedMessages++;
-                            receivedmessages.Enqueue(received.ToArray());
                             Receiving = false;
                             ret = 1;
+                            DeliverFrame();
                             resetDecoderState(false);
                         }
                         else //crc doesnt match.
@@ -235,7 +421,15 @@ namespace libsmp
             // Remove the bytestuffing from the data
             if (data == Framestart)
             {
-                if (framestartReceivedLast)
+                if (framestartReceivedLast && decoderstate == 0)
+                {
+                    // Outside of a frame two framestarts can only be the framestart followed by
+                    // the stuffed low byte 0xFF of the length field. Keep the delimeter for the stuffing byte.
+                    resetDecoderState(true);
+                    Receiving = true;
+                    decoderstate = 1;
+                }
+                else if (framestartReceivedLast)
                 {
                     framestartReceivedLast = false;
                     return private_SMP_RecieveInByte(data);
@@ -279,5 +473,54 @@ namespace libsmp
          * @brief Returns true if the smp stack for the smp_struct object is recieving
          */
         public bool Receiving { get; protected set; } = false;
+
+        /**
+         * @brief Frame buffer rented from the ArrayPool, the owner objects are pooled as well
+         * */
+        private sealed class PooledFrame : IMemoryOwner<byte>
+        {
+            private const int MaxPooled = 1024;
+            private static readonly Stack<PooledFrame> pool = new Stack<PooledFrame>();
+
+            private byte[] buffer;
+            private int length;
+
+            public static PooledFrame Create(byte[] buffer, int length)
+            {
+                PooledFrame frame = null;
+                lock (pool)
+                {
+                    if (pool.Count > 0)
+                        frame = pool.Pop();
+                }
+                frame = frame ?? new PooledFrame();
+                frame.buffer = buffer;
+                frame.length = length;
+                return frame;
+            }
+
+            public Memory<byte> Memory
+            {
+                get
+                {
+                    if (buffer == null)
+                        throw new ObjectDisposedException(nameof(PooledFrame));
+                    return new Memory<byte>(buffer, 0, length);
+                }
+            }
+
+            public void Dispose()
+            {
+                if (buffer == null)
+                    return;
+                ArrayPool<byte>.Shared.Return(buffer);
+                buffer = null;
+                lock (pool)
+                {
+                    if (pool.Count < MaxPooled)
+                        pool.Push(this);
+                }
+            }
+        }
     }
-}
\ No newline at end of file
+}
@@ -7,36 +7,71 @@ namespace libsmp
 {
     public class NativeSMP : SMP, IDisposable
     {
-        private delegate sbyte FrameReady(IntPtr data, UInt32 length);
+        /**
+         * @brief Called for every received frame, the payload is only valid during the call
+         * */
+        public delegate void FrameSpanHandler(ReadOnlySpan<byte> payload);
+
+        [StructLayout(LayoutKind.Sequential)]
+        private struct FrameInfo
+        {
+            public uint Offset;
+            public uint Length;
+        }
+
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        private delegate void BatchReady(IntPtr context, IntPtr buffer, IntPtr frames, uint count);
         [DllImport("libsmp")]
-        private static extern IntPtr SMP_BuildObject(uint bufferlength, FrameReady frameReadyCallback, FrameReady rogueFrameCallback);
+        private static extern IntPtr SMP_BuildObject(uint bufferlength, IntPtr frameReadyCallback, IntPtr rogueFrameCallback);
         [DllImport("libsmp")]
         private static extern void SMP_DestroyObject(IntPtr instance);
         [DllImport("libsmp")]
+        [return: MarshalAs(UnmanagedType.I1)]
+        private static extern bool SMP_SetBatchBuffer(IntPtr instance, IntPtr buffer, UIntPtr bufferlength, IntPtr frames, uint maxframes, BatchReady handler, IntPtr context);
+        [DllImport("libsmp")]
+        private static extern uint SMP_ReceiveBytes(IntPtr instance, ref byte data, UIntPtr length);
+        [DllImport("libsmp")]
         private static extern uint SMP_SendRetIndex(byte[] buffer, ushort length, byte[] messagebuffer, ushort messagebufferlength, out ushort messageStartIndex);
         [DllImport("libsmp")]
         private static extern uint SMP_CalculateMinimumSendBufferSize(ushort length);
-        [DllImport("libsmp")]
-        private static extern sbyte SMP_RecieveInBytes(Span<byte> data, uint length, IntPtr instance);
+
+        private const int BatchFrames = 256;
 
         private IntPtr instance = IntPtr.Zero;
-        private readonly FrameReady receiveFrameCallback;
+        // The native decoder writes the payloads directly into these arrays, so they stay pinned as long as the instance exists
+        private readonly byte[] batch;
+        private readonly FrameInfo[] frames = new FrameInfo[BatchFrames];
+        private GCHandle batchHandle;
+        private GCHandle framesHandle;
+        private readonly BatchReady batchReadyCallback;
+        private FrameSpanHandler spanHandler;
 
         public override uint ReceiveErrors { get; protected set; } = 0;
         public override uint ReceivedMessages { get; protected set; } = 0;
 
         public NativeSMP(int bufferlength = 1000)
         {
-            receiveFrameCallback = ReceiveFrame;
-            instance = SMP_BuildObject((uint)bufferlength, receiveFrameCallback, null);
+            instance = SMP_BuildObject((uint)bufferlength, IntPtr.Zero, IntPtr.Zero);
+            if (instance == IntPtr.Zero)
+                throw new OutOfMemoryException("Couldn't create the native decoder");
+            // Room for a few frames of the maximum length, short frames are batched up to BatchFrames per call
+            batch = new byte[Math.Max(bufferlength, 1) * 4];
+            batchHandle = GCHandle.Alloc(batch, GCHandleType.Pinned);
+            framesHandle = GCHandle.Alloc(frames, GCHandleType.Pinned);
+            batchReadyCallback = BatchReceived;
+            SMP_SetBatchBuffer(instance, batchHandle.AddrOfPinnedObject(), (UIntPtr)batch.Length, framesHandle.AddrOfPinnedObject(), BatchFrames, batchReadyCallback, IntPtr.Zero);
         }
 
-        private sbyte ReceiveFrame(IntPtr data, uint length)
+        private void BatchReceived(IntPtr context, IntPtr buffer, IntPtr framelist, uint count)
         {
-            byte[] payload = new byte[length];
-            Marshal.Copy(data, payload, 0, (int)length);
-            receivedmessages.Enqueue(payload);
-            return 0;
+            for (int i = 0; i < count; i++)
+            {
+                var payload = new ReadOnlySpan<byte>(batch, (int)frames[i].Offset, (int)frames[i].Length);
+                if (spanHandler != null)
+                    spanHandler(payload);
+                else
+                    receivedmessages.Enqueue(payload.ToArray());
+            }
         }
 
         ~NativeSMP()
@@ -52,6 +87,11 @@ namespace libsmp
                 SMP_DestroyObject(instance);
                 instance = IntPtr.Zero;
             }
+            if (batchHandle.IsAllocated)
+                batchHandle.Free();
+            if (framesHandle.IsAllocated)
+                framesHandle.Free();
+            GC.SuppressFinalize(this);
         }
 
         public byte[] GenerateMessage(byte[] payload, int maxMessageLength)
@@ -67,9 +107,41 @@ namespace libsmp
             return GenerateMessage(payload, (int)SMP_CalculateMinimumSendBufferSize((ushort)(payload.Length)));
         }
 
+        private uint Receive(ReadOnlySpan<byte> data)
+        {
+            if (data.IsEmpty)
+                return 0;
+            if (instance == IntPtr.Zero)
+                throw new ObjectDisposedException(nameof(NativeSMP));
+            uint received = SMP_ReceiveBytes(instance, ref MemoryMarshal.GetReference(data), (UIntPtr)data.Length);
+            ReceivedMessages += received;
+            return received;
+        }
+
+        /************************************************************************
+         * @brief Decode the bytes and pass every frame to handler without copying it
+         * @return The number of received frames
+         ************************************************************************/
+        public uint ProcessBytes(ReadOnlySpan<byte> data, FrameSpanHandler handler)
+        {
+            spanHandler = handler;
+            try
+            {
+                return Receive(data);
+            }
+            finally
+            {
+                spanHandler = null;
+            }
+        }
+
+        /************************************************************************
+         * @brief Decode the bytes and store a copy of every frame for GetMessage
+         * @return 1 if at least one frame was received
+         ************************************************************************/
         public override sbyte ProcessBytes(Span<byte> data)
         {
-            return SMP_RecieveInBytes(data, (uint)data.Length, instance);
+            return (sbyte)(Receive(data) > 0 ? 1 : 0);
         }
     }
 }
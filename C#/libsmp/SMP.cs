@@ -23,7 +23,7 @@ namespace libsmp
         }
         public sbyte ProcessBytes(byte[] data)
         {
-            return ProcessBytes(data);
+            return ProcessBytes(data.AsSpan());
         }
         public abstract sbyte ProcessBytes(Span<byte> data);
     }
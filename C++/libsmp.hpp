@@ -3,14 +3,17 @@
 #include <cstdint>
 #include <iterator>
 #include <functional>
+#include <initializer_list>
+#include <memory>
+#include <type_traits>
 
 #pragma once
 
 /**
  * @brief Class for the smp receiver and sender functions. This is an abstraction from the standard C functions.
  *
- * This class generates an internal buffer that is about 2*maxpacketSize bytes big.
- * The transmit functions use a local version of that buffer on the stack memory, so maxpacketSize has a main impact on the memory consumption.
+ * Each object holds the decoder state and a receive buffer of maxpacketSize bytes, so every object decodes its own stream.
+ * The transmit functions use a local buffer of about 2*maxpacketSize bytes on the stack memory, so maxpacketSize has a main impact on the memory consumption.
  */
 template <size_t maxmessageLength>
 class SMP
@@ -46,56 +49,101 @@ public:
         SMP_Init(&smp);
     }
 
-    size_t Transmit(const std::function<size_t(uint8_t *, size_t)> &callback, const void *buffer, size_t length)
+    /**
+     * @brief Type erased callbacks. Every function also has an overload that is templated on the callable,
+     * so lambdas and function objects are called directly without the overhead of std::function.
+     */
+    using TransmitCallback = std::function<size_t(uint8_t *, size_t)>;
+    using ReceiveCallback = std::function<void(const uint8_t *, size_t)>;
+
+    size_t Transmit(const TransmitCallback &callback, const void *buffer, size_t length)
+    {
+        return Transmit<const TransmitCallback &>(callback, buffer, length);
+    }
+
+    template <typename Callback>
+    size_t Transmit(Callback &&callback, const void *buffer, size_t length)
     {
         const uint8_t *ptr = reinterpret_cast<const uint8_t *>(buffer);
         const uint8_t *end = ptr + length;
-        return Transmit<const uint8_t *>(callback, ptr, end);
+        return Transmit<Callback, const uint8_t *>(std::forward<Callback>(callback), ptr, end);
+    }
+
+    size_t TransmitBuffer(const TransmitCallback &callback, const void *buffer, size_t length, std::array<uint8_t, TransmitArrayLength> &workingBuffer)
+    {
+        return TransmitBuffer<const TransmitCallback &>(callback, buffer, length, workingBuffer);
     }
 
-    size_t TransmitBuffer(const std::function<size_t(uint8_t *, size_t)> &callback, const void *buffer, size_t length, std::array<uint8_t, TransmitArrayLength> &workingBuffer)
+    template <typename Callback>
+    size_t TransmitBuffer(Callback &&callback, const void *buffer, size_t length, std::array<uint8_t, TransmitArrayLength> &workingBuffer)
     {
         const uint8_t *ptr = reinterpret_cast<const uint8_t *>(buffer);
         const uint8_t *end = ptr + length;
-        return TransmitBuffer<const uint8_t *>(callback, ptr, end, workingBuffer);
+        return TransmitBuffer<Callback, const uint8_t *>(std::forward<Callback>(callback), ptr, end, workingBuffer);
     }
 
     template <typename Iterator>
-    size_t Transmit(const std::function<size_t(uint8_t *, size_t)> &callback, const Iterator &start, const Iterator &end)
+    size_t Transmit(const TransmitCallback &callback, const Iterator &start, const Iterator &end)
+    {
+        return Transmit<const TransmitCallback &, Iterator>(callback, start, end);
+    }
+
+    template <typename Callback, typename Iterator>
+    size_t Transmit(Callback &&callback, const Iterator &start, const Iterator &end)
     {
         std::array<uint8_t, TransmitArrayLength> buffer;
-        return TransmitBuffer(callback, start, end, buffer);
+        return TransmitBuffer<Callback, Iterator>(std::forward<Callback>(callback), start, end, buffer);
     }
 
     template <typename Iterator>
-    size_t TransmitBuffer(const std::function<size_t(uint8_t *, size_t)> &callback, const Iterator &start, const Iterator &end, std::array<uint8_t, TransmitArrayLength> &buffer)
+    size_t TransmitBuffer(const TransmitCallback &callback, const Iterator &start, const Iterator &end, std::array<uint8_t, TransmitArrayLength> &buffer)
+    {
+        return TransmitBuffer<const TransmitCallback &, Iterator>(callback, start, end, buffer);
+    }
+
+    template <typename Callback, typename Iterator>
+    size_t TransmitBuffer(Callback &&callback, const Iterator &start, const Iterator &end, std::array<uint8_t, TransmitArrayLength> &buffer)
     {
-        buffer[0] = FRAMESTART;
         size_t length = 0;
         uint16_t crc = 0;
-        for (auto it = start; it < end; it++)
+        if constexpr (IsContiguousByteIterator<Iterator>())
+        {
+            length = std::distance(start, end);
+            crc = SMP_crc16_block(crc, reinterpret_cast<const uint8_t *>(start), length);
+        }
+        else
         {
-            auto b = *it;
-            length += sizeof(b);
-            crc = CalcCRC(*it, crc);
+            for (auto it = start; it < end; it++)
+            {
+                auto b = *it;
+                length += sizeof(b);
+                crc = CalcCRC(*it, crc);
+            }
         }
-        size_t crclength = CalculateByteStuffedLength(crc);
-        if (length > InternalBufferLength || (length + crclength) > MaximumSupportedMessageLength)
+        if (length > maxmessageLength || GetMinimumMessageLengthField(length) > MaximumSupportedMessageLength)
             return 0;
 
-        uint16_t lengthField = length + crclength;
+        uint16_t lengthField = GetMinimumMessageLengthField(length);
 
-        buffer[1] = lengthField & 0xFF;
-        buffer[2] = (lengthField >> 8) & 0xFF;
-        size_t offset = 3;
-        for (auto it = start; it < end; it++)
+        buffer[0] = FRAMESTART;
+        size_t offset = 1;
+        offset += AddDataToBuffer(lengthField, buffer, offset);
+        if constexpr (IsContiguousByteIterator<Iterator>())
         {
-            auto data = *it;
-            offset += AddDataToBuffer(data, buffer, offset);
+            offset += SMP_StuffBytes(buffer.data() + offset, reinterpret_cast<const uint8_t *>(start), length);
+        }
+        else
+        {
+            for (auto it = start; it < end; it++)
+            {
+                auto data = *it;
+                offset += AddDataToBuffer(data, buffer, offset);
+            }
         }
         offset += AddDataToBuffer(crc, buffer, offset, true);
         if (callback(buffer.data(), offset) == offset)
         {
+            CountSent(1, length, offset);
             return length;
         }
         else
@@ -104,45 +152,266 @@ public:
         }
     }
 
-    size_t Receive(const std::function<void(const uint8_t *, size_t)> &callback, const void *buffer, size_t length)
+    /**
+     * @brief Write a finished frame without any encoding, e.g. a frame generated at compile time with smp::MakeFrame from smpcodec.hpp
+     * A callback that takes a const uint8_t * gets the frame itself. A callback that takes a writable pointer, like TransmitCallback,
+     * gets a copy on the stack, the frame may be in the read only data.
+     * @return The frame length or 0 if the callback didn't write the whole frame
+     */
+    template <typename Callback, size_t FrameLength>
+    size_t TransmitFrame(Callback &&callback, const std::array<uint8_t, FrameLength> &frame)
+    {
+        size_t written;
+        if constexpr (std::is_invocable_v<Callback &, const uint8_t *, size_t>)
+        {
+            written = callback(frame.data(), frame.size());
+        }
+        else
+        {
+            std::array<uint8_t, FrameLength> copy = frame;
+            written = callback(copy.data(), copy.size());
+        }
+        if (written == frame.size())
+        {
+#ifdef SMP_ENABLE_STATS
+            uint16_t headerlength;
+            CountSent(1, SMP_PacketGetLength(frame.data(), &headerlength) - 2, frame.size());
+#endif
+            return frame.size();
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Transmit one frame with the concatenation of the segments as payload, without staging the payload in a separate buffer.
+     * @return The payload length or 0 on error
+     */
+    template <typename Callback>
+    size_t TransmitV(Callback &&callback, const smp_segment_t *segments, size_t segmentcount)
+    {
+        std::array<uint8_t, TransmitArrayLength> buffer;
+        size_t length = 0;
+        for (size_t i = 0; i < segmentcount; i++)
+        {
+            length += segments[i].length;
+        }
+        if (length > maxmessageLength)
+            return 0;
+        size_t framelength = SMP_SendV(segments, segmentcount, buffer.data(), buffer.size());
+        if (framelength > 0 && callback(buffer.data(), framelength) == framelength)
+        {
+            CountSent(1, length, framelength);
+            return length;
+        }
+        return 0;
+    }
+
+    template <typename Callback>
+    size_t TransmitV(Callback &&callback, std::initializer_list<smp_segment_t> segments)
+    {
+        return TransmitV(std::forward<Callback>(callback), segments.begin(), segments.size());
+    }
+
+    /**
+     * @brief Encode many messages back to back into the buffer and pass them to the callback in batches.
+     *
+     * The callback is called when the buffer is full, when at least flushThreshold bytes are buffered and after the last message.
+     * @return The number of messages that were written
+     */
+    template <typename Callback>
+    size_t TransmitBatchBuffer(Callback &&callback, const smp_segment_t *messages, size_t messagecount, uint8_t *buffer, size_t bufferlength, size_t flushThreshold = 0)
+    {
+        if constexpr (std::is_function_v<std::remove_reference_t<Callback>>)
+        {
+            return TransmitBatchBuffer(&callback, messages, messagecount, buffer, bufferlength, flushThreshold);
+        }
+        else
+        {
+#ifdef SMP_ENABLE_STATS
+            // Count the bytes of the batches that were completely written
+            size_t framebytes = 0;
+            auto write = [&callback, &framebytes](uint8_t *data, size_t length) -> size_t
+            {
+                size_t written = callback(data, length);
+                if (written == length)
+                    framebytes += length;
+                return written;
+            };
+            size_t written = SMP_SendMany(messages, messagecount, buffer, bufferlength, flushThreshold, &WriteTrampoline<decltype(write)>, ContextPointer(write));
+            size_t payloadbytes = 0;
+            for (size_t i = 0; i < written; i++)
+            {
+                payloadbytes += messages[i].length;
+            }
+            CountSent(written, payloadbytes, framebytes);
+            return written;
+#else
+            return SMP_SendMany(messages, messagecount, buffer, bufferlength, flushThreshold, &WriteTrampoline<Callback>, ContextPointer(callback));
+#endif
+        }
+    }
+
+    /**
+     * @brief Batch transmit with a buffer of BatchBufferLength bytes on the stack
+     */
+    template <size_t BatchBufferLength = (TransmitArrayLength > 4096 ? TransmitArrayLength : 4096), typename Callback>
+    size_t TransmitBatch(Callback &&callback, const smp_segment_t *messages, size_t messagecount, size_t flushThreshold = 0)
+    {
+        static_assert(BatchBufferLength >= TransmitArrayLength, "The batch buffer must hold at least one message with the maximum length");
+        std::array<uint8_t, BatchBufferLength> buffer;
+        for (size_t i = 0; i < messagecount; i++)
+        {
+            if (messages[i].length > maxmessageLength)
+            {
+                messagecount = i;
+                break;
+            }
+        }
+        return TransmitBatchBuffer(std::forward<Callback>(callback), messages, messagecount, buffer.data(), buffer.size(), flushThreshold);
+    }
+
+    template <size_t BatchBufferLength = (TransmitArrayLength > 4096 ? TransmitArrayLength : 4096), typename Callback>
+    size_t TransmitBatch(Callback &&callback, std::initializer_list<smp_segment_t> messages, size_t flushThreshold = 0)
+    {
+        return TransmitBatch<BatchBufferLength>(std::forward<Callback>(callback), messages.begin(), messages.size(), flushThreshold);
+    }
+
+    size_t Receive(const ReceiveCallback &callback, const void *buffer, size_t length)
+    {
+        return Receive<const ReceiveCallback &>(callback, buffer, length);
+    }
+
+    template <typename Callback>
+    size_t Receive(Callback &&callback, const void *buffer, size_t length)
     {
         const uint8_t *ptr = reinterpret_cast<const uint8_t *>(buffer);
         const uint8_t *end = ptr + length;
-        return Receive<const uint8_t *>(callback, ptr, end);
+        return Receive<Callback, const uint8_t *>(std::forward<Callback>(callback), ptr, end);
     }
 
     template <typename Iterator>
-    size_t Receive(const std::function<void(const uint8_t *, size_t)> &callback, const Iterator &start, const Iterator &end)
+    size_t Receive(const ReceiveCallback &callback, const Iterator &start, const Iterator &end)
     {
-        std::array<uint8_t, ReceiveArrayLength> buffer;
-        static size_t offset = 0;
-        size_t bytecount = 0;
-        for (auto it = start; it < end; it++)
+        return Receive<const ReceiveCallback &, Iterator>(callback, start, end);
+    }
+
+    template <typename Callback, typename Iterator>
+    size_t Receive(Callback &&callback, const Iterator &start, const Iterator &end)
+    {
+        if constexpr (std::is_function_v<std::remove_reference_t<Callback>>)
+        {
+            // Plain functions are passed as function pointer through the C callback context
+            return Receive(&callback, start, end);
+        }
+        else if constexpr (IsContiguousByteIterator<Iterator>())
         {
-            uint8_t d;
-            auto ret = SMP_RecieveInByte(*it, &d, &smp);
-            switch (ret)
+            size_t length = std::distance(start, end);
+            SMP_ReceiveBuffer(&smp, reinterpret_cast<const uint8_t *>(start), length, receiveBuffer.data(), receiveBuffer.size(),
+                              &FrameTrampoline<Callback>, ContextPointer(callback));
+            return length;
+        }
+        else
+        {
+            // Collect the elements in chunks for the bulk decoder
+            std::array<uint8_t, 64> chunk;
+            size_t used = 0;
+            size_t bytecount = 0;
+            for (auto it = start; it < end; it++)
             {
-            case PACKET_START_FOUND:
-                offset = 0;
-                break;
-            case RECEIVED_BYTE:
-                buffer[offset] = d;
-                offset++;
-                break;
-            case PACKET_READY:
-                callback(buffer.data(), offset);
-                offset = 0;
-                break;
-            default:
-                break;
+                chunk[used++] = static_cast<uint8_t>(*it);
+                if (used == chunk.size() || std::next(it) == end)
+                {
+                    SMP_ReceiveBuffer(&smp, chunk.data(), used, receiveBuffer.data(), receiveBuffer.size(),
+                                      &FrameTrampoline<Callback>, ContextPointer(callback));
+                    used = 0;
+                }
+                bytecount++;
             }
-            bytecount++;
+            return bytecount;
         }
-        return bytecount;
+    }
+
+    /**
+     * @brief Decode the bytes that the producer wrote into the ring, e.g. a SMPRing from smpring.hpp
+     * @return The number of decoded bytes
+     */
+    template <typename Callback, typename Ring>
+    size_t Poll(Callback &&callback, Ring &ring)
+    {
+        return ring.Consume([this, &callback](const uint8_t *data, size_t length)
+                            { Receive(callback, data, length); });
+    }
+
+    /**
+     * @brief Drop the frame that is currently received, the statistics are kept
+     */
+    void ResetReceiver()
+    {
+        SMP_ResetDecoderState(&smp, false);
+        smp.bytesRecieved = 0;
+    }
+
+    /**
+     * @brief Snapshot of the statistics, all zero if the library is compiled without SMP_ENABLE_STATS
+     */
+    smp_stats_snapshot_t Statistics() const
+    {
+        smp_stats_snapshot_t snapshot;
+        SMP_StatsSnapshot(&smp, &snapshot);
+        return snapshot;
+    }
+
+    /**
+     * @brief Last receiver error of this decoder, cleared by the call (see SMP_GetLastError)
+     */
+    signed char LastError()
+    {
+        return SMP_GetLastError(&smp);
     }
 
 private:
+    void CountSent(size_t frames, size_t payloadbytes, size_t framebytes)
+    {
+#ifdef SMP_ENABLE_STATS
+        SMP_StatsAddSent(&smp, frames, payloadbytes, framebytes);
+#else
+        (void)frames;
+        (void)payloadbytes;
+        (void)framebytes;
+#endif
+    }
+
+    /**
+     * @brief Trampolines to call a C++ callable from the C callbacks, the callable is passed as context.
+     * The callable is called directly from here, so it can be inlined into the trampoline.
+     */
+    template <typename Callback>
+    static void FrameTrampoline(void *context, const uint8_t *data, uint32_t length)
+    {
+        (*static_cast<std::remove_reference_t<Callback> *>(context))(data, static_cast<size_t>(length));
+    }
+
+    template <typename Callback>
+    static size_t WriteTrampoline(void *context, const uint8_t *data, size_t length)
+    {
+        return (*static_cast<std::remove_reference_t<Callback> *>(context))(const_cast<uint8_t *>(data), length);
+    }
+
+    template <typename Callback>
+    static void *ContextPointer(Callback &callback)
+    {
+        return const_cast<void *>(static_cast<const void *>(std::addressof(callback)));
+    }
+
+    /**
+     * @brief True if the iterator is a pointer to byte sized elements, so the crc can be calculated over the whole block at once.
+     */
+    template <typename Iterator>
+    static constexpr bool IsContiguousByteIterator()
+    {
+        return std::is_pointer_v<Iterator> && sizeof(std::remove_pointer_t<Iterator>) == 1;
+    }
+
     template <typename Iterator>
     bool AdvanceIteratorSave(Iterator &it, size_t offset, Iterator end)
     {
@@ -250,4 +519,9 @@ private:
      *
      */
     smp_struct_t smp;
+
+    /**
+     * @brief Payload of the frame that is currently received. This is kept between the calls to Receive, so frames can be split across calls.
+     */
+    std::array<uint8_t, ReceiveArrayLength> receiveBuffer;
 };
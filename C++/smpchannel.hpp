@@ -0,0 +1,555 @@
+#include "smpcodec.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#include <span>
+#define SMP_HAS_COROUTINES
+#endif
+
+#pragma once
+
+#ifdef SMP_HAS_COROUTINES
+
+namespace smp
+{
+    namespace detail
+    {
+        /**
+         * @brief Recycles the coroutine frames of the tasks, so a request/response loop doesn't allocate after the first exchange.
+         * Frames up to MaxPooledLength bytes are kept in per thread free lists, larger frames use the global allocator.
+         * Every list keeps at most MaxBlocksPerClass frames, so frames that are created on one thread and destroyed on another
+         * don't accumulate. Frames that are destroyed after the pool of the thread (during thread exit) go to the global allocator.
+         */
+        class FramePool
+        {
+        public:
+            static constexpr size_t Granularity = 64;
+            static constexpr size_t MaxPooledLength = 2048;
+            static constexpr size_t MaxBlocksPerClass = 64;
+
+            FramePool() = default;
+            FramePool(const FramePool &) = delete;
+            FramePool &operator=(const FramePool &) = delete;
+
+            ~FramePool()
+            {
+                destroyed = true;
+                for (Block *&head : freelists)
+                {
+                    while (head)
+                    {
+                        Block *next = head->next;
+                        ::operator delete(head);
+                        head = next;
+                    }
+                }
+            }
+
+            static void *Allocate(size_t length)
+            {
+                if (length > MaxPooledLength)
+                    return ::operator new(length);
+                size_t sizeclass = SizeClass(length);
+                FramePool *pool = Local();
+                Block *block = pool ? pool->freelists[sizeclass] : nullptr;
+                if (!block)
+                    return ::operator new((sizeclass + 1) * Granularity); // The whole size class, the frame may be freed into a pool
+                pool->freelists[sizeclass] = block->next;
+                pool->counts[sizeclass]--;
+                return block;
+            }
+
+            static void Free(void *memory, size_t length)
+            {
+                size_t sizeclass = SizeClass(length);
+                FramePool *pool = length <= MaxPooledLength ? Local() : nullptr;
+                if (!pool || pool->counts[sizeclass] >= MaxBlocksPerClass)
+                {
+                    ::operator delete(memory);
+                    return;
+                }
+                pool->freelists[sizeclass] = new (memory) Block{pool->freelists[sizeclass]};
+                pool->counts[sizeclass]++;
+            }
+
+        private:
+            struct Block
+            {
+                Block *next;
+            };
+
+            static size_t SizeClass(size_t length)
+            {
+                return length == 0 ? 0 : (length - 1) / Granularity;
+            }
+
+            /**
+             * @brief The pool of the calling thread, nullptr after it was destroyed
+             */
+            static FramePool *Local()
+            {
+                if (destroyed)
+                    return nullptr;
+                thread_local FramePool pool;
+                return &pool;
+            }
+
+            // Trivially destructible, so it can still be read after the pool was destroyed
+            static inline thread_local bool destroyed = false;
+
+            std::array<Block *, MaxPooledLength / Granularity> freelists{};
+            std::array<uint32_t, MaxPooledLength / Granularity> counts{};
+        };
+
+        template <typename T>
+        struct TaskResult
+        {
+            template <typename Value>
+            void return_value(Value &&result)
+            {
+                value = std::forward<Value>(result);
+            }
+
+            T value{};
+        };
+
+        template <>
+        struct TaskResult<void>
+        {
+            void return_void()
+            {
+            }
+        };
+    }
+
+    /**
+     * @brief Lazily started coroutine that resumes its awaiting coroutine when it completes, without a scheduler.
+     *
+     * Tasks are awaited with co_await from other tasks. The outermost task is started with Start and runs until it waits
+     * for the first frame, from then on it is resumed by the channel.
+     */
+    template <typename T = void>
+    class Task
+    {
+    public:
+        struct promise_type : detail::TaskResult<T>
+        {
+            Task get_return_object()
+            {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept
+            {
+                return {};
+            }
+
+            auto final_suspend() noexcept
+            {
+                struct FinalAwaiter
+                {
+                    bool await_ready() noexcept
+                    {
+                        return false;
+                    }
+
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                    {
+                        auto continuation = handle.promise().continuation;
+                        return continuation ? continuation : std::noop_coroutine();
+                    }
+
+                    void await_resume() noexcept
+                    {
+                    }
+                };
+                return FinalAwaiter{};
+            }
+
+            void unhandled_exception()
+            {
+                exception = std::current_exception();
+            }
+
+            static void *operator new(size_t length)
+            {
+                return detail::FramePool::Allocate(length);
+            }
+
+            static void operator delete(void *memory, size_t length)
+            {
+                detail::FramePool::Free(memory, length);
+            }
+
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+        };
+
+        Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr))
+        {
+        }
+
+        Task &operator=(Task &&other) noexcept
+        {
+            if (this != &other)
+            {
+                Destroy();
+                handle = std::exchange(other.handle, nullptr);
+            }
+            return *this;
+        }
+
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        ~Task()
+        {
+            Destroy();
+        }
+
+        /**
+         * @brief Run the task until it suspends for the first time, for the outermost task
+         */
+        void Start()
+        {
+            if (handle && !handle.done())
+            {
+                handle.resume();
+            }
+        }
+
+        bool Done() const
+        {
+            return !handle || handle.done();
+        }
+
+        /**
+         * @brief The result of a completed task, rethrows an exception of the task
+         */
+        decltype(auto) Result()
+        {
+            if (handle.promise().exception)
+                std::rethrow_exception(handle.promise().exception);
+            if constexpr (!std::is_void_v<T>)
+                return (handle.promise().value);
+        }
+
+        bool await_ready() const noexcept
+        {
+            return Done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+
+        T await_resume()
+        {
+            if constexpr (std::is_void_v<T>)
+                Result();
+            else
+                return std::move(Result());
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> coroutine) : handle(coroutine)
+        {
+        }
+
+        void Destroy()
+        {
+            if (handle)
+            {
+                handle.destroy();
+                handle = nullptr;
+            }
+        }
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    /**
+     * @brief Coroutine interface for one smp link, for request/response exchanges on a single event loop thread.
+     *
+     * The event loop passes the received bytes to Feed and calls Writable when the transport can accept data again.
+     * co_await Receive() resumes with the payload of the next frame directly from Feed, co_await Send(payload) completes
+     * as soon as the transport accepted the whole frame. Nothing is allocated per frame, the awaiters live in the coroutine
+     * frames and are queued in intrusive lists.
+     *
+     * The transport is a callable write(const uint8_t *data, size_t length) that returns the number of bytes accepted,
+     * less than length if the transport is full. The channel isn't thread safe and must outlive the waiting coroutines.
+     */
+    template <size_t maxmessageLength>
+    class Channel
+    {
+        struct ReceiveAwaiter;
+        struct SendAwaiter;
+
+    public:
+        using WriteCallback = std::function<size_t(const uint8_t *, size_t)>;
+
+        static constexpr size_t FrameBufferLength = 2 * (maxmessageLength + 2) + 5;
+
+        explicit Channel(WriteCallback writeCallback) : write(std::move(writeCallback))
+        {
+        }
+
+        Channel(const Channel &) = delete;
+        Channel &operator=(const Channel &) = delete;
+
+        /**
+         * @brief co_await Receive() returns the payload of the next frame as std::optional<std::span<const uint8_t>>.
+         * The payload is only valid until the coroutine suspends again, std::nullopt means the channel was closed.
+         * Frames with an empty payload are delivered as an empty span.
+         * Waiting coroutines get the frames in the order they started waiting.
+         */
+        ReceiveAwaiter Receive()
+        {
+            return ReceiveAwaiter{this};
+        }
+
+        /**
+         * @brief co_await Send(payload) returns true when the transport accepted the frame, false if the payload is too long
+         * or the channel was closed. The payload must stay valid until then. Frames are written in the order of the calls.
+         */
+        SendAwaiter Send(std::span<const uint8_t> payload)
+        {
+            return SendAwaiter{this, payload};
+        }
+
+        /**
+         * @brief Decode received bytes and resume the waiting coroutines with the frames.
+         * Frames that arrive while no coroutine waits are dropped. The resumed coroutines must not call Feed themselves.
+         * @return The number of valid frames
+         */
+        size_t Feed(const uint8_t *data, size_t length)
+        {
+            return decoder.Receive([this](const uint8_t *payload, size_t payloadlength)
+                                   { Deliver(payload, payloadlength); },
+                                   data, length);
+        }
+
+        /**
+         * @brief Continue the frame that the transport didn't accept completely and the queued frames
+         */
+        void Writable()
+        {
+            Flush();
+        }
+
+        /**
+         * @brief Resume all waiting coroutines, the receivers with std::nullopt and the senders with false.
+         * Later calls to Send and Receive complete immediately.
+         */
+        void Close()
+        {
+            closed = true;
+            encoded = 0;
+            pending = 0;
+            if (SendAwaiter *sender = std::exchange(writing, nullptr))
+            {
+                sender->accepted = false;
+                sender->awaiting.resume();
+            }
+            while (SendAwaiter *sender = PopFront(sendHead, sendTail))
+            {
+                sender->accepted = false;
+                sender->awaiting.resume();
+            }
+            while (ReceiveAwaiter *receiver = PopFront(receiveHead, receiveTail))
+            {
+                receiver->frame = std::nullopt;
+                receiver->awaiting.resume();
+            }
+        }
+
+        bool Closed() const
+        {
+            return closed;
+        }
+
+        /**
+         * @brief Number of valid frames that arrived while no coroutine was waiting
+         */
+        uint64_t DroppedFrames() const
+        {
+            return dropped;
+        }
+
+    private:
+        struct ReceiveAwaiter
+        {
+            Channel *channel;
+            std::optional<std::span<const uint8_t>> frame{};
+            std::coroutine_handle<> awaiting{};
+            ReceiveAwaiter *next = nullptr;
+
+            bool await_ready() const noexcept
+            {
+                return channel->closed;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                awaiting = handle;
+                PushBack(channel->receiveHead, channel->receiveTail, this);
+            }
+
+            std::optional<std::span<const uint8_t>> await_resume() const noexcept
+            {
+                return frame;
+            }
+        };
+
+        struct SendAwaiter
+        {
+            Channel *channel;
+            std::span<const uint8_t> payload;
+            bool accepted = false;
+            std::coroutine_handle<> awaiting{};
+            SendAwaiter *next = nullptr;
+
+            bool await_ready()
+            {
+                if (channel->closed || payload.size() > maxmessageLength)
+                    return true;
+                if (channel->sendHead || channel->pending < channel->encoded)
+                    return false;
+                // Nothing queued, write the frame right away and only suspend if the transport is full
+                channel->Start(payload);
+                channel->WritePending();
+                accepted = channel->pending == channel->encoded;
+                return accepted;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                awaiting = handle;
+                if (channel->pending < channel->encoded && channel->writing == nullptr)
+                {
+                    // The frame of this sender was started in await_ready
+                    channel->writing = this;
+                }
+                else
+                {
+                    PushBack(channel->sendHead, channel->sendTail, this);
+                }
+            }
+
+            bool await_resume() const noexcept
+            {
+                return accepted;
+            }
+        };
+
+        template <typename Awaiter>
+        static void PushBack(Awaiter *&head, Awaiter *&tail, Awaiter *awaiter)
+        {
+            awaiter->next = nullptr;
+            if (tail)
+                tail->next = awaiter;
+            else
+                head = awaiter;
+            tail = awaiter;
+        }
+
+        template <typename Awaiter>
+        static Awaiter *PopFront(Awaiter *&head, Awaiter *&tail)
+        {
+            Awaiter *awaiter = head;
+            if (awaiter)
+            {
+                head = awaiter->next;
+                if (!head)
+                    tail = nullptr;
+            }
+            return awaiter;
+        }
+
+        void Deliver(const uint8_t *payload, size_t length)
+        {
+            ReceiveAwaiter *receiver = PopFront(receiveHead, receiveTail);
+            if (!receiver)
+            {
+                dropped++;
+                return;
+            }
+            receiver->frame = std::span<const uint8_t>(payload, length);
+            // Runs the coroutine until it waits again, the decoder continues with the next frame afterwards
+            receiver->awaiting.resume();
+        }
+
+        void Start(std::span<const uint8_t> payload)
+        {
+            encoded = Encode(payload.data(), payload.size(), frame.data(), frame.size());
+            pending = 0;
+        }
+
+        void WritePending()
+        {
+            while (pending < encoded)
+            {
+                size_t accepted = write(frame.data() + pending, encoded - pending);
+                if (accepted == 0)
+                    return;
+                pending += std::min(accepted, encoded - pending);
+            }
+        }
+
+        /**
+         * @brief Write the current frame and start the queued ones, resume every sender whose frame was accepted
+         */
+        void Flush()
+        {
+            if (flushing)
+                return;
+            flushing = true;
+            while (!closed)
+            {
+                WritePending();
+                if (pending < encoded)
+                    break;
+                if (SendAwaiter *done = std::exchange(writing, nullptr))
+                {
+                    done->accepted = true;
+                    done->awaiting.resume();
+                    continue;
+                }
+                SendAwaiter *sender = PopFront(sendHead, sendTail);
+                if (!sender)
+                    break;
+                Start(sender->payload);
+                writing = sender;
+            }
+            flushing = false;
+        }
+
+        WriteCallback write;
+        Decoder<maxmessageLength> decoder;
+        std::array<uint8_t, FrameBufferLength> frame; // Frame that is written now
+        size_t encoded = 0;                           // Length of the frame
+        size_t pending = 0;                           // Bytes of the frame accepted by the transport
+        SendAwaiter *writing = nullptr;               // Suspended sender of the frame
+        SendAwaiter *sendHead = nullptr;
+        SendAwaiter *sendTail = nullptr;
+        ReceiveAwaiter *receiveHead = nullptr;
+        ReceiveAwaiter *receiveTail = nullptr;
+        uint64_t dropped = 0;
+        bool closed = false;
+        bool flushing = false;
+    };
+}
+
+#endif
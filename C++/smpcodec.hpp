@@ -0,0 +1,428 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#pragma once
+
+/**
+ * Header only implementation of the smp encoder and decoder.
+ *
+ * This produces and accepts the same frames as the C library, but everything is constexpr and visible to the compiler,
+ * so the decoder inlines completely into the receive loop of the caller. The C library stays the implementation for
+ * microcontrollers and the shared library, this header is intended for host builds. All functions can also be
+ * evaluated at compile time, e.g. to generate the frames of fixed messages.
+ */
+
+#if __cplusplus >= 202002L
+#define SMP_LIKELY [[likely]]
+#define SMP_UNLIKELY [[unlikely]]
+#else
+#define SMP_LIKELY
+#define SMP_UNLIKELY
+#endif
+
+namespace smp
+{
+    constexpr uint8_t Framestart = 0xFF;
+    constexpr uint16_t CRCPolynom = 0xA001;
+
+    /**
+     * @brief Longest payload that fits into the 16 bit length field
+     */
+    constexpr size_t MaximumMessageLength = 0xFEFF - 2;
+
+    namespace detail
+    {
+        /**
+         * @brief Slice by 8 tables, table[0] is the bytewise table and table[n] advances the crc over n additional zero bytes
+         */
+        constexpr std::array<std::array<uint16_t, 256>, 8> MakeCRCTables()
+        {
+            std::array<std::array<uint16_t, 256>, 8> tables{};
+            for (size_t i = 0; i < 256; i++)
+            {
+                uint16_t crc = static_cast<uint16_t>(i);
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = (crc & 1) ? static_cast<uint16_t>((crc >> 1) ^ CRCPolynom) : static_cast<uint16_t>(crc >> 1);
+                }
+                tables[0][i] = crc;
+            }
+            for (size_t n = 1; n < tables.size(); n++)
+            {
+                for (size_t i = 0; i < 256; i++)
+                {
+                    uint16_t crc = tables[n - 1][i];
+                    tables[n][i] = static_cast<uint16_t>((crc >> 8) ^ tables[0][crc & 0xFF]);
+                }
+            }
+            return tables;
+        }
+
+        inline constexpr std::array<std::array<uint16_t, 256>, 8> CRCTables = MakeCRCTables();
+
+        /**
+         * @brief Number of bytes the value occupies after the bytestuffing
+         */
+        constexpr size_t StuffedLength(uint16_t value)
+        {
+            return 2 + ((value & 0xFF) == Framestart) + ((value >> 8) == Framestart);
+        }
+
+        constexpr size_t PutStuffed(uint8_t *out, size_t offset, uint8_t value)
+        {
+            out[offset++] = value;
+            if (value == Framestart)
+            {
+                out[offset++] = Framestart;
+            }
+            return offset;
+        }
+    }
+
+    /**
+     * @brief Update the crc with one byte
+     */
+    constexpr uint16_t CRC16(uint16_t crc, uint8_t data)
+    {
+        return static_cast<uint16_t>((crc >> 8) ^ detail::CRCTables[0][(crc ^ data) & 0xFF]);
+    }
+
+    constexpr uint16_t CRC16(uint16_t crc, const uint8_t *data, size_t length)
+    {
+        const auto &t = detail::CRCTables;
+        while (length >= 8)
+        {
+            crc = static_cast<uint16_t>(t[7][(crc ^ data[0]) & 0xFF] ^ t[6][((crc >> 8) ^ data[1]) & 0xFF] ^
+                                        t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]]);
+            data += 8;
+            length -= 8;
+        }
+        for (size_t i = 0; i < length; i++)
+        {
+            crc = CRC16(crc, data[i]);
+        }
+        return crc;
+    }
+
+    /**
+     * @brief Exact length of the frame for the payload
+     */
+    constexpr size_t EncodedLength(const uint8_t *data, size_t length)
+    {
+        size_t framestarts = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            framestarts += data[i] == Framestart;
+        }
+        return 1 + detail::StuffedLength(static_cast<uint16_t>(length + 2)) + length + framestarts + detail::StuffedLength(CRC16(0, data, length));
+    }
+
+    /**
+     * @brief Encode the payload into a frame starting at out
+     * @return The length of the frame or 0 if the payload is too long or the frame doesn't fit into outlength bytes
+     */
+    constexpr size_t Encode(const uint8_t *data, size_t length, uint8_t *out, size_t outlength)
+    {
+        if (length > MaximumMessageLength)
+            return 0;
+        // Only count the exact length if the buffer is smaller than the worst case
+        if (outlength < 2 * length + 9 && EncodedLength(data, length) > outlength)
+            return 0;
+        uint16_t lengthField = static_cast<uint16_t>(length + 2);
+        uint16_t crc = CRC16(0, data, length);
+        size_t offset = 0;
+        out[offset++] = Framestart;
+        offset = detail::PutStuffed(out, offset, static_cast<uint8_t>(lengthField & 0xFF));
+        offset = detail::PutStuffed(out, offset, static_cast<uint8_t>(lengthField >> 8));
+        for (size_t i = 0; i < length; i++)
+        {
+            offset = detail::PutStuffed(out, offset, data[i]);
+        }
+        offset = detail::PutStuffed(out, offset, static_cast<uint8_t>(crc >> 8));
+        offset = detail::PutStuffed(out, offset, static_cast<uint8_t>(crc & 0xFF));
+        return offset;
+    }
+
+    namespace detail
+    {
+        template <size_t FrameLength, size_t PayloadLength>
+        constexpr std::array<uint8_t, FrameLength> EncodeArray(const std::array<uint8_t, PayloadLength> &payload)
+        {
+            std::array<uint8_t, FrameLength> frame{};
+            Encode(payload.data(), payload.size(), frame.data(), frame.size());
+            return frame;
+        }
+
+        /**
+         * @brief Holds the encoded frame of a constant payload as static constexpr member, so every frame is stored once in the read only data
+         */
+        template <const auto &payload>
+        struct StaticFrame
+        {
+            static_assert(payload.size() <= MaximumMessageLength, "The payload is too long for a smp frame");
+            static constexpr size_t Length = EncodedLength(payload.data(), payload.size());
+            static constexpr std::array<uint8_t, Length> Frame = EncodeArray<Length>(payload);
+        };
+
+        template <uint8_t... payload>
+        struct BytePayload
+        {
+            static constexpr std::array<uint8_t, sizeof...(payload)> Payload{payload...};
+        };
+    }
+
+    /**
+     * @brief The finished wire frame for a constant payload, encoded at compile time.
+     *
+     * constexpr auto &ping = smp::MakeFrame<0x01, 0x02>();
+     * The returned array has exactly the length of the frame and can be written out without any runtime encoding.
+     */
+    template <uint8_t... payload>
+    constexpr const auto &MakeFrame()
+    {
+        return detail::StaticFrame<detail::BytePayload<payload...>::Payload>::Frame;
+    }
+
+#if __cplusplus >= 202002L
+    /**
+     * @brief String literal usable as template argument, the terminating zero is not part of the payload
+     */
+    template <size_t N>
+    struct FixedString
+    {
+        constexpr FixedString(const char (&text)[N])
+        {
+            for (size_t i = 0; i < N - 1; i++)
+            {
+                Payload[i] = static_cast<uint8_t>(text[i]);
+            }
+        }
+
+        std::array<uint8_t, N - 1> Payload{};
+    };
+
+    namespace detail
+    {
+        template <FixedString text>
+        struct StringPayload
+        {
+            static constexpr auto Payload = text.Payload;
+        };
+    }
+
+    /**
+     * @brief The finished wire frame for a string payload, encoded at compile time: smp::MakeFrame<"PING">()
+     */
+    template <FixedString text>
+    constexpr const auto &MakeFrame()
+    {
+        return detail::StaticFrame<detail::StringPayload<text>::Payload>::Frame;
+    }
+#endif
+
+    /**
+     * @brief Decoder state machine for one stream with a payload buffer of maxmessageLength bytes.
+     *
+     * The decoder accepts the same byte streams as SMP_RecieveInByte. Frames with a payload longer than maxmessageLength are dropped.
+     * Frames with an empty payload are accepted, the C decoder rejects them.
+     */
+    template <size_t maxmessageLength>
+    class Decoder
+    {
+    public:
+        static_assert(maxmessageLength <= MaximumMessageLength, "The payload length is limited by the 16 bit length field");
+
+        enum State : uint8_t
+        {
+            Idle,
+            Length,
+            Payload,
+            CRC
+        };
+
+        constexpr Decoder() = default;
+
+        /**
+         * @brief Decode one received byte
+         * @return True if the byte completed a valid frame, the payload is available with Data() and Size() until the next call
+         */
+        constexpr bool Push(uint8_t byte)
+        {
+            if (byte == Framestart)
+            {
+                if (!delimiter)
+                {
+                    delimiter = true;
+                    return false;
+                }
+                if (state == Idle)
+                {
+                    // Outside of a frame two framestarts can only be the framestart followed by the stuffed low byte 0xFF of the length field
+                    Reset();
+                    delimiter = true;
+                    state = Length;
+                    return false;
+                }
+                delimiter = false;
+            }
+            else if (delimiter)
+            {
+                Reset();
+                state = Length;
+            }
+            return Decode(byte);
+        }
+
+        /**
+         * @brief Decode a buffer of received bytes and call the callback with (const uint8_t *data, size_t length) for every valid frame.
+         * The data is only valid during the call. Frames can be split across calls.
+         * @return The number of valid frames
+         */
+        template <typename Callback>
+        constexpr size_t Receive(Callback &&callback, const uint8_t *data, size_t length)
+        {
+            size_t frames = 0;
+            const uint8_t *end = data + length;
+            while (data < end)
+            {
+                if (!delimiter)
+                {
+                    if (state == Idle)
+                    {
+                        while (data < end && *data != Framestart)
+                        {
+                            data++;
+                        }
+                        if (data == end)
+                            break;
+                    }
+                    else if (state == Payload) SMP_LIKELY
+                    {
+                        // Copy the run of payload bytes up to the next framestart or the crc and calculate its crc in one block
+                        size_t run = static_cast<size_t>(end - data);
+                        if (run > static_cast<size_t>(bytesToReceive - 2))
+                            run = bytesToReceive - 2;
+                        size_t clean = 0;
+                        while (clean < run && data[clean] != Framestart)
+                        {
+                            clean++;
+                        }
+                        uint8_t *dest = buffer.data() + received;
+                        for (size_t i = 0; i < clean; i++)
+                        {
+                            dest[i] = data[i];
+                        }
+                        crc = CRC16(crc, data, clean);
+                        received += clean;
+                        bytesToReceive = static_cast<uint16_t>(bytesToReceive - clean);
+                        data += clean;
+                        if (bytesToReceive == 2)
+                        {
+                            state = CRC;
+                        }
+                        if (data == end)
+                            break;
+                    }
+                }
+                if (Push(*data++))
+                {
+                    frames++;
+                    callback(static_cast<const uint8_t *>(buffer.data()), received);
+                }
+            }
+            return frames;
+        }
+
+        /**
+         * @brief Drop the frame that is currently received
+         */
+        constexpr void Reset()
+        {
+            state = Idle;
+            delimiter = false;
+            lengthLowReceived = false;
+            crcHighReceived = false;
+            bytesToReceive = 0;
+            crc = 0;
+            crcHighByte = 0;
+            received = 0;
+        }
+
+        constexpr State GetState() const
+        {
+            return state;
+        }
+
+        constexpr const uint8_t *Data() const
+        {
+            return buffer.data();
+        }
+
+        constexpr size_t Size() const
+        {
+            return received;
+        }
+
+    private:
+        constexpr bool Decode(uint8_t byte)
+        {
+            switch (state)
+            {
+            case Idle:
+                return false;
+            case Length:
+                if (!lengthLowReceived)
+                {
+                    bytesToReceive = byte;
+                    lengthLowReceived = true;
+                    return false;
+                }
+                bytesToReceive = static_cast<uint16_t>(bytesToReceive | (byte << 8));
+                if (bytesToReceive < 2 || static_cast<size_t>(bytesToReceive - 2) > maxmessageLength) SMP_UNLIKELY
+                {
+                    Reset();
+                    return false;
+                }
+                crc = 0;
+                received = 0;
+                state = bytesToReceive == 2 ? CRC : Payload;
+                return false;
+            case Payload:
+                buffer[received++] = byte;
+                crc = CRC16(crc, byte);
+                if (--bytesToReceive == 2)
+                {
+                    state = CRC;
+                }
+                return false;
+            case CRC:
+                if (!crcHighReceived)
+                {
+                    crcHighByte = byte;
+                    crcHighReceived = true;
+                    return false;
+                }
+                {
+                    bool valid = crc == static_cast<uint16_t>((crcHighByte << 8) | byte);
+                    size_t length = received;
+                    Reset();
+                    // The payload stays in the buffer until the next frame starts
+                    received = valid ? length : 0;
+                    return valid;
+                }
+            }
+            return false;
+        }
+
+        State state = Idle;
+        bool delimiter = false;
+        bool lengthLowReceived = false;
+        bool crcHighReceived = false;
+        uint16_t bytesToReceive = 0;
+        uint16_t crc = 0;
+        uint8_t crcHighByte = 0;
+        size_t received = 0;
+        std::array<uint8_t, maxmessageLength> buffer{};
+    };
+}
@@ -0,0 +1,124 @@
+#include "libfecmp.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+
+#pragma once
+
+/**
+ * @brief Smp frames protected by interleaved reed solomon codes, with the transmit and receive functions of SMP.
+ *
+ * The frames are encoded and decoded by the fecmp library (see libfecmp.h), link smp::fecmp.
+ * interleaveDepth is the minimum number of codewords per frame, a burst of up to interleaveDepth * NPAR / 2 wrong bytes is corrected.
+ * Sender and receiver don't need the same depth, but the receive buffer is only sized for frames with at most this depth.
+ *
+ * Each object holds the decoder state and a receive buffer for the data and the parity of one frame.
+ * Transmit encodes into a local buffer of TransmitArrayLength bytes on the stack.
+ */
+template <size_t maxmessageLength, uint8_t interleaveDepth = 1>
+class SMPFec
+{
+public:
+    static_assert(SMP_SEND_BUFFER_LENGTH(maxmessageLength) <= FEC_MAX_FRAME_LENGTH, "The smp frame doesn't fit into FEC_MAX_DEPTH codewords");
+
+    static constexpr size_t ReceiveArrayLength = FEC_RECEIVE_BUFFER_LENGTH(maxmessageLength, interleaveDepth);
+    static constexpr size_t TransmitArrayLength = FEC_SEND_BUFFER_LENGTH(maxmessageLength, interleaveDepth);
+
+    SMPFec()
+    {
+        libfecmp_settings_t settings{};
+        settings.data = receiveBuffer.data();
+        settings.bufferlength = receiveBuffer.size();
+        settings.depth = interleaveDepth;
+        fec_Init(&fec, &settings);
+    }
+
+    // The decoder references the own receive buffer
+    SMPFec(const SMPFec &) = delete;
+    SMPFec &operator=(const SMPFec &) = delete;
+
+    using TransmitCallback = std::function<size_t(uint8_t *, size_t)>;
+    using ReceiveCallback = std::function<void(const uint8_t *, size_t)>;
+
+    size_t Transmit(const TransmitCallback &callback, const void *buffer, size_t length)
+    {
+        return Transmit<const TransmitCallback &>(callback, buffer, length);
+    }
+
+    /**
+     * @brief Encode the payload and pass the whole fec frame to the callback
+     * @return The payload length or 0 on error
+     */
+    template <typename Callback>
+    size_t Transmit(Callback &&callback, const void *buffer, size_t length)
+    {
+        std::array<uint8_t, TransmitArrayLength> frame;
+        return TransmitBuffer(std::forward<Callback>(callback), buffer, length, frame);
+    }
+
+    template <typename Callback>
+    size_t TransmitBuffer(Callback &&callback, const void *buffer, size_t length, std::array<uint8_t, TransmitArrayLength> &workingBuffer)
+    {
+        if (length > maxmessageLength)
+            return 0;
+        size_t framelength = fec_encode(static_cast<const uint8_t *>(buffer), length, workingBuffer.data(), workingBuffer.size(), &fec);
+        if (framelength > 0 && callback(workingBuffer.data(), framelength) == framelength)
+            return length;
+        return 0;
+    }
+
+    size_t Receive(const ReceiveCallback &callback, const void *buffer, size_t length)
+    {
+        return Receive<const ReceiveCallback &>(callback, buffer, length);
+    }
+
+    /**
+     * @brief Decode received bytes, the callback is called with (const uint8_t *data, size_t length) for every valid frame.
+     * The data is only valid during the call.
+     * @return The number of valid frames
+     */
+    template <typename Callback>
+    size_t Receive(Callback &&callback, const void *buffer, size_t length)
+    {
+        if constexpr (std::is_function_v<std::remove_reference_t<Callback>>)
+        {
+            return Receive(&callback, buffer, length);
+        }
+        else
+        {
+            return fec_receiveBuffer(&fec, static_cast<const uint8_t *>(buffer), length, &FrameTrampoline<Callback>, ContextPointer(callback));
+        }
+    }
+
+    /**
+     * @brief Drop the frame that is currently received, the statistics are kept
+     */
+    void ResetReceiver()
+    {
+        fec_Reset(&fec);
+    }
+
+    const libfecmp_stats_t &Statistics() const
+    {
+        return fec.stats;
+    }
+
+private:
+    template <typename Callback>
+    static void FrameTrampoline(void *context, const uint8_t *data, uint32_t length)
+    {
+        (*static_cast<std::remove_reference_t<Callback> *>(context))(data, static_cast<size_t>(length));
+    }
+
+    template <typename Callback>
+    static void *ContextPointer(Callback &callback)
+    {
+        return const_cast<void *>(static_cast<const void *>(std::addressof(callback)));
+    }
+
+    libfecmp_t fec;
+    std::array<uint8_t, ReceiveArrayLength> receiveBuffer;
+};
@@ -0,0 +1,264 @@
+#include "libsmp.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#pragma once
+
+/**
+ * @brief Receiver that decodes the frames directly into the slots of a fixed pool, so the frames can be kept without copying them.
+ *
+ * Every valid frame is passed to the callback as a Frame, a reference counted view on the slot with the payload. Copies of the view share
+ * the slot, the slot returns to the pool when the last view is destroyed or released. Views can be passed to other threads and released there,
+ * but only one thread may call Receive and the views must not outlive the pool.
+ *
+ * If all slots are in use when a frame starts, the frame is received into an internal buffer and copied into a slot when it is complete.
+ * If there is still no free slot, the frame is dropped and counted in DroppedFrames.
+ */
+template <size_t maxmessageLength, size_t SlotCount>
+class SMPFramePool
+{
+    struct Slot;
+
+public:
+    static_assert(SlotCount > 0 && SlotCount < UINT32_MAX, "The pool needs at least one slot");
+
+    /**
+     * @brief Reference counted view on a received frame
+     */
+    class Frame
+    {
+    public:
+        Frame() = default;
+
+        Frame(const Frame &other) : slot(other.slot), pool(other.pool)
+        {
+            if (slot)
+            {
+                slot->references.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        Frame(Frame &&other) noexcept : slot(std::exchange(other.slot, nullptr)), pool(other.pool)
+        {
+        }
+
+        Frame &operator=(Frame other) noexcept
+        {
+            std::swap(slot, other.slot);
+            std::swap(pool, other.pool);
+            return *this;
+        }
+
+        ~Frame()
+        {
+            Release();
+        }
+
+        /**
+         * @brief Drop this reference, the slot is returned to the pool with the last reference
+         */
+        void Release()
+        {
+            if (slot && slot->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                pool->Free(slot);
+            }
+            slot = nullptr;
+        }
+
+        const uint8_t *data() const
+        {
+            return slot ? slot->data.data() : nullptr;
+        }
+
+        size_t size() const
+        {
+            return slot ? slot->length : 0;
+        }
+
+        const uint8_t *begin() const
+        {
+            return data();
+        }
+
+        const uint8_t *end() const
+        {
+            return data() + size();
+        }
+
+        explicit operator bool() const
+        {
+            return slot != nullptr;
+        }
+
+    private:
+        friend class SMPFramePool;
+
+        Frame(Slot *frameslot, SMPFramePool *owner) : slot(frameslot), pool(owner)
+        {
+        }
+
+        Slot *slot = nullptr;
+        SMPFramePool *pool = nullptr;
+    };
+
+    SMPFramePool()
+    {
+        SMP_Init(&smp);
+        for (size_t i = 0; i < SlotCount; i++)
+        {
+            slots[i].next = i + 1 < SlotCount ? static_cast<uint32_t>(i + 1) : NoSlot;
+        }
+        freeHead.store(0, std::memory_order_relaxed);
+        current = Acquire();
+    }
+
+    SMPFramePool(const SMPFramePool &) = delete;
+    SMPFramePool &operator=(const SMPFramePool &) = delete;
+
+    /**
+     * @brief Decode the received bytes and pass every valid frame to callback(Frame frame). Frames can be split across calls.
+     * @return The number of valid frames including the dropped frames
+     */
+    template <typename Callback>
+    size_t Receive(Callback &&callback, const void *buffer, size_t length)
+    {
+        if constexpr (std::is_function_v<std::remove_reference_t<Callback>>)
+        {
+            return Receive(&callback, buffer, length);
+        }
+        else
+        {
+            if (!current && smp.bytesRecieved == 0)
+            {
+                // A slot may have been released since the last frame, switch as long as nothing is received into the internal buffer
+                current = Acquire();
+            }
+            ReceiveContext<std::remove_reference_t<Callback>> context{this, &callback};
+            uint8_t *framebuffer = FrameBuffer();
+            return SMP_ReceiveBufferSwap(&smp, static_cast<const uint8_t *>(buffer), length, &framebuffer, maxmessageLength,
+                                         &FrameTrampoline<std::remove_reference_t<Callback>>, &context);
+        }
+    }
+
+    /**
+     * @brief Drop the frame that is currently received, the statistics are kept
+     */
+    void ResetReceiver()
+    {
+        SMP_ResetDecoderState(&smp, false);
+        smp.bytesRecieved = 0;
+    }
+
+    /**
+     * @brief Snapshot of the statistics, all zero if the library is compiled without SMP_ENABLE_STATS
+     */
+    smp_stats_snapshot_t Statistics() const
+    {
+        smp_stats_snapshot_t snapshot;
+        SMP_StatsSnapshot(&smp, &snapshot);
+        return snapshot;
+    }
+
+    /**
+     * @brief Number of valid frames that were dropped because all slots were in use
+     */
+    uint64_t DroppedFrames() const
+    {
+        return dropped;
+    }
+
+private:
+    static constexpr uint32_t NoSlot = UINT32_MAX;
+    static constexpr size_t SlotAlignment = SMP_RING_CACHELINE > alignof(std::atomic<uint32_t>) ? SMP_RING_CACHELINE : alignof(std::atomic<uint32_t>);
+
+    // Every slot on its own cache lines, so releasing a frame on another thread doesn't disturb the receiver
+    struct alignas(SlotAlignment) Slot
+    {
+        std::atomic<uint32_t> references{0};
+        uint32_t length = 0;
+        uint32_t next = NoSlot; // Next free slot while the slot is in the free list
+        std::array<uint8_t, maxmessageLength> data;
+    };
+
+    template <typename Callback>
+    struct ReceiveContext
+    {
+        SMPFramePool *pool;
+        Callback *callback;
+    };
+
+    template <typename Callback>
+    static uint8_t *FrameTrampoline(void *context, uint8_t *, uint32_t length)
+    {
+        auto &receive = *static_cast<ReceiveContext<Callback> *>(context);
+        return receive.pool->Complete(*receive.callback, length);
+    }
+
+    /**
+     * @brief Hand the completed frame to the callback and return the framebuffer for the next frame
+     */
+    template <typename Callback>
+    uint8_t *Complete(Callback &callback, uint32_t length)
+    {
+        Slot *slot = current;
+        if (!slot)
+        {
+            slot = Acquire();
+            if (!slot)
+            {
+                dropped++;
+                return internalBuffer.data();
+            }
+            std::memcpy(slot->data.data(), internalBuffer.data(), length);
+        }
+        slot->length = length;
+        slot->references.store(1, std::memory_order_relaxed);
+        callback(Frame(slot, this));
+        current = Acquire();
+        return FrameBuffer();
+    }
+
+    uint8_t *FrameBuffer()
+    {
+        return current ? current->data.data() : internalBuffer.data();
+    }
+
+    /**
+     * @brief Take a slot from the free list, only called by the receiver.
+     * There is only one thread that removes slots, so the next link of the head can't change during the exchange.
+     */
+    Slot *Acquire()
+    {
+        uint32_t head = freeHead.load(std::memory_order_acquire);
+        while (head != NoSlot && !freeHead.compare_exchange_weak(head, slots[head].next, std::memory_order_acquire, std::memory_order_acquire))
+        {
+        }
+        return head == NoSlot ? nullptr : &slots[head];
+    }
+
+    /**
+     * @brief Return a slot to the free list, called by the thread that releases the last view
+     */
+    void Free(Slot *slot)
+    {
+        uint32_t index = static_cast<uint32_t>(slot - slots.data());
+        uint32_t head = freeHead.load(std::memory_order_relaxed);
+        do
+        {
+            slot->next = head;
+        } while (!freeHead.compare_exchange_weak(head, index, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    smp_struct_t smp;
+    Slot *current = nullptr; // Slot of the frame that is currently received, the internal buffer is used if it is null
+    uint64_t dropped = 0;
+    std::atomic<uint32_t> freeHead{NoSlot};
+    std::array<Slot, SlotCount> slots;
+    std::array<uint8_t, maxmessageLength> internalBuffer;
+};
@@ -0,0 +1,172 @@
+#include "libsmp.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+#pragma once
+
+/**
+ * @brief Decoder for many independent smp streams, e.g. one per serial port.
+ *
+ * The decoder states of all channels are stored in one flat array and the receive buffers in a second one,
+ * so the states of all channels share a few cache lines and no channel allocates memory after construction.
+ * The channel index can be stored in the event data of an epoll loop (epoll_event.data.u32) and passed to Drain or DrainFd
+ * when the file descriptor becomes readable.
+ *
+ * The frame callbacks are called with (size_t channel, const uint8_t *data, size_t length). The data is only valid during the call.
+ */
+template <size_t maxmessageLength>
+class SMPMultiplexer
+{
+public:
+    static constexpr size_t FrameBufferLength = SMP<maxmessageLength>::ReceiveArrayLength;
+    static constexpr size_t ReadChunkLength = 16384;
+
+    explicit SMPMultiplexer(size_t channelcount)
+        : states(channelcount), framebuffers(channelcount * FrameBufferLength), readbuffer(ReadChunkLength)
+    {
+        for (auto &state : states)
+        {
+            SMP_Init(&state);
+        }
+    }
+
+    size_t ChannelCount() const
+    {
+        return states.size();
+    }
+
+    /**
+     * @brief Drop the frame that is currently received on the channel, the statistics are kept
+     */
+    void Reset(size_t channel)
+    {
+        SMP_ResetDecoderState(&states[channel], false);
+        states[channel].bytesRecieved = 0;
+    }
+
+    /**
+     * @brief Snapshot of the statistics of the channel, all zero if the library is compiled without SMP_ENABLE_STATS
+     */
+    smp_stats_snapshot_t Statistics(size_t channel) const
+    {
+        smp_stats_snapshot_t snapshot;
+        SMP_StatsSnapshot(&states[channel], &snapshot);
+        return snapshot;
+    }
+
+    /**
+     * @brief Last receiver error of the channel, cleared by the call (see SMP_GetLastError)
+     */
+    signed char LastError(size_t channel)
+    {
+        return SMP_GetLastError(&states[channel]);
+    }
+
+    /**
+     * @brief Count frames that were encoded for the channel outside of the multiplexer, e.g. by SMPTransport
+     */
+    void CountSent(size_t channel, size_t frames, size_t payloadbytes, size_t framebytes)
+    {
+#ifdef SMP_ENABLE_STATS
+        SMP_StatsAddSent(&states[channel], frames, payloadbytes, framebytes);
+#else
+        (void)channel;
+        (void)frames;
+        (void)payloadbytes;
+        (void)framebytes;
+#endif
+    }
+
+    /**
+     * @brief Decode received bytes of one channel
+     * @return The number of valid frames
+     */
+    template <typename Callback>
+    uint32_t Receive(size_t channel, Callback &&callback, const void *buffer, size_t length)
+    {
+        ChannelContext<std::remove_reference_t<Callback>> context{std::addressof(callback), channel};
+        return SMP_ReceiveBuffer(&states[channel], static_cast<const uint8_t *>(buffer), length,
+                                 framebuffers.data() + channel * FrameBufferLength, FrameBufferLength,
+                                 &FrameTrampoline<std::remove_reference_t<Callback>>, &context);
+    }
+
+    /**
+     * @brief Read all available data of a channel and decode it
+     *
+     * read is called with (uint8_t *buffer, size_t length) and returns the number of bytes read, 0 at the end of the stream
+     * and a negative value if no data is available or an error occured. Reading stops at the first short read.
+     * @return The number of bytes decoded or -1 if read reported the end of the stream or an error
+     */
+    template <typename Read, typename Callback>
+    ptrdiff_t Drain(size_t channel, Read &&read, Callback &&callback)
+    {
+        ptrdiff_t total = 0;
+        while (true)
+        {
+            ptrdiff_t count = read(readbuffer.data(), readbuffer.size());
+            if (count <= 0)
+            {
+                return count == 0 ? -1 : total;
+            }
+            Receive(channel, callback, readbuffer.data(), static_cast<size_t>(count));
+            total += count;
+            if (static_cast<size_t>(count) < readbuffer.size())
+            {
+                return total;
+            }
+        }
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    /**
+     * @brief Drain a non blocking file descriptor, for the use in an epoll or poll loop
+     * @return The number of bytes decoded or -1 if the descriptor was closed or reading failed (see errno)
+     */
+    template <typename Callback>
+    ptrdiff_t DrainFd(size_t channel, int fd, Callback &&callback)
+    {
+        bool failed = false;
+        ptrdiff_t total = Drain(
+            channel, [fd, &failed](uint8_t *buffer, size_t length) -> ptrdiff_t {
+                ssize_t count;
+                do
+                {
+                    count = ::read(fd, buffer, length);
+                } while (count < 0 && errno == EINTR);
+                if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    failed = true;
+                }
+                return count;
+            },
+            callback);
+        return failed ? -1 : total;
+    }
+#endif
+
+private:
+    template <typename Callback>
+    struct ChannelContext
+    {
+        Callback *callback;
+        size_t channel;
+    };
+
+    template <typename Callback>
+    static void FrameTrampoline(void *context, const uint8_t *data, uint32_t length)
+    {
+        auto *channelcontext = static_cast<ChannelContext<Callback> *>(context);
+        (*channelcontext->callback)(channelcontext->channel, data, static_cast<size_t>(length));
+    }
+
+    std::vector<smp_struct_t> states;
+    std::vector<uint8_t> framebuffers;
+    std::vector<uint8_t> readbuffer;
+};
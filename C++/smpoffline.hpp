@@ -0,0 +1,512 @@
+#include "libsmp.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SMP_OFFLINE_HAS_MMAP 1
+#endif
+
+#pragma once
+
+/**
+ * @brief Parallel decoder for captured streams that are completely in memory, e.g. a memory mapped capture file.
+ *
+ * The capture is split into chunks that are scanned and validated in parallel. Every chunk starts with an idle decoder and
+ * resynchronizes on the next framestart (framestart followed by a byte that is not a framestart, as in SMP_RecieveInByte).
+ * A frame belongs to the chunk in which it starts, the scan of that chunk continues past the chunk end to finish it.
+ * Afterwards the chunks are joined in order: if the decoder state at the end of a chunk isn't the idle state the next chunk
+ * assumed, the next chunk is scanned again from the real state until both scans reach the same state. Usually this happens
+ * at the first framestart, so the result is the same as decoding the whole capture sequentially.
+ *
+ * A chunk is joined and freed as soon as it and its predecessor are done, at most twice the number of threads chunks are scanned ahead,
+ * so the memory use doesn't grow with the capture length.
+ *
+ * The frames are passed to the callback in stream order on the calling thread with (uint64_t offset, const uint8_t *data, size_t length).
+ * offset is the position of the framestart in the capture.
+ */
+template <size_t maxmessageLength>
+class SMPOfflineDecoder
+{
+public:
+    static constexpr size_t DefaultChunkLength = 4 * 1024 * 1024;
+
+    explicit SMPOfflineDecoder(size_t threadcount = 0, size_t chunkLength = DefaultChunkLength)
+        : threads(threadcount ? threadcount : std::max(1u, std::thread::hardware_concurrency())), chunklength(std::max<size_t>(chunkLength, 1))
+    {
+    }
+
+    /**
+     * @brief Decode the capture
+     * @return The number of valid frames
+     */
+    template <typename Callback>
+    size_t Decode(const uint8_t *data, size_t length, Callback &&callback)
+    {
+        return DecodeChunks(data, length, callback, [](size_t) {});
+    }
+
+#ifdef SMP_OFFLINE_HAS_MMAP
+    /**
+     * @brief Memory map the capture file and decode it, the pages of the joined chunks are dropped from the mapping
+     * @return The number of valid frames or -1 if the file can't be mapped (see errno)
+     */
+    template <typename Callback>
+    ptrdiff_t DecodeFile(const char *path, Callback &&callback)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return -1;
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        size_t length = static_cast<size_t>(st.st_size);
+        if (length == 0)
+        {
+            ::close(fd);
+            return 0;
+        }
+        void *map = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+            return -1;
+        ::madvise(map, length, MADV_SEQUENTIAL);
+        uint8_t *pages = static_cast<uint8_t *>(map);
+        size_t pagesize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        size_t released = 0;
+        size_t frames = DecodeChunks(pages, length, callback, [&](size_t end)
+                                     {
+                                         end -= end % pagesize;
+                                         if (end > released)
+                                         {
+                                             ::madvise(pages + released, end - released, MADV_DONTNEED);
+                                             released = end;
+                                         } });
+        ::munmap(map, length);
+        return static_cast<ptrdiff_t>(frames);
+    }
+#endif
+
+    /**
+     * @brief Number of frames with a crc error or a bytestuffing error in the last decoded capture
+     */
+    size_t InvalidFrames() const
+    {
+        return invalid;
+    }
+
+private:
+    /**
+     * @brief Decode the capture, release is called with the position before which the data isn't read anymore
+     */
+    template <typename Callback, typename Release>
+    size_t DecodeChunks(const uint8_t *data, size_t length, Callback &callback, Release &&release)
+    {
+        size_t chunkcount = (length + chunklength - 1) / chunklength;
+        size_t window = std::min(chunkcount, 2 * threads);
+        std::vector<Chunk> chunks(window);
+        Schedule schedule;
+
+        // Claim the next chunk if it is within the window and scan it, the lock is released during the scan
+        auto scanNext = [&](std::unique_lock<std::mutex> &lock)
+        {
+            if (schedule.stop || schedule.next == chunkcount || schedule.next >= schedule.delivered + window)
+                return false;
+            size_t i = schedule.next++;
+            Chunk &chunk = chunks[i % window];
+            lock.unlock();
+            chunk.start = i * chunklength;
+            chunk.end = std::min(length, chunk.start + chunklength);
+            ScanChunk(data, length, chunk, ScanState{}, chunk.start, nullptr);
+            Validate(data, chunk, 0);
+            lock.lock();
+            chunk.done = true;
+            schedule.changed.notify_all();
+            return true;
+        };
+        auto work = [&]()
+        {
+            std::unique_lock<std::mutex> lock(schedule.mutex);
+            while (!schedule.stop && schedule.next < chunkcount)
+            {
+                if (!scanNext(lock))
+                {
+                    schedule.changed.wait(lock);
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        WorkerGuard guard{schedule, workers};
+        for (size_t i = 1; i < std::min(threads, chunkcount); i++)
+        {
+            workers.emplace_back(work);
+        }
+
+        // Join the chunks in order as soon as they are scanned, rescan a chunk if it didn't start in the state the previous chunk ended with.
+        // The calling thread scans chunks too while it waits for the next one.
+        ScanState state{};
+        size_t frames = 0;
+        invalid = 0;
+        for (size_t i = 0; i < chunkcount; i++)
+        {
+            Chunk &chunk = chunks[i % window];
+            {
+                std::unique_lock<std::mutex> lock(schedule.mutex);
+                while (!chunk.done)
+                {
+                    if (!scanNext(lock))
+                    {
+                        schedule.changed.wait(lock);
+                    }
+                }
+            }
+            if (!(state == ScanState{}))
+            {
+                Rescan(data, length, chunk, state);
+            }
+            state = chunk.endstate;
+            for (const auto &candidate : chunk.candidates)
+            {
+                if (candidate.valid)
+                {
+                    callback(candidate.offset, chunk.payloads.data() + candidate.payloadoffset, static_cast<size_t>(candidate.payloadlength));
+                    frames++;
+                }
+                else
+                {
+                    invalid++;
+                }
+            }
+            // Free the chunk, the slot is used for the chunk window positions later. The next chunk may start with the framestart before it.
+            release(chunk.end - 1);
+            chunk = Chunk{};
+            std::lock_guard<std::mutex> lock(schedule.mutex);
+            schedule.delivered = i + 1;
+            schedule.changed.notify_all();
+        }
+        return frames;
+    }
+
+    enum Phase : uint8_t
+    {
+        Idle,
+        Header,
+        Body
+    };
+
+    /**
+     * @brief The state of the frame scanner, this follows the bytestuffing the same way as SMP_RecieveInByte
+     */
+    struct ScanState
+    {
+        Phase phase = Idle;
+        bool delimiter = false;
+        uint8_t headerbytes = 0;
+        uint16_t lengthField = 0;
+        size_t remaining = 0;
+        uint64_t framestart = 0;
+
+        bool operator==(const ScanState &other) const
+        {
+            return phase == other.phase && delimiter == other.delimiter && headerbytes == other.headerbytes &&
+                   lengthField == other.lengthField && remaining == other.remaining && framestart == other.framestart;
+        }
+    };
+
+    struct Candidate
+    {
+        uint64_t offset;       // Position of the framestart, the frame belongs to the chunk containing the byte after it
+        size_t framelength;    // Stuffed length including the framestart
+        size_t payloadoffset;  // Position in Chunk::payloads
+        uint16_t payloadlength;
+        bool valid;
+    };
+
+    struct Chunk
+    {
+        size_t start = 0;
+        size_t end = 0;
+        ScanState endstate;
+        std::vector<Candidate> candidates;
+        std::vector<uint64_t> checkpoints; // Positions at which the first scan was idle between two frames
+        std::vector<uint8_t> payloads;
+        bool done = false; // Scanned and validated, guarded by Schedule::mutex
+    };
+
+    /**
+     * @brief Chunks claimed by the workers and joined by the calling thread
+     */
+    struct Schedule
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        size_t next = 0;      // The next chunk to scan
+        size_t delivered = 0; // The chunks before this one are joined and freed
+        bool stop = false;
+    };
+
+    /**
+     * @brief Stops and joins the workers when Decode returns or the callback throws
+     */
+    struct WorkerGuard
+    {
+        Schedule &schedule;
+        std::vector<std::thread> &workers;
+
+        ~WorkerGuard()
+        {
+            {
+                std::lock_guard<std::mutex> lock(schedule.mutex);
+                schedule.stop = true;
+            }
+            schedule.changed.notify_all();
+            for (auto &worker : workers)
+            {
+                worker.join();
+            }
+        }
+    };
+
+    /**
+     * @brief Compares the rescan with the checkpoints of the first scan.
+     * Once both scans have the same state they stay the same, so it's enough to compare them when they are idle between two frames.
+     */
+    struct Convergence
+    {
+        const std::vector<uint64_t> &checkpoints;
+        size_t index;
+        uint64_t position; // Set when the rescan reached a state of the first scan
+    };
+
+    /**
+     * @brief Scan the chunk from start on with the state and collect the candidate frames that begin in the chunk.
+     * The scan continues past the chunk end until the frame that is received at the end is finished.
+     * @param convergence Compare the states with the checkpoints of the first scan instead of recording them
+     * @return false if the scan reached a state of the first scan and stopped there
+     */
+    bool ScanChunk(const uint8_t *data, size_t length, Chunk &chunk, ScanState state, size_t start, Convergence *convergence)
+    {
+        size_t pos = start;
+        bool finishing = false;
+        while (pos < length)
+        {
+            if (pos == chunk.end && !finishing)
+            {
+                chunk.endstate = state;
+                if (state.phase == Idle)
+                    return true;
+                finishing = true;
+            }
+            size_t limit = (finishing ? length : chunk.end) - pos;
+            if (!state.delimiter && state.phase == Idle)
+            {
+                // Outside of a frame only a framestart changes the state
+                const uint8_t *framestart = static_cast<const uint8_t *>(std::memchr(data + pos, FRAMESTART, limit));
+                if (!framestart)
+                {
+                    pos += limit;
+                    continue;
+                }
+                pos = static_cast<size_t>(framestart - data);
+            }
+            else if (!state.delimiter && state.phase == Body && state.remaining > 1)
+            {
+                // Skip the run of payload bytes up to the next framestart, the last byte of the frame is scanned below
+                size_t run = std::min(limit, state.remaining - 1);
+                const uint8_t *framestart = static_cast<const uint8_t *>(std::memchr(data + pos, FRAMESTART, run));
+                if (framestart)
+                    run = static_cast<size_t>(framestart - (data + pos));
+                pos += run;
+                state.remaining -= run;
+                if (run > 0)
+                    continue;
+            }
+
+            int event = ScanByte(state, data[pos], pos);
+            pos++;
+            if (event == NoEvent)
+                continue;
+            if (event == BeginEvent && finishing)
+            {
+                // This frame begins after the chunk end and belongs to the next chunk
+                return true;
+            }
+            if (event == CompleteEvent)
+            {
+                uint64_t begin = state.framestart + 1;
+                if (begin >= chunk.start)
+                {
+                    chunk.candidates.push_back(Candidate{state.framestart, pos - state.framestart, 0, static_cast<uint16_t>(state.lengthField - 2), false});
+                }
+                state = ScanState{};
+            }
+            if (finishing)
+            {
+                if (state.phase == Idle)
+                    return true;
+            }
+            else if (convergence)
+            {
+                auto &checkpoints = convergence->checkpoints;
+                while (convergence->index < checkpoints.size() && checkpoints[convergence->index] < pos)
+                {
+                    convergence->index++;
+                }
+                if (convergence->index < checkpoints.size() && checkpoints[convergence->index] == pos && state == ScanState{})
+                {
+                    convergence->position = pos;
+                    return false;
+                }
+            }
+            else if (state == ScanState{})
+            {
+                chunk.checkpoints.push_back(pos);
+            }
+        }
+        if (!finishing)
+        {
+            chunk.endstate = state;
+        }
+        return true;
+    }
+
+    static constexpr int NoEvent = 0;
+    static constexpr int BeginEvent = 1;
+    static constexpr int CompleteEvent = 2;
+    static constexpr int AbortEvent = 3;
+
+    /**
+     * @brief Process the byte at position
+     * @return The event that was caused by the byte
+     */
+    static int ScanByte(ScanState &state, uint8_t byte, uint64_t position)
+    {
+        if (byte == FRAMESTART)
+        {
+            if (!state.delimiter)
+            {
+                state.delimiter = true;
+                return NoEvent;
+            }
+            if (state.phase == Idle)
+            {
+                // Framestart followed by the stuffed low byte 0xFF of the length field
+                state = ScanState{};
+                state.phase = Header;
+                state.delimiter = true;
+                state.framestart = position - 1;
+                return BeginEvent;
+            }
+            state.delimiter = false;
+        }
+        else if (state.delimiter)
+        {
+            state = ScanState{};
+            state.phase = Header;
+            state.framestart = position - 1;
+            ScanDecodedByte(state, byte);
+            return BeginEvent;
+        }
+        return ScanDecodedByte(state, byte);
+    }
+
+    static int ScanDecodedByte(ScanState &state, uint8_t byte)
+    {
+        switch (state.phase)
+        {
+        case Idle:
+            return NoEvent;
+        case Header:
+            if (state.headerbytes++ == 0)
+            {
+                state.lengthField = byte;
+                return NoEvent;
+            }
+            state.lengthField = static_cast<uint16_t>(state.lengthField | (byte << 8));
+            // Empty frames are dropped like in SMP_ReceiveBuffer
+            if (state.lengthField <= 2 || static_cast<size_t>(state.lengthField - 2) > maxmessageLength)
+            {
+                state = ScanState{};
+                return AbortEvent;
+            }
+            state.phase = Body;
+            state.remaining = state.lengthField; // Payload and crc
+            return NoEvent;
+        case Body:
+            return --state.remaining == 0 ? CompleteEvent : NoEvent;
+        }
+        return NoEvent;
+    }
+
+    /**
+     * @brief Validate the candidates from the index first on and extract their payloads
+     */
+    void Validate(const uint8_t *data, Chunk &chunk, size_t first)
+    {
+        for (size_t i = first; i < chunk.candidates.size(); i++)
+        {
+            Candidate &candidate = chunk.candidates[i];
+            size_t offset = chunk.payloads.size();
+            chunk.payloads.resize(offset + candidate.payloadlength);
+            candidate.payloadoffset = offset;
+            candidate.valid = SMP_PacketDecode(data + candidate.offset, candidate.framelength, chunk.payloads.data() + offset,
+                                               candidate.payloadlength, &candidate.payloadlength);
+            if (!candidate.valid)
+            {
+                chunk.payloads.resize(offset);
+            }
+        }
+    }
+
+    /**
+     * @brief Scan the chunk again with the real state at its start until the state equals the state of the first scan
+     */
+    void Rescan(const uint8_t *data, size_t length, Chunk &chunk, const ScanState &state)
+    {
+        Chunk rescan;
+        rescan.start = chunk.start;
+        rescan.end = chunk.end;
+        Convergence convergence{chunk.checkpoints, 0, 0};
+        bool converged = !ScanChunk(data, length, rescan, state, chunk.start, &convergence);
+        if (converged)
+        {
+            // The candidates that were completed before the common state come from the rescan and the rest from the first scan
+            rescan.payloads = std::move(chunk.payloads);
+            rescan.endstate = chunk.endstate;
+        }
+        size_t rescanned = rescan.candidates.size();
+        if (converged)
+        {
+            for (const auto &candidate : chunk.candidates)
+            {
+                if (candidate.offset + candidate.framelength > convergence.position)
+                {
+                    rescan.candidates.push_back(candidate);
+                }
+            }
+        }
+        std::vector<Candidate> kept(rescan.candidates.begin() + rescanned, rescan.candidates.end());
+        rescan.candidates.resize(rescanned);
+        Validate(data, rescan, 0);
+        rescan.candidates.insert(rescan.candidates.end(), kept.begin(), kept.end());
+        chunk.candidates = std::move(rescan.candidates);
+        chunk.payloads = std::move(rescan.payloads);
+        chunk.endstate = rescan.endstate;
+    }
+
+    size_t threads;
+    size_t chunklength;
+    size_t invalid = 0;
+};
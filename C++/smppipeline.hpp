@@ -0,0 +1,406 @@
+#include "libsmp.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#pragma once
+
+/**
+ * @brief Multithreaded decoder for one high rate stream.
+ *
+ * The thread that calls Receive only scans the stream for the frame boundaries. It follows the framestarts, the
+ * bytestuffing and the length field and copies every candidate frame still stuffed into a job.
+ * The crc check and the removal of the bytestuffing (SMP_PacketDecode) and the frame handler run on a pool of worker threads.
+ * Every worker has its own queue, idle workers steal jobs from the other queues.
+ *
+ * With ordered delivery the handler is called for the frames in stream order, one frame at a time. Without it the handler is
+ * called concurrently from the worker threads as soon as a frame is validated, so it has to be thread safe.
+ * The handler is called with (const uint8_t *data, size_t length), the data is only valid during the call.
+ *
+ * At most QueueDepth frames are in flight, Receive blocks if all jobs are in use.
+ */
+template <size_t maxmessageLength>
+class SMPPipeline
+{
+public:
+    using FrameHandler = std::function<void(const uint8_t *, size_t)>;
+
+    static constexpr size_t MaximumFrameLength = SMP_SEND_BUFFER_LENGTH(maxmessageLength);
+    static constexpr size_t DefaultQueueDepth = 256;
+
+    explicit SMPPipeline(FrameHandler frameHandler, size_t workercount = 0, bool orderedDelivery = true, size_t queueDepth = DefaultQueueDepth)
+        : handler(std::move(frameHandler)), ordered(orderedDelivery), jobs(std::max<size_t>(queueDepth, 1)), completed(jobs.size(), nullptr)
+    {
+        if (workercount == 0)
+        {
+            workercount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        freejobs.reserve(jobs.size());
+        for (auto &job : jobs)
+        {
+            job.frame.resize(MaximumFrameLength);
+            job.payload.resize(maxmessageLength);
+            freejobs.push_back(&job);
+        }
+        queues = std::make_unique<WorkerQueue[]>(workercount);
+        for (size_t i = 0; i < workercount; i++)
+        {
+            workers.emplace_back(&SMPPipeline::Work, this, i, workercount);
+        }
+    }
+
+    SMPPipeline(const SMPPipeline &) = delete;
+    SMPPipeline &operator=(const SMPPipeline &) = delete;
+
+    ~SMPPipeline()
+    {
+        Flush();
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    /**
+     * @brief Scan the received bytes for frames and pass the complete frames to the workers.
+     * Only one thread may call Receive. Frames can be split across calls.
+     */
+    void Receive(const void *buffer, size_t length)
+    {
+        const uint8_t *data = static_cast<const uint8_t *>(buffer);
+        const uint8_t *end = data + length;
+        while (data < end)
+        {
+            if (!delimiter)
+            {
+                if (state == Idle)
+                {
+                    const uint8_t *framestart = static_cast<const uint8_t *>(std::memchr(data, FRAMESTART, end - data));
+                    if (!framestart)
+                        return;
+                    data = framestart;
+                }
+                else if (state == Body)
+                {
+                    // Copy the run up to the next framestart or the end of the frame in one block
+                    size_t run = std::min(static_cast<size_t>(end - data), remaining);
+                    const uint8_t *framestart = static_cast<const uint8_t *>(std::memchr(data, FRAMESTART, run));
+                    if (framestart)
+                        run = framestart - data;
+                    if (run > 0)
+                    {
+                        std::memcpy(current->frame.data() + current->used, data, run);
+                        current->used += run;
+                        remaining -= run;
+                        data += run;
+                        if (remaining == 0)
+                        {
+                            Submit();
+                        }
+                        continue;
+                    }
+                }
+            }
+            ScanByte(*data++);
+        }
+    }
+
+    /**
+     * @brief Wait until every frame that was passed to Receive is validated and delivered
+     */
+    void Flush()
+    {
+        std::unique_lock<std::mutex> lock(freeMutex);
+        jobReleased.wait(lock, [this]()
+                         { return freejobs.size() + (current ? 1 : 0) == jobs.size(); });
+    }
+
+    /**
+     * @brief Drop the frame that is currently scanned
+     */
+    void ResetReceiver()
+    {
+        if (current)
+        {
+            ReleaseJob(current);
+            current = nullptr;
+        }
+        state = Idle;
+        delimiter = false;
+    }
+
+    uint64_t ValidFrames() const
+    {
+        return validFrames.load(std::memory_order_relaxed);
+    }
+
+    uint64_t InvalidFrames() const
+    {
+        return invalidFrames.load(std::memory_order_relaxed);
+    }
+
+private:
+    enum ScanState
+    {
+        Idle,
+        Header,
+        Body
+    };
+
+    struct Job
+    {
+        uint64_t sequence = 0;
+        size_t used = 0;
+        uint16_t payloadlength = 0;
+        bool valid = false;
+        std::vector<uint8_t> frame;   // The stuffed frame including the framestart
+        std::vector<uint8_t> payload; // Decoded by the worker
+    };
+
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<Job *> jobs;
+    };
+
+    /**
+     * @brief Follow the bytestuffing the same way as SMP_RecieveInByte
+     */
+    void ScanByte(uint8_t byte)
+    {
+        if (byte == FRAMESTART)
+        {
+            if (!delimiter)
+            {
+                delimiter = true;
+                return;
+            }
+            if (state == Idle)
+            {
+                // Framestart followed by the stuffed low byte 0xFF of the length field, the second framestart is the stuffing
+                BeginFrame();
+                return;
+            }
+            delimiter = false;
+            Append(FRAMESTART);
+            Append(FRAMESTART);
+        }
+        else
+        {
+            if (delimiter)
+            {
+                delimiter = false;
+                BeginFrame();
+            }
+            if (state == Idle)
+                return;
+            Append(byte);
+        }
+        ScanDecodedByte(byte);
+    }
+
+    void ScanDecodedByte(uint8_t byte)
+    {
+        if (state == Header)
+        {
+            if (headerbytes++ == 0)
+            {
+                lengthField = byte;
+                return;
+            }
+            lengthField |= static_cast<uint16_t>(byte << 8);
+            // Empty frames are dropped like in SMP_ReceiveBuffer
+            if (lengthField <= 2 || static_cast<size_t>(lengthField - 2) > maxmessageLength)
+            {
+                state = Idle;
+                return;
+            }
+            remaining = lengthField; // Payload and crc
+            state = Body;
+        }
+        else if (--remaining == 0)
+        {
+            Submit();
+        }
+    }
+
+    void BeginFrame()
+    {
+        if (!current)
+        {
+            current = AcquireJob();
+        }
+        current->used = 0;
+        Append(FRAMESTART);
+        state = Header;
+        headerbytes = 0;
+    }
+
+    void Append(uint8_t byte)
+    {
+        current->frame[current->used++] = byte;
+    }
+
+    void Submit()
+    {
+        state = Idle;
+        Job *job = current;
+        current = nullptr;
+        job->sequence = nextSequence++;
+        WorkerQueue &queue = queues[nextWorker];
+        nextWorker = (nextWorker + 1) % workers.size();
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(job);
+        }
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            queued++;
+        }
+        wake.notify_one();
+    }
+
+    Job *AcquireJob()
+    {
+        std::unique_lock<std::mutex> lock(freeMutex);
+        jobReleased.wait(lock, [this]()
+                         { return !freejobs.empty(); });
+        Job *job = freejobs.back();
+        freejobs.pop_back();
+        return job;
+    }
+
+    void ReleaseJob(Job *job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(freeMutex);
+            freejobs.push_back(job);
+        }
+        jobReleased.notify_all();
+    }
+
+    /**
+     * @brief Take a job from the own queue or steal the oldest job of another worker
+     * Every decrement of queued reserves a job, but another worker may take the job in front of this one while the next job is pushed to a queue that was already scanned. Returns nullptr in that case.
+     */
+    Job *TakeJob(size_t index, size_t workercount)
+    {
+        for (size_t i = 0; i < workercount; i++)
+        {
+            WorkerQueue &queue = queues[(index + i) % workercount];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty())
+            {
+                Job *job = queue.jobs.front();
+                queue.jobs.pop_front();
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    void Work(size_t index, size_t workercount)
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                wake.wait(lock, [this]()
+                          { return queued > 0 || stop; });
+                if (queued == 0)
+                    return;
+                queued--;
+            }
+            // The reserved job may have landed in a queue that was already scanned
+            Job *job;
+            while (!(job = TakeJob(index, workercount)))
+            {
+                std::this_thread::yield();
+            }
+            job->valid = SMP_PacketDecode(job->frame.data(), job->used, job->payload.data(), job->payload.size(), &job->payloadlength);
+            (job->valid ? validFrames : invalidFrames).fetch_add(1, std::memory_order_relaxed);
+            if (ordered)
+            {
+                Deliver(job);
+            }
+            else
+            {
+                if (job->valid)
+                {
+                    handler(job->payload.data(), job->payloadlength);
+                }
+                ReleaseJob(job);
+            }
+        }
+    }
+
+    /**
+     * @brief Park the job until all frames before it are delivered, then deliver every frame that is ready in order
+     */
+    void Deliver(Job *job)
+    {
+        std::lock_guard<std::mutex> lock(deliveryMutex);
+        completed[job->sequence % completed.size()] = job;
+        while (true)
+        {
+            Job *&slot = completed[nextDelivery % completed.size()];
+            if (!slot || slot->sequence != nextDelivery)
+                break;
+            Job *ready = slot;
+            slot = nullptr;
+            nextDelivery++;
+            if (ready->valid)
+            {
+                handler(ready->payload.data(), ready->payloadlength);
+            }
+            ReleaseJob(ready);
+        }
+    }
+
+    FrameHandler handler;
+    const bool ordered;
+
+    // Scanner state, only used by the thread calling Receive
+    ScanState state = Idle;
+    bool delimiter = false;
+    size_t headerbytes = 0;
+    uint16_t lengthField = 0;
+    size_t remaining = 0;
+    Job *current = nullptr;
+    uint64_t nextSequence = 0;
+    size_t nextWorker = 0;
+
+    std::vector<Job> jobs;
+    std::mutex freeMutex;
+    std::condition_variable jobReleased;
+    std::vector<Job *> freejobs;
+
+    std::unique_ptr<WorkerQueue[]> queues;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    size_t queued = 0;
+    bool stop = false;
+
+    std::mutex deliveryMutex;
+    std::vector<Job *> completed;
+    uint64_t nextDelivery = 0;
+
+    std::atomic<uint64_t> validFrames{0};
+    std::atomic<uint64_t> invalidFrames{0};
+
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,96 @@
+#include "libsmp.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#pragma once
+
+/**
+ * @brief Lock free single producer single consumer byte ring between the receive interrupt or reader thread and the decoder.
+ *
+ * This is the C++ counterpart of smp_ring_t with the buffer inside the object. The producer calls Put or Write,
+ * the consumer passes the ring to SMP<N>::Poll, which decodes the received bytes in bulk.
+ * Size must be a power of two.
+ */
+template <size_t Size>
+class SMPRing
+{
+public:
+    static_assert(Size > 0 && (Size & (Size - 1)) == 0, "The ring size must be a power of two");
+
+    /**
+     * @brief Append one received byte, only called by the producer
+     * @return false if the ring is full and the byte was dropped
+     */
+    bool Put(uint8_t data)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= Size)
+            return false;
+        buffer[h & (Size - 1)] = data;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Append a block of received bytes, only called by the producer
+     * @return The number of bytes written. The remaining bytes didn't fit into the ring and were dropped.
+     */
+    size_t Write(const void *data, size_t length)
+    {
+        const uint8_t *ptr = static_cast<const uint8_t *>(data);
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t space = Size - (h - tail.load(std::memory_order_acquire));
+        if (length > space)
+            length = space;
+        size_t index = h & (Size - 1);
+        size_t first = Size - index;
+        if (first > length)
+            first = length;
+        std::memcpy(buffer.data() + index, ptr, first);
+        std::memcpy(buffer.data(), ptr + first, length - first);
+        head.store(h + length, std::memory_order_release);
+        return length;
+    }
+
+    /**
+     * @brief Pass the bytes that are in the ring to consume(const uint8_t *data, size_t length) in at most two contiguous blocks
+     * and release them afterwards. Only called by the consumer.
+     * @return The number of consumed bytes
+     */
+    template <typename Consumer>
+    size_t Consume(Consumer &&consume)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        size_t total = h - t;
+        while (t != h)
+        {
+            size_t index = t & (Size - 1);
+            size_t run = h - t;
+            if (run > Size - index)
+                run = Size - index;
+            consume(static_cast<const uint8_t *>(buffer.data() + index), run);
+            t += run;
+            tail.store(t, std::memory_order_release);
+        }
+        return total;
+    }
+
+    /**
+     * @brief Number of bytes in the ring that were not consumed yet
+     */
+    size_t Available() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t IndexAlignment = SMP_RING_CACHELINE > alignof(std::atomic<size_t>) ? SMP_RING_CACHELINE : alignof(std::atomic<size_t>);
+
+    alignas(IndexAlignment) std::atomic<size_t> head{0}; // Written by the producer
+    alignas(IndexAlignment) std::atomic<size_t> tail{0}; // Written by the consumer
+    std::array<uint8_t, Size> buffer;
+};
@@ -0,0 +1,89 @@
+#include "libsmp.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#pragma once
+
+/**
+ * @brief Resumable encoder for transports that accept only a part of a frame per call, e.g. SPI or USB endpoints.
+ *
+ * The frame is encoded in pieces of at most ChunkLength bytes while it is written, so the memory doesn't depend on the payload length.
+ * A short write of the transport isn't an error, the rest of the frame is written by the next call to Write.
+ * The payload isn't copied and must stay valid as long as Busy returns true.
+ */
+template <size_t ChunkLength = 64>
+class SMPStreamEncoder
+{
+public:
+    static_assert(ChunkLength > 0, "The chunk must hold at least one byte");
+
+    /**
+     * @brief Start a new frame, a frame that is still in progress is abandoned
+     * @return false if the payload is too long
+     */
+    bool Start(const void *payload, size_t length)
+    {
+        staged = 0;
+        sent = 0;
+        return SMP_EncoderStart(&encoder, static_cast<const uint8_t *>(payload), length);
+    }
+
+    /**
+     * @brief Write the next bytes of the frame into dest
+     * @return The number of bytes written, zero if the frame is complete
+     */
+    size_t Read(void *dest, size_t space)
+    {
+        uint8_t *out = static_cast<uint8_t *>(dest);
+        size_t written = std::min(space, staged - sent);
+        std::memcpy(out, chunk.data() + sent, written);
+        sent += written;
+        return written + SMP_EncoderRead(&encoder, out + written, space - written);
+    }
+
+    /**
+     * @brief Pass the frame to write(uint8_t *data, size_t length) until it is complete or write accepts less than offered
+     * @return The number of bytes accepted by write in this call
+     */
+    template <typename Callback>
+    size_t Write(Callback &&write)
+    {
+        size_t total = 0;
+        while (true)
+        {
+            if (sent == staged)
+            {
+                staged = SMP_EncoderRead(&encoder, chunk.data(), chunk.size());
+                sent = 0;
+                if (staged == 0)
+                    break;
+            }
+            size_t offered = staged - sent;
+            size_t accepted = write(chunk.data() + sent, offered);
+            if (accepted > offered)
+                accepted = offered;
+            sent += accepted;
+            total += accepted;
+            if (accepted < offered)
+                break;
+        }
+        return total;
+    }
+
+    /**
+     * @brief True as long as the frame isn't completely written
+     */
+    bool Busy() const
+    {
+        return sent < staged || SMP_EncoderBusy(&encoder);
+    }
+
+private:
+    smp_encoder_t encoder{};
+    std::array<uint8_t, ChunkLength> chunk;
+    size_t staged = 0; // Encoded bytes in chunk
+    size_t sent = 0;   // Bytes of chunk accepted by the transport
+};
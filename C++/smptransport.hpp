@@ -0,0 +1,777 @@
+#include "libsmp.hpp"
+#include "smpmultiplexer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <unistd.h>
+#if __has_include(<linux/io_uring.h>) && !defined(SMP_TRANSPORT_NO_IO_URING)
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define SMP_TRANSPORT_HAS_IO_URING
+#endif
+#endif
+
+#pragma once
+
+#if defined(__linux__)
+
+/**
+ * @brief Event loop for many smp links (serial ports, pipes, PTYs) on one thread, Linux only.
+ *
+ * The transport owns the file descriptors of the links. Poll writes the queued frames of all links, waits for the descriptors and
+ * decodes the received data with a SMPMultiplexer. The frame handler is called with (size_t link, const uint8_t *data, size_t length),
+ * the data is only valid during the call.
+ *
+ * With io_uring every link has one read in flight all the time and one write whenever frames are queued, so a call to Poll
+ * needs a single system call for all links. Without io_uring (old kernels, seccomp filters or SMP_TRANSPORT_NO_IO_URING) the
+ * descriptors are watched by epoll, every readable link is drained with read and written with write.
+ *
+ * The transport isn't thread safe, Send and Poll have to be called from the same thread.
+ */
+template <size_t maxmessageLength>
+class SMPTransport
+{
+public:
+    using FrameHandler = std::function<void(size_t, const uint8_t *, size_t)>;
+
+    enum class Backend
+    {
+        Auto,
+        IoUring,
+        Epoll
+    };
+
+    static constexpr size_t DefaultReadLength = 4096;
+    static constexpr size_t DefaultQueueLimit = 64 * 1024;
+
+    /**
+     * @param linkcount Number of links, the links are numbered from 0 to linkcount - 1
+     * @param backend Auto uses io_uring if the kernel supports it and epoll otherwise
+     * @param readLength Bytes per read and link
+     * @param queueLimit Encoded bytes per link that may wait for the transmission, Send fails above
+     */
+    SMPTransport(size_t linkcount, FrameHandler frameHandler, Backend backend = Backend::Auto, size_t readLength = DefaultReadLength, size_t queueLimit = DefaultQueueLimit)
+        : handler(std::move(frameHandler)), links(linkcount), decoder(linkcount), readlength(std::max<size_t>(readLength, 1)), queuelimit(queueLimit)
+    {
+#ifdef SMP_TRANSPORT_HAS_IO_URING
+        if (backend != Backend::Epoll && SetupRing(static_cast<unsigned>(4 * linkcount + 4)))
+        {
+            active = Backend::IoUring;
+            readbuffers.resize(linkcount * readlength);
+            return;
+        }
+#endif
+        if (backend == Backend::IoUring)
+            return;
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd >= 0)
+        {
+            active = Backend::Epoll;
+        }
+    }
+
+    SMPTransport(const SMPTransport &) = delete;
+    SMPTransport &operator=(const SMPTransport &) = delete;
+
+    ~SMPTransport()
+    {
+        for (size_t i = 0; i < links.size(); i++)
+        {
+            Detach(i);
+        }
+#ifdef SMP_TRANSPORT_HAS_IO_URING
+        CloseRing();
+#endif
+        if (epollfd >= 0)
+        {
+            close(epollfd);
+        }
+    }
+
+    /**
+     * @brief False if neither io_uring nor epoll could be set up
+     */
+    bool Valid() const
+    {
+        return active != Backend::Auto;
+    }
+
+    /**
+     * @brief The backend in use, Auto if the transport isn't valid
+     */
+    Backend ActiveBackend() const
+    {
+        return active;
+    }
+
+    size_t LinkCount() const
+    {
+        return links.size();
+    }
+
+    /**
+     * @brief Take over the descriptor for the link, it is closed on Detach or when the link fails.
+     * The descriptor is switched to non blocking mode.
+     * @return false if the link is in use or the descriptor can't be watched (see errno)
+     */
+    bool Attach(size_t link, int fd)
+    {
+        Link &l = links[link];
+        if (!Valid() || l.fd >= 0)
+        {
+            errno = EBUSY;
+            return false;
+        }
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0)
+            return false;
+        // Blocking reads of a tty would stall io_uring_enter on some kernels, io_uring waits for non blocking descriptors with its internal poll
+        if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+            return false;
+        if (active == Backend::Epoll)
+        {
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = link;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) < 0)
+                return false;
+        }
+        l.fd = fd;
+        l.open = true;
+        l.readPoll = false;
+        l.writePoll = false;
+        decoder.Reset(link);
+#ifdef SMP_TRANSPORT_HAS_IO_URING
+        if (active == Backend::IoUring)
+        {
+            QueueRead(link);
+        }
+#endif
+        return true;
+    }
+
+    /**
+     * @brief Configure a tty for raw 8 bit transfers with the baudrate (e.g. B115200) and open it for Attach
+     * @return The descriptor or -1 on error (see errno)
+     */
+    static int OpenSerial(const char *device, speed_t baudrate)
+    {
+        int fd = open(device, O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (fd < 0)
+            return -1;
+        termios tty;
+        if (tcgetattr(fd, &tty) < 0)
+        {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        cfmakeraw(&tty);
+        tty.c_cflag |= CLOCAL | CREAD;
+        tty.c_cc[VMIN] = 1;
+        tty.c_cc[VTIME] = 0;
+        if (cfsetspeed(&tty, baudrate) < 0 || tcsetattr(fd, TCSANOW, &tty) < 0)
+        {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        return fd;
+    }
+
+    /**
+     * @brief Drop the queued frames of the link and close its descriptor.
+     * With io_uring this waits for the cancelled operations of the link, frames of other links may be delivered meanwhile.
+     */
+    void Detach(size_t link)
+    {
+        Link &l = links[link];
+        if (l.fd < 0)
+            return;
+        Fail(link);
+#ifdef SMP_TRANSPORT_HAS_IO_URING
+        while (l.fd >= 0 && active == Backend::IoUring)
+        {
+            if (Enter(1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+                break;
+            Reap();
+        }
+#endif
+    }
+
+    /**
+     * @brief False if the link isn't attached, the other side closed it or it failed
+     */
+    bool IsOpen(size_t link) const
+    {
+        return links[link].open;
+    }
+
+    /**
+     * @brief Encode the payload into the transmit queue of the link, it is written by the next Poll
+     * @return false if the link isn't open, the payload is too long or the queue limit is reached
+     */
+    bool Send(size_t link, const void *payload, size_t length)
+    {
+        Link &l = links[link];
+        if (!l.open || length > maxmessageLength)
+            return false;
+        size_t maximum = SMP_SEND_BUFFER_LENGTH(length);
+        if (QueuedBytes(link) + maximum > queuelimit && QueuedBytes(link) > 0)
+            return false;
+        size_t used = l.pending.size();
+        l.pending.resize(used + maximum);
+        size_t framelength = SMP_Encode(static_cast<const uint8_t *>(payload), length, l.pending.data() + used, maximum);
+        l.pending.resize(used + framelength);
+        if (framelength == 0)
+            return false;
+        decoder.CountSent(link, 1, length, framelength);
+        if (!l.dirty)
+        {
+            l.dirty = true;
+            dirty.push_back(link);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Encoded bytes of the link that aren't accepted by the kernel yet
+     */
+    size_t QueuedBytes(size_t link) const
+    {
+        const Link &l = links[link];
+        return l.pending.size() + l.inflight.size() - l.written;
+    }
+
+    /**
+     * @brief Write the queued frames, wait up to timeout milliseconds for data and decode it
+     * @param timeout Milliseconds to wait, 0 returns immediately and -1 waits until something happens
+     * @return The number of delivered frames or -1 if waiting failed (see errno)
+     */
+    int Poll(int timeout)
+    {
+        delivered = 0;
+#ifdef SMP_TRANSPORT_HAS_IO_URING
+        if (active == Backend::IoUring)
+            return PollRing(timeout);
+#endif
+        if (active != Backend::Epoll)
+        {
+            errno = EBADF;
+            return -1;
+        }
+        return PollEpoll(timeout);
+    }
+
+    /**
+     * @brief Snapshot of the statistics of the link, all zero if the library is compiled without SMP_ENABLE_STATS
+     */
+    smp_stats_snapshot_t Statistics(size_t link) const
+    {
+        return decoder.Statistics(link);
+    }
+
+private:
+    struct Link
+    {
+        int fd = -1;
+        bool open = false;
+        bool dirty = false;         // In the list of links with new frames
+        bool writing = false;       // io_uring write in flight or epoll waiting for EPOLLOUT
+        bool reading = false;       // io_uring read in flight
+        bool readPoll = false;      // Wait for POLLIN before the next read, for kernels that return EAGAIN
+        bool writePoll = false;     // Wait for POLLOUT before the next write
+        std::vector<uint8_t> pending;  // Frames queued by Send
+        std::vector<uint8_t> inflight; // Frames that are written now, Send doesn't touch them
+        size_t written = 0;            // Bytes of inflight accepted by the kernel
+    };
+
+    void Deliver(size_t link, const uint8_t *frame, size_t length)
+    {
+        delivered++;
+        handler(link, frame, length);
+    }
+
+    /**
+     * @brief Frame callback for the decoder
+     */
+    auto Receiver()
+    {
+        return [this](size_t link, const uint8_t *frame, size_t length)
+        { Deliver(link, frame, length); };
+    }
+
+    /**
+     * @brief Move the queued frames of the link into the write buffer, false if there is nothing to write
+     */
+    bool NextWrite(Link &l)
+    {
+        if (l.written < l.inflight.size())
+            return true;
+        l.inflight.clear();
+        l.written = 0;
+        if (l.pending.empty())
+            return false;
+        std::swap(l.inflight, l.pending);
+        return true;
+    }
+
+    /**
+     * @brief Close the link after an error, the end of the stream or on Detach
+     */
+    void Fail(size_t link)
+    {
+        Link &l = links[link];
+        bool wasOpen = l.open;
+        l.open = false;
+        l.pending.clear();
+        if (active == Backend::Epoll)
+        {
+            if (l.fd >= 0)
+            {
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, l.fd, nullptr);
+                close(l.fd);
+                l.fd = -1;
+            }
+            l.inflight.clear();
+            l.written = 0;
+            l.writing = false;
+            return;
+        }
+#ifdef SMP_TRANSPORT_HAS_IO_URING
+        // The buffers of the link stay in use until the kernel completes the cancelled operations
+        // A read or write that still waits for its linked poll is cancelled with the poll
+        if (wasOpen && l.reading)
+        {
+            QueueCancel(link, ReadTag);
+            if (l.readPoll)
+                QueueCancel(link, ReadPollTag);
+        }
+        if (wasOpen && l.writing)
+        {
+            QueueCancel(link, WriteTag);
+            if (l.writePoll)
+                QueueCancel(link, WritePollTag);
+        }
+        ReleaseIfIdle(link);
+#endif
+    }
+
+    int PollEpoll(int timeout)
+    {
+        for (size_t link : dirty)
+        {
+            links[link].dirty = false;
+            if (!links[link].writing)
+            {
+                WriteEpoll(link);
+            }
+        }
+        dirty.clear();
+
+        epoll_event events[64];
+        int count = epoll_wait(epollfd, events, 64, timeout);
+        if (count < 0)
+            return errno == EINTR ? 0 : -1;
+        for (int i = 0; i < count; i++)
+        {
+            size_t link = static_cast<size_t>(events[i].data.u64);
+            Link &l = links[link];
+            if (l.fd >= 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            {
+                ptrdiff_t result = decoder.DrainFd(link, l.fd, Receiver());
+                if (result < 0)
+                {
+                    Fail(link);
+                }
+            }
+            if (l.fd >= 0 && (events[i].events & EPOLLOUT))
+            {
+                WriteEpoll(link);
+            }
+        }
+        return static_cast<int>(delivered);
+    }
+
+    /**
+     * @brief Write until the queue is empty or the descriptor is full, then wait for EPOLLOUT
+     */
+    void WriteEpoll(size_t link)
+    {
+        Link &l = links[link];
+        bool wasWaiting = l.writing;
+        while (NextWrite(l))
+        {
+            ssize_t count = write(l.fd, l.inflight.data() + l.written, l.inflight.size() - l.written);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                Fail(link);
+                return;
+            }
+            l.written += static_cast<size_t>(count);
+        }
+        l.writing = l.written < l.inflight.size();
+        if (l.writing != wasWaiting)
+        {
+            epoll_event event{};
+            event.events = l.writing ? EPOLLIN | EPOLLOUT : EPOLLIN;
+            event.data.u64 = link;
+            epoll_ctl(epollfd, EPOLL_CTL_MOD, l.fd, &event);
+        }
+    }
+
+#ifdef SMP_TRANSPORT_HAS_IO_URING
+    static constexpr uint64_t ReadTag = 0;
+    static constexpr uint64_t WriteTag = 1;
+    static constexpr uint64_t CancelTag = 2;
+    static constexpr uint64_t ReadPollTag = 3;
+    static constexpr uint64_t WritePollTag = 4;
+    static constexpr unsigned TagBits = 3;
+    static constexpr uint64_t TimeoutUserData = UINT64_MAX;
+
+    bool SetupRing(unsigned entries)
+    {
+        io_uring_params params{};
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0)
+            return false;
+        // Kernel 5.6 or newer, IORING_OP_READ and IORING_OP_WRITE came with IORING_FEAT_RW_CUR_POS
+        const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS;
+        if ((params.features & required) != required)
+        {
+            close(fd);
+            return false;
+        }
+        ringlength = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        void *ring = mmap(nullptr, ringlength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (ring == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        sqelength = params.sq_entries * sizeof(io_uring_sqe);
+        void *entriesMemory = mmap(nullptr, sqelength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (entriesMemory == MAP_FAILED)
+        {
+            munmap(ring, ringlength);
+            close(fd);
+            return false;
+        }
+        uint8_t *base = static_cast<uint8_t *>(ring);
+        ringmemory = ring;
+        sqes = static_cast<io_uring_sqe *>(entriesMemory);
+        sqHead = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+        sqEntries = params.sq_entries;
+        cqHead = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+        sqLocalTail = *sqTail;
+        ringfd = fd;
+        return true;
+    }
+
+    void CloseRing()
+    {
+        if (ringfd < 0)
+            return;
+        munmap(sqes, sqelength);
+        munmap(ringmemory, ringlength);
+        close(ringfd);
+        ringfd = -1;
+    }
+
+    /**
+     * @brief Publish the queued entries and call io_uring_enter
+     */
+    int Enter(unsigned minComplete, unsigned flags)
+    {
+        __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+        int result = static_cast<int>(syscall(__NR_io_uring_enter, ringfd, tosubmit, minComplete, flags, nullptr, 0));
+        if (result >= 0)
+        {
+            tosubmit -= std::min<unsigned>(tosubmit, static_cast<unsigned>(result));
+        }
+        return result;
+    }
+
+    io_uring_sqe *GetSqe()
+    {
+        while (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+        {
+            // Submission queue full, pass the entries to the kernel
+            if (Enter(0, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                return nullptr;
+        }
+        unsigned index = sqLocalTail & sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        sqLocalTail++;
+        tosubmit++;
+        return sqe;
+    }
+
+    /**
+     * @brief Queue a poll that is linked to the next entry, so the read or write only starts when the descriptor is ready
+     */
+    bool QueuePoll(size_t link, unsigned events, uint64_t tag)
+    {
+        io_uring_sqe *sqe = GetSqe();
+        if (!sqe)
+            return false;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = links[link].fd;
+        sqe->poll_events = static_cast<uint16_t>(events);
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = link << TagBits | tag;
+        return true;
+    }
+
+    void QueueRead(size_t link)
+    {
+        // Older kernels return EAGAIN for non blocking descriptors instead of waiting
+        if (links[link].readPoll && !QueuePoll(link, POLLIN, ReadPollTag))
+        {
+            Fail(link);
+            return;
+        }
+        io_uring_sqe *sqe = GetSqe();
+        if (!sqe)
+        {
+            Fail(link);
+            return;
+        }
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = links[link].fd;
+        sqe->addr = reinterpret_cast<uint64_t>(readbuffers.data() + link * readlength);
+        sqe->len = static_cast<uint32_t>(readlength);
+        sqe->off = static_cast<uint64_t>(-1); // Current position, the links are streams
+        sqe->user_data = link << TagBits | ReadTag;
+        links[link].reading = true;
+    }
+
+    void QueueWrite(size_t link)
+    {
+        Link &l = links[link];
+        if (l.writePoll && !QueuePoll(link, POLLOUT, WritePollTag))
+        {
+            Fail(link);
+            return;
+        }
+        io_uring_sqe *sqe = GetSqe();
+        if (!sqe)
+        {
+            Fail(link);
+            return;
+        }
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = l.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(l.inflight.data() + l.written);
+        sqe->len = static_cast<uint32_t>(l.inflight.size() - l.written);
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->user_data = link << TagBits | WriteTag;
+        l.writing = true;
+    }
+
+    void QueueCancel(size_t link, uint64_t tag)
+    {
+        io_uring_sqe *sqe = GetSqe();
+        if (!sqe)
+            return;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = link << TagBits | tag;
+        sqe->user_data = link << TagBits | CancelTag;
+    }
+
+    /**
+     * @brief Close the descriptor of a failed link once no operation uses its buffers anymore
+     */
+    void ReleaseIfIdle(size_t link)
+    {
+        Link &l = links[link];
+        if (l.open || l.reading || l.writing || l.fd < 0)
+            return;
+        close(l.fd);
+        l.fd = -1;
+        l.inflight.clear();
+        l.written = 0;
+    }
+
+    int PollRing(int timeout)
+    {
+        for (size_t link : dirty)
+        {
+            Link &l = links[link];
+            l.dirty = false;
+            if (l.open && !l.writing && NextWrite(l))
+            {
+                QueueWrite(link);
+            }
+        }
+        dirty.clear();
+
+        unsigned wait = 0;
+        if (timeout != 0 && !Reap())
+        {
+            wait = 1;
+            if (timeout > 0 && !timeoutPending)
+            {
+                // Completes after the timeout or together with the first other completion
+                io_uring_sqe *sqe = GetSqe();
+                if (sqe)
+                {
+                    timeoutSpec.tv_sec = timeout / 1000;
+                    timeoutSpec.tv_nsec = (timeout % 1000) * 1000000LL;
+                    sqe->opcode = IORING_OP_TIMEOUT;
+                    sqe->fd = -1;
+                    sqe->addr = reinterpret_cast<uint64_t>(&timeoutSpec);
+                    sqe->len = 1;
+                    sqe->off = 1;
+                    sqe->user_data = TimeoutUserData;
+                    timeoutPending = true;
+                }
+            }
+        }
+        if (tosubmit > 0 || wait > 0)
+        {
+            if (Enter(wait, wait ? IORING_ENTER_GETEVENTS : 0) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+                return -1;
+        }
+        Reap();
+        return static_cast<int>(delivered);
+    }
+
+    /**
+     * @brief Handle all completions
+     * @return true if there was at least one completion
+     */
+    bool Reap()
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        bool any = head != tail;
+        while (head != tail)
+        {
+            const io_uring_cqe &cqe = cqes[head & cqMask];
+            uint64_t data = cqe.user_data;
+            int result = cqe.res;
+            head++;
+            // Release the entry before handling it, the handler may queue new entries
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            Complete(data, result);
+            tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        }
+        return any;
+    }
+
+    void Complete(uint64_t data, int result)
+    {
+        if (data == TimeoutUserData)
+        {
+            timeoutPending = false;
+            return;
+        }
+        size_t link = static_cast<size_t>(data >> TagBits);
+        Link &l = links[link];
+        switch (data & ((1u << TagBits) - 1))
+        {
+        case ReadTag:
+            l.reading = false;
+            if (result > 0)
+            {
+                decoder.Receive(link, Receiver(), readbuffers.data() + link * readlength, static_cast<size_t>(result));
+            }
+            if (!l.open)
+                break;
+            l.readPoll = result == -EAGAIN;
+            if (result > 0 || result == -EAGAIN || result == -EINTR)
+            {
+                QueueRead(link);
+            }
+            else
+            {
+                // End of the stream (0) or an error like EIO of a PTY whose other side was closed
+                Fail(link);
+            }
+            break;
+        case WriteTag:
+            l.writing = false;
+            if (!l.open)
+                break;
+            l.writePoll = result == -EAGAIN;
+            if (result > 0)
+            {
+                l.written += static_cast<size_t>(result);
+            }
+            else if (result != -EAGAIN && result != -EINTR)
+            {
+                Fail(link);
+                break;
+            }
+            if (NextWrite(l))
+            {
+                QueueWrite(link);
+            }
+            break;
+        default:
+            break;
+        }
+        ReleaseIfIdle(link);
+    }
+
+    int ringfd = -1;
+    void *ringmemory = nullptr;
+    size_t ringlength = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqelength = 0;
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned sqLocalTail = 0;
+    unsigned tosubmit = 0;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+    __kernel_timespec timeoutSpec{};
+    bool timeoutPending = false;
+#endif
+
+    FrameHandler handler;
+    Backend active = Backend::Auto;
+    int epollfd = -1;
+    std::vector<Link> links;
+    std::vector<size_t> dirty; // Links with frames queued since the last Poll
+    SMPMultiplexer<maxmessageLength> decoder;
+    std::vector<uint8_t> readbuffers; // One read buffer per link for io_uring
+    size_t readlength;
+    size_t queuelimit;
+    size_t delivered = 0;
+};
+
+#endif
@@ -0,0 +1,432 @@
+/*****************************************************************************************************
+ Throughput benchmarks for the smp encoder, decoder and crc and for the reed solomon fec frames (up to 16 KiB).
+
+ Every benchmark runs over payload sizes from 8 byte to 64 KiB and three framestart densities:
+    0%:   No framestarts in the payload
+    3%:   Random bytes with a framestart probability of 3%, close to the typical overhead on random data
+    100%: Payload consists only of framestarts (worst case for the bytestuffing)
+ The byte rate is the payload rate, the frame rate is reported as the frames counter.
+
+ Write the results as json with --benchmark_out=<file> --benchmark_out_format=json
+ ******************************************************************************************************/
+#include "libsmp.hpp"
+#include "smpcodec.hpp"
+#include "smpfec.hpp"
+#include "smpframepool.hpp"
+#include "smppipeline.hpp"
+#include "smpstreamencoder.hpp"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+    constexpr size_t MaximumPayload = 65000;
+    constexpr size_t MaximumSendPayload = 16384; // SMP_Send takes an unsigned short buffer length
+    constexpr size_t MaximumFecPayload = 16384;
+    constexpr uint8_t FecDepth = 8;
+
+    enum Density
+    {
+        NoFramestarts = 0,
+        RandomFramestarts = 3,
+        OnlyFramestarts = 100
+    };
+
+    std::vector<uint8_t> CreatePayload(size_t length, int density)
+    {
+        std::mt19937 rng(length * 131 + density);
+        std::uniform_int_distribution<int> byte(0, FRAMESTART - 1);
+        std::uniform_int_distribution<int> percent(0, 99);
+        std::vector<uint8_t> payload(length);
+        for (auto &b : payload)
+        {
+            b = percent(rng) < density ? FRAMESTART : static_cast<uint8_t>(byte(rng));
+        }
+        return payload;
+    }
+
+    std::vector<uint8_t> CreateFrame(const std::vector<uint8_t> &payload)
+    {
+        std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(payload.size()));
+        frame.resize(SMP_Encode(payload.data(), payload.size(), frame.data(), frame.size()));
+        return frame;
+    }
+
+    void SetRates(benchmark::State &state, size_t payloadlength)
+    {
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * payloadlength));
+        state.counters["frames"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+        state.SetLabel(std::to_string(state.range(1)) + "% framestarts");
+    }
+
+    void PayloadArguments(benchmark::internal::Benchmark *b, size_t maximum)
+    {
+        for (int density : {NoFramestarts, RandomFramestarts, OnlyFramestarts})
+        {
+            for (size_t length = 8; length <= maximum; length *= 8)
+            {
+                b->Args({static_cast<int64_t>(length), density});
+            }
+            b->Args({static_cast<int64_t>(maximum), density});
+        }
+    }
+
+    void AllPayloads(benchmark::internal::Benchmark *b)
+    {
+        PayloadArguments(b, MaximumPayload);
+    }
+
+    void SendPayloads(benchmark::internal::Benchmark *b)
+    {
+        PayloadArguments(b, MaximumSendPayload);
+    }
+
+    void FecPayloads(benchmark::internal::Benchmark *b)
+    {
+        PayloadArguments(b, MaximumFecPayload);
+    }
+
+    std::vector<uint8_t> CreateFecFrame(SMPFec<MaximumFecPayload, FecDepth> &fec, const std::vector<uint8_t> &payload)
+    {
+        std::vector<uint8_t> frame;
+        fec.Transmit([&frame](uint8_t *data, size_t length)
+                     {
+                         frame.assign(data, data + length);
+                         return length; },
+                     payload.data(), payload.size());
+        return frame;
+    }
+}
+
+static void BM_crc16(benchmark::State &state)
+{
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    for (auto _ : state)
+    {
+        uint16_t crc = 0;
+        for (auto b : payload)
+        {
+            crc = SMP_crc16(crc, b, CRC_POLYNOM);
+        }
+        benchmark::DoNotOptimize(crc);
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_crc16)->Apply(AllPayloads);
+
+static void BM_crc16_block(benchmark::State &state)
+{
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(SMP_crc16_block(0, payload.data(), payload.size()));
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_crc16_block)->Apply(AllPayloads);
+
+static void BM_Send(benchmark::State &state)
+{
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    std::vector<uint8_t> buffer(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    for (auto _ : state)
+    {
+        uint8_t *start;
+        benchmark::DoNotOptimize(SMP_Send(payload.data(), static_cast<unsigned short>(payload.size()), buffer.data(), static_cast<unsigned short>(buffer.size()), &start));
+        benchmark::ClobberMemory();
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_Send)->Apply(SendPayloads);
+
+static void BM_Encode(benchmark::State &state)
+{
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    std::vector<uint8_t> buffer(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(SMP_Encode(payload.data(), payload.size(), buffer.data(), buffer.size()));
+        benchmark::ClobberMemory();
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_Encode)->Apply(AllPayloads);
+
+static void BM_RecieveInByte(benchmark::State &state)
+{
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    auto frame = CreateFrame(payload);
+    std::vector<uint8_t> received(payload.size());
+    smp_struct_t smp;
+    SMP_Init(&smp);
+    for (auto _ : state)
+    {
+        size_t offset = 0;
+        for (auto b : frame)
+        {
+            uint8_t decoded;
+            if (SMP_RecieveInByte(b, &decoded, &smp) == RECEIVED_BYTE)
+            {
+                received[offset++] = decoded;
+            }
+        }
+        benchmark::DoNotOptimize(offset);
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_RecieveInByte)->Apply(AllPayloads);
+
+static void BM_ReceiveBuffer(benchmark::State &state)
+{
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    auto frame = CreateFrame(payload);
+    std::vector<uint8_t> framebuffer(payload.size());
+    smp_struct_t smp;
+    SMP_Init(&smp);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(SMP_ReceiveBuffer(&smp, frame.data(), frame.size(), framebuffer.data(), framebuffer.size(), nullptr, nullptr));
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_ReceiveBuffer)->Apply(AllPayloads);
+
+static void BM_PacketValid(benchmark::State &state)
+{
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    auto frame = CreateFrame(payload);
+    for (auto _ : state)
+    {
+        uint16_t headerlength;
+        uint16_t length = SMP_PacketGetLength(frame.data(), &headerlength);
+        benchmark::DoNotOptimize(SMP_PacketValid(frame.data(), length + headerlength, headerlength, nullptr));
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_PacketValid)->Apply(AllPayloads);
+
+static void BM_PacketDecode(benchmark::State &state)
+{
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    auto frame = CreateFrame(payload);
+    std::vector<uint8_t> decoded(payload.size());
+    for (auto _ : state)
+    {
+        uint16_t length;
+        benchmark::DoNotOptimize(SMP_PacketDecode(frame.data(), frame.size(), decoded.data(), decoded.size(), &length));
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_PacketDecode)->Apply(AllPayloads);
+
+static void BM_CppTransmit(benchmark::State &state)
+{
+    static SMP<MaximumPayload> smp;
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(smp.Transmit([](uint8_t *data, size_t length) {
+            benchmark::DoNotOptimize(data);
+            return length; }, payload.data(), payload.size()));
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_CppTransmit)->Apply(AllPayloads);
+
+static void BM_CppReceive(benchmark::State &state)
+{
+    static SMP<MaximumPayload> smp;
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    auto frame = CreateFrame(payload);
+    size_t frames = 0;
+    for (auto _ : state)
+    {
+        smp.Receive([&frames](const uint8_t *, size_t) { frames++; }, frame.data(), frame.size());
+    }
+    benchmark::DoNotOptimize(frames);
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_CppReceive)->Apply(AllPayloads);
+
+static void BM_PoolReceive(benchmark::State &state)
+{
+    using Pool = SMPFramePool<MaximumPayload, 4>;
+    static auto pool = std::make_unique<Pool>();
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    auto frame = CreateFrame(payload);
+    Pool::Frame last;
+    for (auto _ : state)
+    {
+        // Keep the frame until the next one is received, as a consumer that works on the frames would
+        pool->Receive([&last](Pool::Frame received) { last = std::move(received); }, frame.data(), frame.size());
+    }
+    benchmark::DoNotOptimize(last.data());
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_PoolReceive)->Apply(AllPayloads);
+
+static void BM_CodecEncode(benchmark::State &state)
+{
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    std::vector<uint8_t> buffer(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(smp::Encode(payload.data(), payload.size(), buffer.data(), buffer.size()));
+        benchmark::ClobberMemory();
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_CodecEncode)->Apply(AllPayloads);
+
+static void BM_StreamEncode(benchmark::State &state)
+{
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    SMPStreamEncoder<64> encoder;
+    size_t written = 0;
+    for (auto _ : state)
+    {
+        // Transport that takes at most 64 bytes per call
+        encoder.Start(payload.data(), payload.size());
+        while (encoder.Write([&written](uint8_t *data, size_t length)
+                             {
+                                 benchmark::DoNotOptimize(data);
+                                 written += length;
+                                 return length; }) > 0)
+        {
+        }
+    }
+    benchmark::DoNotOptimize(written);
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_StreamEncode)->Apply(AllPayloads);
+
+static void BM_CodecReceive(benchmark::State &state)
+{
+    static smp::Decoder<MaximumPayload> decoder;
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    auto frame = CreateFrame(payload);
+    size_t frames = 0;
+    for (auto _ : state)
+    {
+        decoder.Receive([&frames](const uint8_t *, size_t) { frames++; }, frame.data(), frame.size());
+    }
+    benchmark::DoNotOptimize(frames);
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_CodecReceive)->Apply(AllPayloads);
+
+static void BM_Pipeline(benchmark::State &state)
+{
+    constexpr size_t FramesPerIteration = 64;
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    auto frame = CreateFrame(payload);
+    std::vector<uint8_t> stream;
+    for (size_t i = 0; i < FramesPerIteration; i++)
+    {
+        stream.insert(stream.end(), frame.begin(), frame.end());
+    }
+    std::atomic<size_t> frames{0};
+    SMPPipeline<MaximumPayload> pipeline([&frames](const uint8_t *, size_t) { frames++; });
+    for (auto _ : state)
+    {
+        pipeline.Receive(stream.data(), stream.size());
+        pipeline.Flush();
+    }
+    benchmark::DoNotOptimize(frames.load());
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * FramesPerIteration * payload.size()));
+    state.counters["frames"] = benchmark::Counter(static_cast<double>(state.iterations() * FramesPerIteration), benchmark::Counter::kIsRate);
+    state.SetLabel(std::to_string(state.range(1)) + "% framestarts");
+}
+BENCHMARK(BM_Pipeline)->Apply(AllPayloads)->UseRealTime();
+
+static void BM_FecEncode(benchmark::State &state)
+{
+    static SMPFec<MaximumFecPayload, FecDepth> fec;
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(fec.Transmit([](uint8_t *data, size_t length) {
+            benchmark::DoNotOptimize(data);
+            return length; }, payload.data(), payload.size()));
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_FecEncode)->Apply(FecPayloads);
+
+static void BM_FecReceive(benchmark::State &state)
+{
+    static SMPFec<MaximumFecPayload, FecDepth> fec;
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    auto frame = CreateFecFrame(fec, payload);
+    size_t frames = 0;
+    for (auto _ : state)
+    {
+        frames += fec.Receive([](const uint8_t *, size_t) {}, frame.data(), frame.size());
+    }
+    if (frames != static_cast<size_t>(state.iterations()))
+    {
+        state.SkipWithError("Frames lost");
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_FecReceive)->Apply(FecPayloads);
+
+/**
+ * @brief Worst case of the decoder, every codeword has the maximum number of wrong bytes
+ */
+static void BM_FecCorrect(benchmark::State &state)
+{
+    static SMPFec<MaximumFecPayload, FecDepth> fec;
+    auto payload = CreatePayload(state.range(0), state.range(1));
+    auto frame = CreateFecFrame(fec, payload);
+    size_t body = FEC_SYNC_LENGTH + FEC_HEADER_LENGTH;
+    size_t depth = frame[FEC_SYNC_LENGTH + 2];
+    for (size_t row = 0; row < NPAR / 2; row++)
+    {
+        for (size_t lane = 0; lane < depth; lane++)
+        {
+            frame[body + row * depth + lane] ^= 0x5A;
+        }
+    }
+    size_t frames = 0;
+    for (auto _ : state)
+    {
+        frames += fec.Receive([](const uint8_t *, size_t) {}, frame.data(), frame.size());
+    }
+    if (frames != static_cast<size_t>(state.iterations()))
+    {
+        state.SkipWithError("Frames lost");
+    }
+    SetRates(state, payload.size());
+}
+BENCHMARK(BM_FecCorrect)->Apply(FecPayloads);
+
+/**
+ * @brief Syndromes of depth full codewords, the rate is the codeword rate in bytes
+ */
+static void BM_FecSyndromes(benchmark::State &state)
+{
+    ecc_t ecc;
+    initialize_ecc(&ecc);
+    size_t depth = state.range(0);
+    auto data = CreatePayload(depth * FEC_BLOCK_DATA_LENGTH, RandomFramestarts);
+    std::vector<uint8_t> parity(depth * NPAR);
+    FEC_InterleavedParity(data.data(), data.size(), depth, parity.data(), &ecc);
+    uint8_t syndromes[FEC_SYNDROME_LANES * NPAR];
+    for (auto _ : state)
+    {
+        for (size_t lane = 0; lane < depth;)
+        {
+            lane += FEC_InterleavedSyndromes(data.data(), data.size(), parity.data(), depth, lane, syndromes, &ecc);
+            benchmark::DoNotOptimize(syndromes);
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * depth * FEC_BLOCKSIZE));
+    state.SetLabel("depth " + std::to_string(depth));
+}
+BENCHMARK(BM_FecSyndromes)->Arg(1)->Arg(16)->Arg(32)->Arg(255);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,108 @@
+#include "libsmp.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define MAXLENGTH 4096
+#define MAXALIGNMENT 16
+#define RANDOM_RUNS 20000
+
+static uint8_t testdata[MAXLENGTH + MAXALIGNMENT];
+
+/**
+ * Bitwise reference implementation of the reflected CRC-16 with the polynomial 0xA001,
+ * independent of the library so a wrong table or polynomial in smp_crc.c is detected
+ */
+static uint16_t referenceCRC(uint16_t crc, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static bool checkCRC(uint16_t startcrc, size_t alignment, size_t length)
+{
+    const uint8_t *data = testdata + alignment;
+    uint16_t expected = referenceCRC(startcrc, data, length);
+    uint16_t calculated = SMP_crc16_block(startcrc, data, length);
+    if (expected != calculated)
+    {
+        printf("CRC missmatch: start 0x%04X, alignment %zu, length %zu: expected 0x%04X, got 0x%04X\n",
+               startcrc, alignment, length, expected, calculated);
+        return false;
+    }
+    return true;
+}
+
+int main(void)
+{
+    uint32_t failed = 0;
+    for (size_t i = 0; i < sizeof(testdata); i++)
+    {
+        testdata[i] = rand() & 0xFF;
+    }
+
+    // Known check value of the CRC-16/ARC for "123456789"
+    if (SMP_crc16_block(0, (const uint8_t *)"123456789", 9) != 0xBB3D || referenceCRC(0, (const uint8_t *)"123456789", 9) != 0xBB3D)
+    {
+        printf("Check value missmatch\n");
+        failed++;
+    }
+
+    // The bytewise function of the library
+    for (size_t i = 0; i < 256; i++)
+    {
+        uint16_t crc = (uint16_t)(rand() & 0xFFFF);
+        uint8_t byte = (uint8_t)i;
+        if (SMP_crc16(crc, byte, CRC_POLYNOM) != referenceCRC(crc, &byte, 1))
+        {
+            printf("SMP_crc16 missmatch for byte 0x%02zX\n", i);
+            failed++;
+        }
+    }
+
+    // Every length up to a few simd blocks for every alignment
+    for (size_t alignment = 0; alignment < MAXALIGNMENT; alignment++)
+    {
+        for (size_t length = 0; length <= 512; length++)
+        {
+            if (!checkCRC(0, alignment, length))
+                failed++;
+        }
+    }
+
+    for (uint32_t i = 0; i < RANDOM_RUNS; i++)
+    {
+        size_t alignment = rand() % MAXALIGNMENT;
+        size_t length = rand() % (MAXLENGTH + 1);
+        if (!checkCRC(rand() & 0xFFFF, alignment, length))
+            failed++;
+    }
+
+    // Continuing a calculation over split buffers must give the same result
+    for (size_t split = 0; split <= MAXLENGTH; split += 7)
+    {
+        uint16_t crc = SMP_crc16_block(0, testdata, split);
+        crc = SMP_crc16_block(crc, testdata + split, MAXLENGTH - split);
+        if (crc != referenceCRC(0, testdata, MAXLENGTH))
+        {
+            printf("CRC missmatch when splitting at %zu\n", split);
+            failed++;
+        }
+    }
+
+    if (failed > 0)
+    {
+        printf("%u crc tests failed\n", failed);
+        return -1;
+    }
+    printf("All crc tests successfull\n");
+    return 0;
+}
@@ -23,6 +23,10 @@ int main()
 
     encode_calcParity(headerfieldstart, HEADER_LENGTH, headerfieldstart + HEADER_LENGTH, &fec);
 
+    //Two transmission errors, one in the data and one in the parity
+    headerfieldstart[1] ^= 0x5A;
+    headerfieldstart[HEADER_LENGTH + 2] ^= 0x01;
+
     bool valid;
     //Check syndroms
     decode_data(headerfieldstart, HEADER_BLOCK_LENGTH, &fec);
@@ -48,5 +52,5 @@ int main()
             blockcount = headerfieldstart[0] << 8 | headerfieldstart[1];
         }
     }
-    return 0;
+    return blockcount == 4 ? 0 : 1;
 }
\ No newline at end of file
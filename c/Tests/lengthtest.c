@@ -0,0 +1,124 @@
+#include "libsmp.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Frames with the payload length 253 + n * 256 have the low byte 0xFF in the length field,
+// so the framestart is followed by two framestarts (the stuffed length byte).
+
+#define MAXPAYLOAD SMP_MAX_PAYLOAD // The length field holds the payload length + 2
+
+// One byte more than the maximum payload, so only the length limit rejects the longer payload
+static uint8_t payload[MAXPAYLOAD + 1];
+static uint8_t frame[SMP_SEND_BUFFER_LENGTH(MAXPAYLOAD + 1)];
+static uint8_t stream[3 + 2 * SMP_SEND_BUFFER_LENGTH(MAXPAYLOAD)];
+static uint8_t framebuffer[MAXPAYLOAD];
+
+typedef struct
+{
+    uint32_t frames;
+    uint32_t expectedLength;
+    bool valid;
+} receiveResult_t;
+
+static void checkFrame(void *context, const uint8_t *data, uint32_t length)
+{
+    receiveResult_t *result = (receiveResult_t *)context;
+    result->frames++;
+    if (length != result->expectedLength || memcmp(data, payload, length) != 0)
+    {
+        result->valid = false;
+    }
+}
+
+/**
+ * Receive the data in chunks of chunksize bytes and check that it contained the expected number of valid frames
+ */
+static bool receive(const uint8_t *data, size_t length, size_t chunksize, uint32_t payloadlength, uint32_t frames)
+{
+    smp_struct_t smp;
+    SMP_Init(&smp);
+    receiveResult_t result = {0, payloadlength, true};
+    for (size_t offset = 0; offset < length; offset += chunksize)
+    {
+        size_t chunk = length - offset < chunksize ? length - offset : chunksize;
+        SMP_ReceiveBuffer(&smp, data + offset, chunk, framebuffer, sizeof(framebuffer), checkFrame, &result);
+    }
+    return result.valid && result.frames == frames;
+}
+
+static bool checkLength(uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        payload[i] = rand() % 8 == 0 ? FRAMESTART : rand() & 0xFF;
+    }
+    smp_segment_t segment = {payload, length};
+    size_t framelength = SMP_SendV(&segment, 1, frame, sizeof(frame));
+    if (framelength == 0)
+    {
+        printf("Payload length %u not encoded\n", length);
+        return false;
+    }
+
+    bool ok = receive(frame, framelength, framelength, length, 1);
+    ok = receive(frame, framelength, 1, length, 1) && ok;
+    // The same frame twice back to back, after some noise without a framestart
+    memset(stream, 0x55, 3);
+    memcpy(stream + 3, frame, framelength);
+    memcpy(stream + 3 + framelength, frame, framelength);
+    ok = receive(stream, 3 + 2 * framelength, 7, length, 2) && ok;
+    if (!ok)
+    {
+        printf("Frame with payload length %u not received\n", length);
+    }
+    return ok;
+}
+
+/**
+ * The longest payload round trips through SMP_Encode, one byte more would wrap the length field to 0
+ */
+static bool checkEncodeLimit(void)
+{
+    for (uint32_t i = 0; i <= MAXPAYLOAD; i++)
+    {
+        payload[i] = rand() % 8 == 0 ? FRAMESTART : rand() & 0xFF;
+    }
+    size_t framelength = SMP_EncodedLength(payload, MAXPAYLOAD);
+    bool ok = framelength > 0 && SMP_Encode(payload, MAXPAYLOAD, frame, framelength) == framelength &&
+              receive(frame, framelength, framelength, MAXPAYLOAD, 1);
+    if (!ok)
+    {
+        printf("Payload length %u not encoded by SMP_Encode\n", MAXPAYLOAD);
+    }
+    if (SMP_EncodedLength(payload, MAXPAYLOAD + 1) != 0 || SMP_Encode(payload, MAXPAYLOAD + 1, frame, sizeof(frame)) != 0)
+    {
+        printf("Payload length %u accepted by SMP_Encode\n", MAXPAYLOAD + 1);
+        ok = false;
+    }
+    return ok;
+}
+
+int main(void)
+{
+    uint32_t failed = 0;
+    if (!checkEncodeLimit())
+        failed++;
+    for (uint32_t length = 253; length <= MAXPAYLOAD; length += 256)
+    {
+        if (!checkLength(length))
+            failed++;
+        // The neighbours without a stuffed length byte
+        if (!checkLength(length - 1) || (length < MAXPAYLOAD && !checkLength(length + 1)))
+            failed++;
+    }
+
+    if (failed > 0)
+    {
+        printf("%u length tests failed\n", failed);
+        return -1;
+    }
+    printf("All length tests successfull\n");
+    return 0;
+}
@@ -0,0 +1,266 @@
+#include "libsmp.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// The vectorized bytestuffing against bytewise reference implementations, for every length up to a few vectors
+// at every start alignment. Framestarts are placed at the vector lane boundaries.
+// SMP_UnstuffBytes and SMP_PacketDecode also have to reject truncated data, broken stuffing and crc errors,
+// including the stuffing of the length field.
+
+#define MAXLENGTH 100
+#define MAXALIGNMENT 64
+#define GUARD 0xA5
+
+#if defined(__GNUC__) && defined(__AVX2__) && (defined(__x86_64__) || defined(__i386__))
+#define SKIP_WITHOUT_AVX2 1
+#endif
+
+static _Alignas(64) uint8_t source[MAXALIGNMENT + MAXLENGTH];
+static _Alignas(64) uint8_t stuffed[MAXALIGNMENT + 2 * MAXLENGTH + 16];
+static _Alignas(64) uint8_t decoded[MAXALIGNMENT + SMP_SEND_BUFFER_LENGTH(MAXLENGTH)];
+static uint8_t expected[2 * MAXLENGTH];
+static uint8_t frame[SMP_SEND_BUFFER_LENGTH(MAXLENGTH)];
+static uint32_t failed = 0;
+
+static size_t referenceStuff(uint8_t *dest, const uint8_t *src, size_t length)
+{
+    size_t out = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        dest[out++] = src[i];
+        if (src[i] == FRAMESTART)
+            dest[out++] = FRAMESTART;
+    }
+    return out;
+}
+
+/**
+ * Frame with the reference bytestuffing and the crc of SMP_crc16_block
+ */
+static size_t referenceFrame(uint8_t *dest, const uint8_t *payload, size_t length)
+{
+    uint16_t lengthfield = (uint16_t)(length + 2);
+    uint16_t crc = SMP_crc16_block(0, payload, length);
+    const uint8_t header[] = {(uint8_t)(lengthfield & 0xFF), (uint8_t)(lengthfield >> 8)};
+    const uint8_t trailer[] = {(uint8_t)(crc >> 8), (uint8_t)(crc & 0xFF)};
+    size_t out = 0;
+    dest[out++] = FRAMESTART;
+    out += referenceStuff(dest + out, header, sizeof(header));
+    out += referenceStuff(dest + out, payload, length);
+    out += referenceStuff(dest + out, trailer, sizeof(trailer));
+    return out;
+}
+
+static size_t referenceCount(const uint8_t *data, size_t length)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (data[i] == FRAMESTART)
+            count++;
+    }
+    return count;
+}
+
+/**
+ * Fill the data with random bytes, pattern selects framestarts at the lane boundaries, only framestarts or none
+ */
+static void fillPattern(uint8_t *data, size_t length, int pattern)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        switch (pattern)
+        {
+        case 0:
+            data[i] = rand() % 0xFF; // No framestart
+            break;
+        case 1:
+            data[i] = FRAMESTART;
+            break;
+        case 2:
+            // The first and the last byte of every 16 byte block, so both sides of every 16 and 32 byte vector boundary
+            data[i] = (i % 16 == 0 || i % 16 == 15) ? FRAMESTART : rand() % 0xFF;
+            break;
+        default:
+            data[i] = rand() % 4 == 0 ? FRAMESTART : rand() & 0xFF;
+            break;
+        }
+    }
+}
+
+static void check(bool condition, const char *message, size_t alignment, size_t length, int pattern)
+{
+    if (!condition)
+    {
+        printf("%s: alignment %zu, length %zu, pattern %d\n", message, alignment, length, pattern);
+        failed++;
+    }
+}
+
+static void checkStuffing(size_t alignment, size_t length, int pattern)
+{
+    const uint8_t *src = source + alignment;
+    size_t expectedLength = referenceStuff(expected, src, length);
+    check(SMP_CountFramestarts(src, length) == referenceCount(src, length), "SMP_CountFramestarts differs", alignment, length, pattern);
+
+    uint8_t *dest = stuffed + alignment;
+    memset(stuffed, GUARD, sizeof(stuffed));
+    size_t written = SMP_StuffBytes(dest, src, length);
+    check(written == expectedLength && memcmp(dest, expected, written) == 0, "SMP_StuffBytes differs", alignment, length, pattern);
+    bool guard = true;
+    for (size_t i = alignment + written; i < sizeof(stuffed); i++)
+    {
+        guard = guard && stuffed[i] == GUARD;
+    }
+    check(guard, "SMP_StuffBytes wrote behind the stuffed data", alignment, length, pattern);
+}
+
+static void checkUnstuffing(size_t alignment, size_t length, int pattern)
+{
+    const uint8_t *src = source + alignment;
+    uint8_t *in = stuffed + alignment;
+    size_t stuffedLength = referenceStuff(in, src, length);
+    // Bytes behind the stuffed data must not be consumed
+    memset(in + stuffedLength, FRAMESTART, 8);
+
+    uint8_t *dest = decoded + alignment;
+    check(SMP_UnstuffBytes(dest, in, stuffedLength + 8, length) == stuffedLength && memcmp(dest, src, length) == 0,
+          "SMP_UnstuffBytes differs", alignment, length, pattern);
+
+    memcpy(dest, in, stuffedLength);
+    check(SMP_UnstuffBytes(dest, dest, stuffedLength, length) == stuffedLength && memcmp(dest, src, length) == 0,
+          "SMP_UnstuffBytes in place differs", alignment, length, pattern);
+
+    if (length == 0)
+        return;
+    check(SMP_UnstuffBytes(dest, in, stuffedLength - 1, length) == 0, "SMP_UnstuffBytes accepted truncated data", alignment, length, pattern);
+    for (size_t i = 0; i + 1 < stuffedLength; i++)
+    {
+        if (in[i] != FRAMESTART)
+            continue;
+        // A framestart that is followed by another byte than the stuffing byte
+        in[i + 1] = 0x00;
+        check(SMP_UnstuffBytes(dest, in, stuffedLength, length) == 0, "SMP_UnstuffBytes accepted a missing stuffing byte", alignment, length, pattern);
+        in[i + 1] = FRAMESTART;
+        i++;
+    }
+}
+
+static void checkPacketDecode(size_t alignment, size_t length, int pattern)
+{
+    const uint8_t *src = source + alignment;
+    size_t framelength = referenceFrame(frame, src, length);
+    uint8_t *data = decoded + alignment;
+    uint8_t payload[MAXLENGTH];
+    uint16_t payloadlength = 0xFFFF;
+    check(framelength > 0 && SMP_PacketDecode(frame, framelength, payload, sizeof(payload), &payloadlength) && payloadlength == length &&
+              memcmp(payload, src, length) == 0,
+          "SMP_PacketDecode differs", alignment, length, pattern);
+
+    memcpy(data, frame, framelength);
+    payloadlength = 0xFFFF;
+    check(SMP_PacketDecode(data, framelength, data, framelength, &payloadlength) && payloadlength == length && memcmp(data, src, length) == 0,
+          "SMP_PacketDecode in place differs", alignment, length, pattern);
+
+    if (length > 0)
+    {
+        check(!SMP_PacketDecode(frame, framelength, payload, length - 1, NULL), "SMP_PacketDecode overflowed the payload buffer", alignment, length, pattern);
+    }
+    for (size_t i = 0; i < framelength; i++)
+    {
+        memcpy(data, frame, i);
+        check(!SMP_PacketDecode(data, i, data, framelength, NULL), "SMP_PacketDecode accepted a truncated frame", alignment, length, pattern);
+    }
+
+    // Every stuffing byte and every bit error behind the framestart, the length field is corrupted as well
+    for (size_t i = 1; i < framelength; i++)
+    {
+        memcpy(data, frame, framelength);
+        if (frame[i] == FRAMESTART)
+        {
+            data[i + 1] = 0x00;
+            check(!SMP_PacketDecode(data, framelength, data, framelength, NULL), "SMP_PacketDecode accepted a missing stuffing byte", alignment, length, pattern);
+            i++;
+        }
+        else if (frame[i] != FRAMESTART - 1)
+        {
+            data[i] ^= 0x01;
+            check(!SMP_PacketDecode(data, framelength, data, framelength, NULL), "SMP_PacketDecode accepted a crc error", alignment, length, pattern);
+        }
+    }
+}
+
+/**
+ * Payload lengths with 0xFF in the length field, so the header itself has stuffing bytes.
+ * The field of the longest payload is 0xFFFF, both length bytes are stuffed.
+ */
+static void checkHeaderStuffing(void)
+{
+    static const size_t lengths[] = {253, 509, SMP_MAX_PAYLOAD};
+    static uint8_t payload[SMP_MAX_PAYLOAD];
+    static uint8_t longframe[SMP_SEND_BUFFER_LENGTH(SMP_MAX_PAYLOAD)];
+    static uint8_t data[SMP_SEND_BUFFER_LENGTH(SMP_MAX_PAYLOAD)];
+    for (size_t n = 0; n < sizeof(lengths) / sizeof(lengths[0]); n++)
+    {
+        size_t length = lengths[n];
+        fillPattern(payload, length, 3);
+        size_t framelength = referenceFrame(longframe, payload, length);
+        uint16_t payloadlength = 0;
+        memcpy(data, longframe, framelength);
+        check(SMP_PacketDecode(data, framelength, data, sizeof(data), &payloadlength) && payloadlength == length && memcmp(data, payload, length) == 0,
+              "SMP_PacketDecode differs with a stuffed header", 0, length, 3);
+
+        // The framestart and both length bytes with their stuffing bytes
+        size_t headerlength = 3 + (((length + 2) & 0xFF) == FRAMESTART) + (((length + 2) >> 8) == FRAMESTART);
+        for (size_t i = 1; i < headerlength; i++)
+        {
+            memcpy(data, longframe, framelength);
+            if (longframe[i] == FRAMESTART)
+            {
+                data[i + 1] = 0x00;
+                check(!SMP_PacketDecode(data, framelength, data, sizeof(data), NULL), "SMP_PacketDecode accepted a missing stuffing byte in the header", 0, length, 3);
+                i++;
+            }
+            else
+            {
+                data[i] ^= 0x01;
+                check(!SMP_PacketDecode(data, framelength, data, sizeof(data), NULL), "SMP_PacketDecode accepted a wrong length", 0, length, 3);
+            }
+        }
+    }
+}
+
+int main(void)
+{
+#ifdef SKIP_WITHOUT_AVX2
+    if (!__builtin_cpu_supports("avx2"))
+    {
+        printf("AVX2 not supported, skipped\n");
+        return 77;
+    }
+#endif
+    for (int pattern = 0; pattern < 4; pattern++)
+    {
+        for (size_t alignment = 0; alignment < MAXALIGNMENT; alignment++)
+        {
+            for (size_t length = 0; length <= MAXLENGTH; length++)
+            {
+                fillPattern(source + alignment, length, pattern);
+                checkStuffing(alignment, length, pattern);
+                checkUnstuffing(alignment, length, pattern);
+                checkPacketDecode(alignment, length, pattern);
+            }
+        }
+    }
+    checkHeaderStuffing();
+
+    if (failed > 0)
+    {
+        printf("%u stuffing tests failed\n", failed);
+        return -1;
+    }
+    printf("All stuffing tests successfull\n");
+    return 0;
+}
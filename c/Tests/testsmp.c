@@ -1,5 +1,5 @@
-#include "../libsmp.h"
-#include "../fecmp/libfecmp.h"
+#include "libsmp.h"
+#include "libfecmp.h"
 #include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
@@ -19,7 +19,7 @@ uint8_t smpbuffer[1024];
 smp_struct_t smp;
 #define TESTFEC
 #ifdef TESTFEC
-uint8_t fecmpbuffer[512 * BLOCKSIZE];
+uint8_t fecmpbuffer[FEC_RECEIVE_BUFFER_LENGTH(MAXMESSAGELENGTH, 1)];
 libfecmp_t fecmp;
 #endif
 
@@ -38,9 +38,9 @@ static bool SequenceEqual(uint8_t *seq1, uint8_t *seq2, uint32_t length)
     return true;
 }
 
-static void printPacket(uint8_t *data, uint32_t length)
+static void printPacket(const uint8_t *data, uint32_t length)
 {
-    for (int i = 0; i < length; i++)
+    for (uint32_t i = 0; i < length; i++)
     {
         if (i > 0)
         {
@@ -59,17 +59,12 @@ static void printPacket(uint8_t *data, uint32_t length)
 uint8_t latestReceived[1024];
 uint32_t latestReceivedLength;
 
-signed char smpdatareceived(uint8_t *data, uint32_t length)
+void smpdatareceived(void *context, const uint8_t *data, uint32_t length)
 {
+    (void)context;
     memcpy(latestReceived, data, length);
     latestReceivedLength = length;
     printf("Received packet\n");
-    return 1;
-}
-
-signed char fecdatareceived(uint8_t *data, uint32_t length)
-{
-    return 0;
 }
 
 uint32_t CreateRandomMessage(uint8_t *buffer, uint32_t minmessagelength, uint32_t maxmessagelength)
@@ -115,13 +110,8 @@ int main(void)
     //srand(time(NULL));
 
     printf("Init smp structures\n");
-    //Setup smp
-    smp_settings_t smpsettings;
-    memset(&smpsettings, 0, sizeof(smpsettings));
-    smpsettings.buffer.buffer = smpbuffer;
-    smpsettings.buffer.maxlength = sizeof(smpbuffer);
-    smpsettings.frameReadyCallback = smpdatareceived;
-    SMP_Init(&smp, &smpsettings);
+    //Setup smp, the frames are decoded into smpbuffer
+    SMP_Init(&smp);
 
     printf("Init fec structures\n");
     //Setup fecmp
@@ -130,7 +120,8 @@ int main(void)
     memset(&fecmpsettings, 0, sizeof(fecmpsettings));
     fecmpsettings.data = fecmpbuffer;
     fecmpsettings.bufferlength = sizeof(fecmpbuffer);
-    fecmpsettings.frameReadyCallback = smpdatareceived;
+    fecmpsettings.frameHandler = smpdatareceived;
+    fecmpsettings.depth = 1;
     fec_Init(&fecmp, &fecmpsettings);
 #endif
     uint8_t packetbuffer[2048];           //Buffer for sending
@@ -164,7 +155,9 @@ int main(void)
         memset(packetbuffer, 0, sizeof(packetbuffer));
         payloadlength = CreateRandomMessage(payloadbuffer, MINMESSAGELENGTH, MAXMESSAGELENGTH);
         smppayloadbytes += payloadlength;
-        toSend = fec_encode(payloadbuffer, payloadlength, packetbuffer, sizeof(packetbuffer), &msgstart, &fecmp);
+        //The fec frame starts at the beginning of the buffer and contains the smp frame
+        toSend = fec_encode(payloadbuffer, payloadlength, packetbuffer, sizeof(packetbuffer), &fecmp);
+        msgstart = packetbuffer;
         //toSend = SMP_Send(payloadbuffer, payloadlength, packetbuffer, sizeof(packetbuffer), &msgstart);
         smptransmittedbytes += toSend;
         if (toSend > 0)
@@ -172,7 +165,7 @@ int main(void)
             hasErrors = AddRandomError(msgstart, toSend, BITERRORPROB, &addedByteErrors);
             smptotalByteErrors += addedByteErrors;
             //SMP try to decode the data
-            returncode = SMP_RecieveInBytes(msgstart, toSend, &smp);
+            returncode = SMP_ReceiveBuffer(&smp, msgstart, toSend, smpbuffer, sizeof(smpbuffer), smpdatareceived, NULL);
             if (hasErrors)
             {
                 printf("Packet had errors\n");
@@ -199,10 +192,9 @@ int main(void)
                     printf("Original: ");
                     printPacket(payloadbuffer, payloadlength);
                     printf("Transmitlength: %u\n", toSend);
-                    printf("Recovered packet lenght: %u\n", SMP_PacketGetLength(msgstart, 0));
                     printf("Received: ");
                     printPacket(latestReceived, latestReceivedLength);
-                    printf("Returncode %d\n", returncode);
+                    printf("Received frames %d\n", returncode);
                     printf("Last packet: ");
                     printPacket(lasttransmittedmessage, lastDataToTransmitCount);
                     if (lasttransmittedmessage[lastDataToTransmitCount - 1] == 0xFF)
@@ -228,7 +220,7 @@ int main(void)
                         printPacket(payloadbuffer, payloadlength);
                         printf("Received: ");
                         printPacket(latestReceived, latestReceivedLength);
-                        printf("Returncode %d\n", returncode);
+                        printf("Received frames %d\n", returncode);
                         return -1; //This is a serious error
                     }
                     else
@@ -261,10 +253,9 @@ int main(void)
                     printf("Original: ");
                     printPacket(payloadbuffer, payloadlength);
                     printf("Transmitlength: %u\n", toSend);
-                    printf("Recovered packet lenght: %u\n", SMP_PacketGetLength(msgstart, 0));
                     printf("Received: ");
                     printPacket(latestReceived, latestReceivedLength);
-                    printf("Returncode %d\n", returncode);
+                    printf("Received frames %d\n", returncode);
                     printf("Last packet: ");
                     printPacket(lasttransmittedmessage, lastDataToTransmitCount);
                     if (lasttransmittedmessage[lastDataToTransmitCount - 1] == 0xFF)
@@ -289,7 +280,7 @@ int main(void)
                         printPacket(payloadbuffer, payloadlength);
                         printf("Received: ");
                         printPacket(latestReceived, latestReceivedLength);
-                        printf("Returncode %d\n", returncode);
+                        printf("Received frames %d\n", returncode);
                         return -1; //This is a serious error
                     }
                 }
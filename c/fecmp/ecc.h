@@ -0,0 +1,95 @@
+/*****************************************************************************************************
+ File: ecc
+ Autor: Peter Kremsner
+
+ Reed solomon code over GF(256) with NPAR parity bytes per codeword. A codeword holds at most FEC_BLOCKSIZE bytes,
+ the data bytes followed by the parity bytes. Shorter codewords are shortened codes with implicit leading zeros.
+ Up to NPAR/2 wrong bytes or NPAR erased bytes (2 * errors + erasures <= NPAR) are corrected per codeword.
+
+ Usage:
+    initialize_ecc(&ecc);
+    encode_calcParity(data, datalength, parity, &ecc);           // Sender
+    decode_data(codeword, datalength + NPAR, &ecc);              // Receiver
+    if (check_syndrome(&ecc))
+        ok = correct_errors_erasures(codeword, datalength + NPAR, 0, NULL, &ecc);
+
+ The parity and the syndromes of the interleaved blocks of libfecmp are computed for 16 (SSSE3, NEON) or 32 (AVX2) codewords at once.
+ The instruction set is selected at compile time, define FEC_SCALAR to disable the vector code.
+
+ ******************************************************************************************************/
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sharedlib.h"
+
+/**
+ * Number of parity bytes per codeword. The definition changes the layout of ecc_t and the transmitted frames,
+ * the library, the application and the remote station must be compiled with the same value.
+ */
+#ifndef FEC_PARITY_LENGTH
+#define FEC_PARITY_LENGTH 16
+#endif
+#define NPAR FEC_PARITY_LENGTH
+
+#define FEC_BLOCKSIZE 255                           // Maximum codeword length
+#define FEC_BLOCK_DATA_LENGTH (FEC_BLOCKSIZE - NPAR) // Maximum data bytes per codeword
+
+#if NPAR < 2 || NPAR > 64 || (NPAR % 2) != 0
+#error "FEC_PARITY_LENGTH must be an even number from 2 to 64"
+#endif
+
+/**
+ * Maximum number of codewords FEC_InterleavedSyndromes processes per call, the syndrome buffer holds FEC_SYNDROME_LANES * NPAR bytes.
+ * FEC_SCALAR also removes the multiplication tables of the vector code from ecc_t, it has to be defined for the library and the application alike.
+ */
+#ifdef FEC_SCALAR
+#define FEC_SYNDROME_LANES 1
+#else
+#define FEC_SYNDROME_LANES 32
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Generator polynom, the syndromes of the last decoded codeword and the working polynoms of the decoder.
+     * The encoder only reads the structure, the decoder functions write the syndromes and polynoms,
+     * so every thread that decodes needs its own ecc_t.
+     * */
+    typedef struct
+    {
+        uint8_t generator[NPAR + 1]; // Coefficient i belongs to x^i, generator[NPAR] is 1
+        uint8_t generatorLog[NPAR];  // Logarithms of the coefficients below x^NPAR, 0xFF for a zero coefficient
+        uint8_t syndromes[NPAR];     // Syndrome i is the codeword evaluated at alpha^(i+1)
+        uint8_t locator[NPAR + 1];   // Errata locator of the last correction
+        uint8_t evaluator[NPAR];     // Errata evaluator of the last correction
+        unsigned int corrected;      // Bytes changed by the last call to correct_errors_erasures
+#ifndef FEC_SCALAR
+        /**
+         * Products of the multiplication constants with all values of the low and the high nibble, for the vector table lookups
+         * */
+        uint8_t syndromeTables[NPAR][2][16];  // alpha^(i+1)
+        uint8_t generatorTables[NPAR][2][16]; // generator[i]
+#endif
+    } ecc_t;
+
+    MODULE_API void initialize_ecc(ecc_t *ecc);
+    MODULE_API void encode_calcParity(const uint8_t *data, size_t length, uint8_t *parity, const ecc_t *ecc);
+    MODULE_API void decode_data(const uint8_t *codeword, size_t length, ecc_t *ecc);
+    MODULE_API bool check_syndrome(const ecc_t *ecc);
+    MODULE_API bool correct_errors_erasures(uint8_t *codeword, size_t length, int nerasures, const int *erasures, ecc_t *ecc);
+
+    /**
+     * Interleaved blocks: Byte r of codeword k is data[r * depth + k], parity byte j of codeword k is parity[j * depth + k].
+     * Data bytes at or behind length are treated as zero and aren't transmitted.
+     * */
+    MODULE_API void FEC_InterleavedParity(const uint8_t *data, size_t length, size_t depth, uint8_t *parity, const ecc_t *ecc);
+    MODULE_API size_t FEC_InterleavedSyndromes(const uint8_t *data, size_t length, const uint8_t *parity, size_t depth, size_t lane, uint8_t *syndromes, const ecc_t *ecc);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,46 @@
+/*****************************************************************************************************
+ File: fec_gf
+ Autor: Peter Kremsner
+
+ Table driven GF(256) arithmetic of the reed solomon codes, for internal use of the fecmp sources only.
+
+ ******************************************************************************************************/
+#pragma once
+
+#include <inttypes.h>
+
+extern const uint8_t FEC_GF_EXP[512];
+extern const uint8_t FEC_GF_LOG[256];
+
+static inline uint8_t FEC_GF_Multiply(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return FEC_GF_EXP[FEC_GF_LOG[a] + FEC_GF_LOG[b]];
+}
+
+/**
+ * @brief Multiply with a constant that is given as logarithm, saves one table lookup in the inner loops
+ */
+static inline uint8_t FEC_GF_MultiplyLog(uint8_t a, unsigned int logb)
+{
+    if (a == 0)
+        return 0;
+    return FEC_GF_EXP[FEC_GF_LOG[a] + logb];
+}
+
+/**
+ * @brief Multiplicative inverse, a must not be zero
+ */
+static inline uint8_t FEC_GF_Inverse(uint8_t a)
+{
+    return FEC_GF_EXP[255 - FEC_GF_LOG[a]];
+}
+
+/**
+ * @brief alpha^power for any non negative power
+ */
+static inline uint8_t FEC_GF_Power(unsigned int power)
+{
+    return FEC_GF_EXP[power % 255];
+}
@@ -0,0 +1,498 @@
+/*****************************************************************************************************
+ File: fec_rs
+ Autor: Peter Kremsner
+
+ Reed solomon encoder and errors and erasures decoder (Berlekamp-Massey, Chien search and Forney algorithm).
+ The roots of the generator polynom are alpha^1 ... alpha^NPAR.
+
+ The interleaved functions process one codeword per vector lane. A multiplication with a constant is split into
+ two table lookups, one with the low and one with the high nibble of every byte (PSHUFB, TBL).
+ The last group of codewords of a block fills only a part of the lanes, the unused lanes are zero.
+
+ ******************************************************************************************************/
+#include "ecc.h"
+#include "fec_gf.h"
+#include <string.h>
+
+/**
+ * Groups of fewer codewords than this are processed by the scalar code, a vector with few used lanes is slower
+ */
+#define FEC_VECTOR_MIN_LANES 8
+
+#if defined(FEC_SCALAR)
+// Vector extensions disabled
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define FEC_VECTORLENGTH 32
+typedef __m256i fec_vector_t;
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define FEC_VECTORLENGTH 16
+typedef __m128i fec_vector_t;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define FEC_VECTORLENGTH 16
+typedef uint8x16_t fec_vector_t;
+#endif
+
+#ifdef FEC_VECTORLENGTH
+static inline fec_vector_t private_load(const uint8_t *ptr)
+{
+#if FEC_VECTORLENGTH == 32
+    return _mm256_loadu_si256((const __m256i *)ptr);
+#elif defined(__SSSE3__)
+    return _mm_loadu_si128((const __m128i *)ptr);
+#else
+    return vld1q_u8(ptr);
+#endif
+}
+
+static inline void private_store(uint8_t *ptr, fec_vector_t v)
+{
+#if FEC_VECTORLENGTH == 32
+    _mm256_storeu_si256((__m256i *)ptr, v);
+#elif defined(__SSSE3__)
+    _mm_storeu_si128((__m128i *)ptr, v);
+#else
+    vst1q_u8(ptr, v);
+#endif
+}
+
+static inline fec_vector_t private_xor(fec_vector_t a, fec_vector_t b)
+{
+#if FEC_VECTORLENGTH == 32
+    return _mm256_xor_si256(a, b);
+#elif defined(__SSSE3__)
+    return _mm_xor_si128(a, b);
+#else
+    return veorq_u8(a, b);
+#endif
+}
+
+static inline fec_vector_t private_zero(void)
+{
+#if FEC_VECTORLENGTH == 32
+    return _mm256_setzero_si256();
+#elif defined(__SSSE3__)
+    return _mm_setzero_si128();
+#else
+    return vdupq_n_u8(0);
+#endif
+}
+
+/**
+ * @brief Multiply every byte with the constant of the nibble tables
+ */
+static inline fec_vector_t private_multiply(fec_vector_t x, const uint8_t table[2][16])
+{
+#if FEC_VECTORLENGTH == 32
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)table[0]));
+    __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)table[1]));
+    return _mm256_xor_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(x, mask)),
+                            _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+#elif defined(__SSSE3__)
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i low = _mm_loadu_si128((const __m128i *)table[0]);
+    __m128i high = _mm_loadu_si128((const __m128i *)table[1]);
+    return _mm_xor_si128(_mm_shuffle_epi8(low, _mm_and_si128(x, mask)),
+                         _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+#else
+    return veorq_u8(vqtbl1q_u8(vld1q_u8(table[0]), vandq_u8(x, vdupq_n_u8(0x0F))),
+                    vqtbl1q_u8(vld1q_u8(table[1]), vshrq_n_u8(x, 4)));
+#endif
+}
+
+/**
+ * @brief Load count bytes of one row into the first lanes, the other lanes and the bytes at or behind length are zero
+ */
+static inline fec_vector_t private_load_lanes(const uint8_t *data, size_t length, size_t offset, size_t count, uint8_t *scratch)
+{
+    if (count == FEC_VECTORLENGTH && offset + FEC_VECTORLENGTH <= length)
+        return private_load(data + offset);
+    memset(scratch, 0, FEC_VECTORLENGTH);
+    if (offset < length)
+    {
+        memcpy(scratch, data + offset, length - offset < count ? length - offset : count);
+    }
+    return private_load(scratch);
+}
+#endif
+
+#ifndef FEC_SCALAR
+static void private_build_table(uint8_t table[2][16], uint8_t constant)
+{
+    for (uint8_t v = 0; v < 16; v++)
+    {
+        table[0][v] = FEC_GF_Multiply(v, constant);
+        table[1][v] = FEC_GF_Multiply((uint8_t)(v << 4), constant);
+    }
+}
+#endif
+
+/**
+ * @brief Shift one data byte into the parity register, parity[0] is the coefficient of x^(NPAR-1)
+ */
+static inline void private_parity_step(uint8_t *parity, uint8_t data, const ecc_t *ecc)
+{
+    uint8_t feedback = data ^ parity[0];
+    if (feedback == 0)
+    {
+        memmove(parity, parity + 1, NPAR - 1);
+        parity[NPAR - 1] = 0;
+        return;
+    }
+    unsigned int feedbackLog = FEC_GF_LOG[feedback];
+    for (int j = 0; j < NPAR - 1; j++)
+    {
+        uint8_t coefficientLog = ecc->generatorLog[NPAR - 1 - j];
+        parity[j] = parity[j + 1] ^ (coefficientLog == 0xFF ? 0 : FEC_GF_EXP[feedbackLog + coefficientLog]);
+    }
+    parity[NPAR - 1] = ecc->generatorLog[0] == 0xFF ? 0 : FEC_GF_EXP[feedbackLog + ecc->generatorLog[0]];
+}
+
+static inline void private_syndrome_step(uint8_t *syndromes, uint8_t data)
+{
+    for (int i = 0; i < NPAR; i++)
+    {
+        syndromes[i] = FEC_GF_MultiplyLog(syndromes[i], (unsigned int)(i + 1)) ^ data;
+    }
+}
+
+/**
+ * @brief Evaluate the polynom with the coefficients poly[0] ... poly[degree] at x
+ */
+static uint8_t private_evaluate(const uint8_t *poly, int degree, uint8_t x)
+{
+    uint8_t result = 0;
+    for (int i = degree; i >= 0; i--)
+    {
+        result = FEC_GF_Multiply(result, x) ^ poly[i];
+    }
+    return result;
+}
+
+/**
+ * @brief Calculate the generator polynom and the multiplication tables
+ */
+MODULE_API void initialize_ecc(ecc_t *ecc)
+{
+    memset(ecc, 0, sizeof(*ecc));
+    ecc->generator[0] = 1;
+    for (int i = 1; i <= NPAR; i++)
+    {
+        // Multiply with (x + alpha^i)
+        uint8_t root = FEC_GF_Power((unsigned int)i);
+        for (int k = i; k > 0; k--)
+        {
+            ecc->generator[k] = ecc->generator[k - 1] ^ FEC_GF_Multiply(ecc->generator[k], root);
+        }
+        ecc->generator[0] = FEC_GF_Multiply(ecc->generator[0], root);
+    }
+    for (int i = 0; i < NPAR; i++)
+    {
+        ecc->generatorLog[i] = ecc->generator[i] == 0 ? 0xFF : FEC_GF_LOG[ecc->generator[i]];
+#ifndef FEC_SCALAR
+        private_build_table(ecc->syndromeTables[i], FEC_GF_Power((unsigned int)(i + 1)));
+        private_build_table(ecc->generatorTables[i], ecc->generator[i]);
+#endif
+    }
+}
+
+/**
+ * @brief Calculate the NPAR parity bytes of the data, length + NPAR must not exceed FEC_BLOCKSIZE
+ */
+MODULE_API void encode_calcParity(const uint8_t *data, size_t length, uint8_t *parity, const ecc_t *ecc)
+{
+    memset(parity, 0, NPAR);
+    for (size_t i = 0; i < length; i++)
+    {
+        private_parity_step(parity, data[i], ecc);
+    }
+}
+
+/**
+ * @brief Calculate the syndromes of the received codeword, the data followed by the parity bytes
+ */
+MODULE_API void decode_data(const uint8_t *codeword, size_t length, ecc_t *ecc)
+{
+    memset(ecc->syndromes, 0, NPAR);
+    for (size_t i = 0; i < length; i++)
+    {
+        private_syndrome_step(ecc->syndromes, codeword[i]);
+    }
+}
+
+/**
+ * @brief Returns true if the syndromes of the last decode_data call show an error
+ */
+MODULE_API bool check_syndrome(const ecc_t *ecc)
+{
+    uint8_t any = 0;
+    for (int i = 0; i < NPAR; i++)
+    {
+        any |= ecc->syndromes[i];
+    }
+    return any != 0;
+}
+
+/**
+ * @brief Correct the codeword with the syndromes of the last decode_data call.
+ *
+ * erasures holds the indices of nerasures bytes in the codeword that are known to be unreliable, e.g. bytes with a framing error of the uart.
+ * @return true if the codeword is valid after the correction, the codeword is unchanged if the errors can't be corrected
+ */
+MODULE_API bool correct_errors_erasures(uint8_t *codeword, size_t length, int nerasures, const int *erasures, ecc_t *ecc)
+{
+    ecc->corrected = 0;
+    if (length <= NPAR || length > FEC_BLOCKSIZE || nerasures < 0 || nerasures > NPAR)
+        return false;
+    if (!check_syndrome(ecc))
+        return true;
+
+    // Erasure locator, the product of (1 + X x) for the locations X of the erasures
+    uint8_t *locator = ecc->locator;
+    uint8_t previous[NPAR + 2];
+    memset(locator, 0, NPAR + 1);
+    locator[0] = 1;
+    for (int e = 0; e < nerasures; e++)
+    {
+        if (erasures[e] < 0 || (size_t)erasures[e] >= length)
+            return false;
+        uint8_t location = FEC_GF_Power((unsigned int)(length - 1 - (size_t)erasures[e]));
+        for (int k = e + 1; k > 0; k--)
+        {
+            locator[k] ^= FEC_GF_Multiply(locator[k - 1], location);
+        }
+    }
+    memcpy(previous, locator, NPAR + 1);
+    previous[NPAR + 1] = 0;
+
+    // Berlekamp-Massey, starting with the erasure locator
+    int order = nerasures;
+    for (int r = nerasures + 1; r <= NPAR; r++)
+    {
+        uint8_t discrepancy = 0;
+        for (int i = 0; i <= order && i < r; i++)
+        {
+            discrepancy ^= FEC_GF_Multiply(locator[i], ecc->syndromes[r - i - 1]);
+        }
+        // previous = x * previous
+        memmove(previous + 1, previous, NPAR + 1);
+        previous[0] = 0;
+        if (discrepancy == 0)
+            continue;
+        uint8_t next[NPAR + 1];
+        for (int i = 0; i <= NPAR; i++)
+        {
+            next[i] = locator[i] ^ FEC_GF_Multiply(discrepancy, previous[i]);
+        }
+        if (2 * order <= r + nerasures - 1)
+        {
+            order = r + nerasures - order;
+            uint8_t inverse = FEC_GF_Inverse(discrepancy);
+            for (int i = 0; i <= NPAR; i++)
+            {
+                previous[i] = FEC_GF_Multiply(locator[i], inverse);
+            }
+            previous[NPAR + 1] = 0;
+        }
+        memcpy(locator, next, NPAR + 1);
+    }
+    int degree = NPAR;
+    while (degree > 0 && locator[degree] == 0)
+    {
+        degree--;
+    }
+    if (degree != order || 2 * order - nerasures > NPAR)
+        return false;
+
+    // Chien search for the roots X^-1, term k is locator[k] * X^-k, the logarithm of the terms grows by k per position
+    int positions[NPAR];
+    int rootcount = 0;
+    unsigned int terms[NPAR + 1];
+    for (int k = 1; k <= degree; k++)
+    {
+        terms[k] = locator[k] == 0 ? 0xFFFF : (FEC_GF_LOG[locator[k]] + (unsigned int)k * (255 - (length - 1) % 255)) % 255;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        uint8_t sum = locator[0];
+        for (int k = 1; k <= degree; k++)
+        {
+            if (terms[k] == 0xFFFF)
+                continue;
+            sum ^= FEC_GF_EXP[terms[k]];
+            terms[k] += (unsigned int)k;
+            if (terms[k] >= 255)
+                terms[k] -= 255;
+        }
+        if (sum == 0)
+        {
+            if (rootcount == degree)
+                return false;
+            positions[rootcount++] = (int)i;
+        }
+    }
+    if (rootcount != degree)
+        return false;
+
+    // Evaluator S(x) * locator(x) mod x^NPAR
+    uint8_t *evaluator = ecc->evaluator;
+    for (int k = 0; k < NPAR; k++)
+    {
+        uint8_t sum = 0;
+        for (int i = 0; i <= k && i <= degree; i++)
+        {
+            sum ^= FEC_GF_Multiply(locator[i], ecc->syndromes[k - i]);
+        }
+        evaluator[k] = sum;
+    }
+
+    // Forney, the error value is evaluator(X^-1) / locator'(X^-1)
+    uint8_t values[NPAR];
+    for (int e = 0; e < rootcount; e++)
+    {
+        uint8_t inverse = FEC_GF_Power((unsigned int)(255 - (length - 1 - (size_t)positions[e]) % 255));
+        uint8_t derivative = 0;
+        uint8_t power = 1; // inverse^(i-1) for odd i
+        uint8_t square = FEC_GF_Multiply(inverse, inverse);
+        for (int i = 1; i <= degree; i += 2)
+        {
+            derivative ^= FEC_GF_Multiply(locator[i], power);
+            power = FEC_GF_Multiply(power, square);
+        }
+        if (derivative == 0)
+            return false;
+        values[e] = FEC_GF_Multiply(private_evaluate(evaluator, NPAR - 1, inverse), FEC_GF_Inverse(derivative));
+    }
+
+    for (int e = 0; e < rootcount; e++)
+    {
+        codeword[positions[e]] ^= values[e];
+    }
+    // A codeword with more errors than the code can correct may be moved to another valid codeword or to none at all
+    decode_data(codeword, length, ecc);
+    if (check_syndrome(ecc))
+    {
+        for (int e = 0; e < rootcount; e++)
+        {
+            codeword[positions[e]] ^= values[e];
+        }
+        return false;
+    }
+    for (int e = 0; e < rootcount; e++)
+    {
+        if (values[e] != 0)
+            ecc->corrected++;
+    }
+    return true;
+}
+
+/**
+ * @brief Calculate the parity bytes of all depth codewords of an interleaved block
+ */
+MODULE_API void FEC_InterleavedParity(const uint8_t *data, size_t length, size_t depth, uint8_t *parity, const ecc_t *ecc)
+{
+    size_t rows = (length + depth - 1) / depth;
+    size_t lane = 0;
+#ifdef FEC_VECTORLENGTH
+    uint8_t scratch[FEC_VECTORLENGTH];
+    while (depth - lane >= FEC_VECTOR_MIN_LANES)
+    {
+        size_t count = depth - lane < FEC_VECTORLENGTH ? depth - lane : FEC_VECTORLENGTH;
+        fec_vector_t registers[NPAR];
+        for (int j = 0; j < NPAR; j++)
+        {
+            registers[j] = private_zero();
+        }
+        for (size_t r = 0; r < rows; r++)
+        {
+            fec_vector_t feedback = private_xor(private_load_lanes(data, length, r * depth + lane, count, scratch), registers[0]);
+            for (int j = 0; j < NPAR - 1; j++)
+            {
+                registers[j] = private_xor(registers[j + 1], private_multiply(feedback, ecc->generatorTables[NPAR - 1 - j]));
+            }
+            registers[NPAR - 1] = private_multiply(feedback, ecc->generatorTables[0]);
+        }
+        for (int j = 0; j < NPAR; j++)
+        {
+            if (count == FEC_VECTORLENGTH)
+            {
+                private_store(parity + (size_t)j * depth + lane, registers[j]);
+            }
+            else
+            {
+                private_store(scratch, registers[j]);
+                memcpy(parity + (size_t)j * depth + lane, scratch, count);
+            }
+        }
+        lane += count;
+    }
+#endif
+    for (; lane < depth; lane++)
+    {
+        uint8_t registers[NPAR] = {0};
+        for (size_t offset = lane; offset < rows * depth; offset += depth)
+        {
+            private_parity_step(registers, offset < length ? data[offset] : 0, ecc);
+        }
+        for (int j = 0; j < NPAR; j++)
+        {
+            parity[(size_t)j * depth + lane] = registers[j];
+        }
+    }
+}
+
+/**
+ * @brief Calculate the syndromes of the codewords of an interleaved block, starting with the codeword lane.
+ *
+ * The syndromes of codeword lane + l are written to syndromes[l * NPAR] ... syndromes[l * NPAR + NPAR - 1].
+ * @return The number of codewords processed, at most FEC_SYNDROME_LANES
+ */
+MODULE_API size_t FEC_InterleavedSyndromes(const uint8_t *data, size_t length, const uint8_t *parity, size_t depth, size_t lane, uint8_t *syndromes, const ecc_t *ecc)
+{
+    size_t rows = (length + depth - 1) / depth;
+#ifdef FEC_VECTORLENGTH
+    if (depth - lane >= FEC_VECTOR_MIN_LANES)
+    {
+        size_t count = depth - lane < FEC_VECTORLENGTH ? depth - lane : FEC_VECTORLENGTH;
+        uint8_t scratch[FEC_VECTORLENGTH];
+        fec_vector_t accumulators[NPAR];
+        for (int i = 0; i < NPAR; i++)
+        {
+            accumulators[i] = private_zero();
+        }
+        for (size_t r = 0; r < rows + NPAR; r++)
+        {
+            fec_vector_t row = r < rows ? private_load_lanes(data, length, r * depth + lane, count, scratch)
+                                        : private_load_lanes(parity, (size_t)NPAR * depth, (r - rows) * depth + lane, count, scratch);
+            for (int i = 0; i < NPAR; i++)
+            {
+                accumulators[i] = private_xor(private_multiply(accumulators[i], ecc->syndromeTables[i]), row);
+            }
+        }
+        for (int i = 0; i < NPAR; i++)
+        {
+            private_store(scratch, accumulators[i]);
+            for (size_t l = 0; l < count; l++)
+            {
+                syndromes[l * NPAR + (size_t)i] = scratch[l];
+            }
+        }
+        return count;
+    }
+#else
+    (void)ecc;
+#endif
+    memset(syndromes, 0, NPAR);
+    for (size_t offset = lane; offset < rows * depth; offset += depth)
+    {
+        private_syndrome_step(syndromes, offset < length ? data[offset] : 0);
+    }
+    for (int j = 0; j < NPAR; j++)
+    {
+        private_syndrome_step(syndromes, parity[(size_t)j * depth + lane]);
+    }
+    return 1;
+}
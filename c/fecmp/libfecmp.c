@@ -0,0 +1,313 @@
+/*****************************************************************************************************
+ File: libfecmp
+ Autor: Peter Kremsner
+
+ Encoder and streaming decoder of the fec frames, see libfecmp.h for the frame layout.
+
+ ******************************************************************************************************/
+#include "libfecmp.h"
+#include <string.h>
+
+#define FEC_HEADER_CHECK 0xA5 // Xored into the check byte, so a header of zeros isn't valid
+
+enum
+{
+    FEC_SEARCH_SYNC,
+    FEC_RECEIVE_HEADER,
+    FEC_RECEIVE_BODY
+};
+
+static unsigned int private_popcount(uint32_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int)__builtin_popcount(value);
+#else
+    unsigned int count = 0;
+    while (value)
+    {
+        value &= value - 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+static size_t private_depth(size_t framelength, uint8_t depth)
+{
+    return FEC_DEPTH(framelength, (size_t)depth);
+}
+
+/**
+ * @brief Length of the data section, the smp frame padded to whole rows
+ */
+static size_t private_padded_length(size_t framelength, size_t depth)
+{
+    return (framelength + depth - 1) / depth * depth;
+}
+
+/**
+ * @brief Correct the header and read the length and depth of the frame
+ * @return true if the frame fits into the receive buffer
+ */
+static bool private_parse_header(libfecmp_t *fec)
+{
+    uint8_t *header = fec->header;
+    decode_data(header, FEC_HEADER_LENGTH, &fec->ecc);
+    if (check_syndrome(&fec->ecc) && !correct_errors_erasures(header, FEC_HEADER_LENGTH, 0, NULL, &fec->ecc))
+        return false;
+    if ((header[0] ^ header[1] ^ header[2] ^ FEC_HEADER_CHECK) != header[3])
+        return false;
+    size_t framelength = (size_t)header[0] | ((size_t)header[1] << 8);
+    uint8_t depth = header[2];
+    if (depth == 0 || framelength < 5 || framelength > FEC_MAX_FRAME_LENGTH)
+        return false;
+    if ((framelength + depth - 1) / depth > FEC_BLOCK_DATA_LENGTH)
+        return false;
+    if (!fec->settings.data || private_padded_length(framelength, depth) + (size_t)NPAR * depth > fec->settings.bufferlength)
+        return false;
+    fec->framelength = framelength;
+    fec->framedepth = depth;
+    return true;
+}
+
+/**
+ * @brief Correct one codeword of the received block
+ * @return The number of corrected bytes or -1 if the codeword has too many errors
+ */
+static int private_correct_codeword(libfecmp_t *fec, size_t lane, const uint8_t *syndromes)
+{
+    uint8_t *data = fec->settings.data;
+    size_t framelength = fec->framelength;
+    size_t depth = fec->framedepth;
+    size_t rows = (framelength + depth - 1) / depth;
+    const uint8_t *parity = data + rows * depth;
+    uint8_t codeword[FEC_BLOCKSIZE];
+    for (size_t r = 0; r < rows; r++)
+    {
+        codeword[r] = data[r * depth + lane];
+    }
+    for (size_t j = 0; j < NPAR; j++)
+    {
+        codeword[rows + j] = parity[j * depth + lane];
+    }
+    memcpy(fec->ecc.syndromes, syndromes, NPAR);
+    if (!correct_errors_erasures(codeword, rows + NPAR, 0, NULL, &fec->ecc))
+        return -1;
+    // The padding of the last row is sent as zero, any other value is a miscorrection
+    if ((rows - 1) * depth + lane >= framelength && codeword[rows - 1] != 0)
+        return -1;
+    for (size_t r = 0; r < rows; r++)
+    {
+        data[r * depth + lane] = codeword[r];
+    }
+    return (int)fec->ecc.corrected;
+}
+
+/**
+ * @brief Correct the received block and pass the smp frame to the handler
+ * @return 1 if the frame was valid
+ */
+static uint32_t private_decode_frame(libfecmp_t *fec, SMP_Frame_Handler handler, void *context)
+{
+    uint8_t *data = fec->settings.data;
+    size_t framelength = fec->framelength;
+    size_t depth = fec->framedepth;
+    size_t padded = private_padded_length(framelength, depth);
+    uint8_t syndromes[FEC_SYNDROME_LANES * NPAR];
+    size_t corrected = 0;
+    for (size_t lane = 0; lane < depth;)
+    {
+        size_t count = FEC_InterleavedSyndromes(data, padded, data + padded, depth, lane, syndromes, &fec->ecc);
+        for (size_t l = 0; l < count; l++)
+        {
+            uint8_t any = 0;
+            for (size_t i = 0; i < NPAR; i++)
+            {
+                any |= syndromes[l * NPAR + i];
+            }
+            if (any == 0)
+                continue;
+            int result = private_correct_codeword(fec, lane + l, syndromes + l * NPAR);
+            if (result < 0)
+            {
+                // The smp crc still decides, the errors may be in the parity bytes only
+                fec->stats.blocksFailed++;
+            }
+            else
+            {
+                corrected += (size_t)result;
+            }
+        }
+        lane += count;
+    }
+
+    // The payload is decoded in place, it is shorter than the stuffed frame
+    uint16_t payloadlength;
+    if (!SMP_PacketDecode(data, framelength, data, framelength, &payloadlength))
+    {
+        fec->stats.framesLost++;
+        return 0;
+    }
+    fec->stats.framesReceived++;
+    fec->stats.bytesCorrected += corrected;
+    if (corrected > 0)
+    {
+        fec->stats.framesCorrected++;
+    }
+    if (handler)
+    {
+        handler(context, data, payloadlength);
+    }
+    return 1;
+}
+
+/**
+ * @brief Initialize the encoder and decoder, the settings are copied
+ */
+MODULE_API bool fec_Init(libfecmp_t *fec, const libfecmp_settings_t *settings)
+{
+    if (!fec || !settings)
+        return false;
+    memset(fec, 0, sizeof(*fec));
+    initialize_ecc(&fec->ecc);
+    fec->settings = *settings;
+    if (fec->settings.depth == 0)
+    {
+        fec->settings.depth = 1;
+    }
+    fec_Reset(fec);
+    return true;
+}
+
+/**
+ * @brief Drop the frame that is currently received and search the next sync word, the statistics are kept
+ */
+MODULE_API void fec_Reset(libfecmp_t *fec)
+{
+    fec->state = FEC_SEARCH_SYNC;
+    fec->sync = ~(uint32_t)FEC_SYNC_WORD;
+    fec->received = 0;
+}
+
+/**
+ * @brief Exact length of the fec frame for the payload
+ * @return The length or 0 if the smp frame is longer than FEC_MAX_FRAME_LENGTH
+ */
+MODULE_API size_t fec_encodedLength(const uint8_t *payload, size_t length, const libfecmp_t *fec)
+{
+    size_t framelength = SMP_EncodedLength(payload, length);
+    if (framelength == 0 || framelength > FEC_MAX_FRAME_LENGTH)
+        return 0;
+    size_t depth = private_depth(framelength, fec->settings.depth);
+    return FEC_SYNC_LENGTH + FEC_HEADER_LENGTH + private_padded_length(framelength, depth) + (size_t)NPAR * depth;
+}
+
+/**
+ * @brief Encode the payload as smp frame and add the sync word, the header and the parity bytes.
+ * The frame starts at buffer[0], a buffer of FEC_SEND_BUFFER_LENGTH(length, depth) bytes is always large enough.
+ * @return The length of the fec frame or 0 if the buffer is too short
+ */
+MODULE_API size_t fec_encode(const uint8_t *payload, size_t length, uint8_t *buffer, size_t bufferlength, const libfecmp_t *fec)
+{
+    if (bufferlength <= FEC_SYNC_LENGTH + FEC_HEADER_LENGTH)
+        return 0;
+    uint8_t *header = buffer + FEC_SYNC_LENGTH;
+    uint8_t *frame = header + FEC_HEADER_LENGTH;
+    size_t framelength = SMP_Encode(payload, length, frame, bufferlength - FEC_SYNC_LENGTH - FEC_HEADER_LENGTH);
+    if (framelength == 0 || framelength > FEC_MAX_FRAME_LENGTH)
+        return 0;
+    size_t depth = private_depth(framelength, fec->settings.depth);
+    size_t padded = private_padded_length(framelength, depth);
+    size_t total = FEC_SYNC_LENGTH + FEC_HEADER_LENGTH + padded + (size_t)NPAR * depth;
+    if (total > bufferlength)
+        return 0;
+    memset(frame + framelength, 0, padded - framelength);
+
+    buffer[0] = (uint8_t)(FEC_SYNC_WORD >> 24);
+    buffer[1] = (uint8_t)(FEC_SYNC_WORD >> 16);
+    buffer[2] = (uint8_t)(FEC_SYNC_WORD >> 8);
+    buffer[3] = (uint8_t)FEC_SYNC_WORD;
+    header[0] = (uint8_t)framelength;
+    header[1] = (uint8_t)(framelength >> 8);
+    header[2] = (uint8_t)depth;
+    header[3] = header[0] ^ header[1] ^ header[2] ^ FEC_HEADER_CHECK;
+    encode_calcParity(header, FEC_HEADER_DATA_LENGTH, header + FEC_HEADER_DATA_LENGTH, &fec->ecc);
+    FEC_InterleavedParity(frame, padded, depth, frame + padded, &fec->ecc);
+    return total;
+}
+
+/**
+ * @brief Decode received bytes with the frame handler of the settings
+ * @return The number of valid frames
+ */
+MODULE_API uint32_t fec_processBytes(const uint8_t *data, size_t length, libfecmp_t *fec)
+{
+    return fec_receiveBuffer(fec, data, length, fec->settings.frameHandler, fec->settings.context);
+}
+
+/**
+ * @brief Decode received bytes, frames can be split across calls.
+ *
+ * handler is called with the payload of every valid frame, the payload is only valid during the call.
+ * A header that can't be corrected drops the frame, the decoder continues with the search for the next sync word.
+ * @return The number of valid frames
+ */
+MODULE_API uint32_t fec_receiveBuffer(libfecmp_t *fec, const uint8_t *data, size_t length, SMP_Frame_Handler handler, void *context)
+{
+    const uint8_t *end = data + length;
+    uint32_t frames = 0;
+    while (data < end)
+    {
+        if (fec->state == FEC_SEARCH_SYNC)
+        {
+            while (data < end)
+            {
+                fec->sync = (fec->sync << 8) | *data++;
+                if (private_popcount(fec->sync ^ (uint32_t)FEC_SYNC_WORD) <= FEC_SYNC_TOLERANCE)
+                {
+                    fec->state = FEC_RECEIVE_HEADER;
+                    fec->received = 0;
+                    break;
+                }
+            }
+        }
+        else if (fec->state == FEC_RECEIVE_HEADER)
+        {
+            size_t count = FEC_HEADER_LENGTH - fec->received;
+            if (count > (size_t)(end - data))
+                count = (size_t)(end - data);
+            memcpy(fec->header + fec->received, data, count);
+            fec->received += count;
+            data += count;
+            if (fec->received == FEC_HEADER_LENGTH)
+            {
+                if (private_parse_header(fec))
+                {
+                    fec->state = FEC_RECEIVE_BODY;
+                    fec->received = 0;
+                }
+                else
+                {
+                    fec->stats.headersFailed++;
+                    fec_Reset(fec);
+                }
+            }
+        }
+        else
+        {
+            size_t bodylength = private_padded_length(fec->framelength, fec->framedepth) + (size_t)NPAR * fec->framedepth;
+            size_t count = bodylength - fec->received;
+            if (count > (size_t)(end - data))
+                count = (size_t)(end - data);
+            memcpy(fec->settings.data + fec->received, data, count);
+            fec->received += count;
+            data += count;
+            if (fec->received == bodylength)
+            {
+                frames += private_decode_frame(fec, handler, context);
+                fec_Reset(fec);
+            }
+        }
+    }
+    return frames;
+}
@@ -0,0 +1,101 @@
+/*****************************************************************************************************
+ File: libfecmp
+ Autor: Peter Kremsner
+
+ Forward error correction for smp frames on noisy links, e.g. radio links where a retransmission costs more than the parity.
+
+ Every smp frame is sent as one fec frame:
+ | Name   | Bytes          |                                                                   |
+ |--------|----------------|-------------------------------------------------------------------|
+ | Sync   | 4              | FEC_SYNC_WORD, found with up to FEC_SYNC_TOLERANCE wrong bits      |
+ | Header | 4 + NPAR       | Frame length (2 bytes), depth, check byte and their parity bytes  |
+ | Data   | rows * depth   | The smp frame, padded with zeros to whole rows                    |
+ | Parity | NPAR * depth   | Parity of the depth interleaved codewords                         |
+
+ Byte i of the data and the parity belongs to codeword i % depth, so a burst of up to depth * NPAR / 2 wrong bytes is corrected.
+ The depth is the interleaving depth of the settings, but at least the number of codewords needed for the frame.
+ After the correction the smp frame is validated with the smp crc.
+
+ ******************************************************************************************************/
+#pragma once
+
+#include "libsmp.h"
+#include "ecc.h"
+
+#define BLOCKSIZE FEC_BLOCKSIZE
+
+#define FEC_SYNC_WORD 0x1ACFFC1DUL
+#define FEC_SYNC_LENGTH 4
+#ifndef FEC_SYNC_TOLERANCE
+#define FEC_SYNC_TOLERANCE 3
+#endif
+#define FEC_HEADER_DATA_LENGTH 4
+#define FEC_HEADER_LENGTH (FEC_HEADER_DATA_LENGTH + NPAR)
+#define FEC_MAX_DEPTH 255
+#define FEC_MAX_FRAME_LENGTH (FEC_MAX_DEPTH * FEC_BLOCK_DATA_LENGTH) // Longest smp frame, including the bytestuffing
+
+/**
+ * Number of codewords of a smp frame with the length framelength and the minimum interleaving depth depth
+ */
+#define FEC_DEPTH(framelength, depth) ((((framelength) + FEC_BLOCK_DATA_LENGTH - 1) / FEC_BLOCK_DATA_LENGTH) > (depth) ? (((framelength) + FEC_BLOCK_DATA_LENGTH - 1) / FEC_BLOCK_DATA_LENGTH) : (depth))
+
+/**
+ * Length of the receive buffer for payloads of up to messageLength bytes, the data and parity section of a fec frame
+ */
+#define FEC_RECEIVE_BUFFER_LENGTH(messageLength, depth) (SMP_SEND_BUFFER_LENGTH(messageLength) + (NPAR + 1) * FEC_DEPTH(SMP_SEND_BUFFER_LENGTH(messageLength), depth) - 1)
+
+/**
+ * Worst case length of the fec frame for a payload of messageLength bytes
+ */
+#define FEC_SEND_BUFFER_LENGTH(messageLength, depth) (FEC_SYNC_LENGTH + FEC_HEADER_LENGTH + FEC_RECEIVE_BUFFER_LENGTH(messageLength, depth))
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        uint64_t framesReceived;   // Valid smp frames
+        uint64_t framesCorrected;  // Valid smp frames that needed a correction
+        uint64_t bytesCorrected;
+        uint64_t blocksFailed;     // Codewords with more errors than the code can correct
+        uint64_t framesLost;       // Frames that failed the smp crc check after the correction
+        uint64_t headersFailed;    // Sync words followed by a header that can't be corrected or doesn't fit into the buffer
+    } libfecmp_stats_t;
+
+    typedef struct
+    {
+        uint8_t *data;                   // Receive buffer, see FEC_RECEIVE_BUFFER_LENGTH
+        size_t bufferlength;
+        SMP_Frame_Handler frameHandler;  // Called by fec_processBytes for every valid frame
+        void *context;
+        uint8_t depth;                   // Minimum interleaving depth of the sent frames, 0 is treated as 1
+    } libfecmp_settings_t;
+
+    /**
+     * Decoder state of one stream and the encoder settings
+     * */
+    typedef struct
+    {
+        ecc_t ecc;
+        libfecmp_settings_t settings;
+        uint32_t sync;        // The last four received bytes while searching the sync word
+        uint8_t state;
+        uint8_t framedepth;
+        size_t framelength;
+        size_t received;      // Bytes of the current header or body
+        uint8_t header[FEC_HEADER_LENGTH];
+        libfecmp_stats_t stats;
+    } libfecmp_t;
+
+    MODULE_API bool fec_Init(libfecmp_t *fec, const libfecmp_settings_t *settings);
+    MODULE_API void fec_Reset(libfecmp_t *fec);
+    MODULE_API size_t fec_encodedLength(const uint8_t *payload, size_t length, const libfecmp_t *fec);
+    MODULE_API size_t fec_encode(const uint8_t *payload, size_t length, uint8_t *buffer, size_t bufferlength, const libfecmp_t *fec);
+    MODULE_API uint32_t fec_processBytes(const uint8_t *data, size_t length, libfecmp_t *fec);
+    MODULE_API uint32_t fec_receiveBuffer(libfecmp_t *fec, const uint8_t *data, size_t length, SMP_Frame_Handler handler, void *context);
+
+#ifdef __cplusplus
+}
+#endif
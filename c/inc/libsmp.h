@@ -9,8 +9,69 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "sharedlib.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#define SMP_HAS_IOVEC 1
+#endif
+
+/**
+ * The indices of the receive ring use C11 atomics if the compiler supports them.
+ * C++ code only passes the ring to the library functions, there the indices are plain words of the same size.
+ */
+#if !defined(__cplusplus) && defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define SMP_RING_C11_ATOMICS 1
+typedef atomic_size_t smp_ring_index_t;
+typedef atomic_size_t smp_stats_counter_t;
+#else
+typedef volatile size_t smp_ring_index_t;
+typedef volatile size_t smp_stats_counter_t;
+#endif
+
+/**
+ * The producer and consumer index of the receive ring are placed on separate cache lines on hosts with caches.
+ * Define SMP_RING_CACHELINE to 0 to pack them.
+ */
+#ifndef SMP_RING_CACHELINE
+#if defined(__x86_64__) || defined(__aarch64__) || defined(_M_X64) || defined(_M_ARM64)
+#define SMP_RING_CACHELINE 64
+#else
+#define SMP_RING_CACHELINE 0
+#endif
+#endif
+
+/**
+ * Decoder statistics, disabled by default. Define SMP_ENABLE_STATS to count the frames and errors of every decoder and
+ * SMP_ENABLE_LATENCY_HISTOGRAM to additionally record the time from the framestart to the validated frame.
+ * The definitions change the layout of smp_struct_t, the library and the application must be compiled with the same definitions.
+ * The counters are machine words, they wrap on 32 bit targets.
+ */
+#if defined(SMP_ENABLE_LATENCY_HISTOGRAM) && !defined(SMP_ENABLE_STATS)
+#define SMP_ENABLE_STATS 1
+#endif
+
+/**
+ * Number of buckets of the latency histogram. Bucket i counts the frames with a decode time of [2^(i-1), 2^i) clock ticks,
+ * bucket 0 the frames without a measurable time and the last bucket all longer times.
+ */
+#define SMP_STATS_HISTOGRAM_BUCKETS 32
+
+/**
+ * The statistics are placed on their own cache lines, so reading a snapshot from another thread doesn't slow down the decoder
+ */
+#if SMP_RING_CACHELINE > 0 && defined(__cplusplus)
+#define SMP_STATS_ALIGN alignas(SMP_RING_CACHELINE)
+#elif SMP_RING_CACHELINE > 0 && defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define SMP_STATS_ALIGN _Alignas(SMP_RING_CACHELINE)
+#elif SMP_RING_CACHELINE > 0 && defined(__GNUC__)
+#define SMP_STATS_ALIGN __attribute__((aligned(SMP_RING_CACHELINE)))
+#else
+#define SMP_STATS_ALIGN
+#endif
+
 /**
  * @brief Calculate the required size of the smp buffer (worst case) for the supplied maximum message length
  *
@@ -25,6 +86,21 @@ extern "C"
 #define FRAMESTART 0xFF    // The framestartdelimeter
 #define CRC_POLYNOM 0xA001 // CRC Generatorpolynom
 
+/**
+ * Selectable implementations of the crc calculation.
+ * Define SMP_CRC_BACKEND to one of these values when compiling the library.
+ * SMP_CRC_BITWISE needs no lookup table and should be used on flash constrained microcontrollers,
+ * the slice variants need 2 KiB (SLICE4) or 4 KiB (SLICE8) of tables and are intended for host builds.
+ */
+#define SMP_CRC_BITWISE 0
+#define SMP_CRC_TABLE 1
+#define SMP_CRC_SLICE4 2
+#define SMP_CRC_SLICE8 3
+
+#ifndef SMP_CRC_BACKEND
+#define SMP_CRC_BACKEND SMP_CRC_TABLE
+#endif
+
 typedef enum
 {
     NO_PACKET_START,
@@ -40,10 +116,38 @@ typedef enum
 
 #define SMP_SEND_BUFFER_LENGTH(messageLength) (2 * (messageLength + 2) + 5)
 
+/**
+ * The longest payload of a frame, the 16 bit length field holds the payload length + 2
+ */
+#define SMP_MAX_PAYLOAD 65533
+
+/**
+ * Payload runs shorter than this are copied by SMP_SendIovec instead of being referenced.
+ * An additional iovec entry costs more than copying a few bytes.
+ */
+#ifndef SMP_IOVEC_MIN_REFERENCE
+#define SMP_IOVEC_MIN_REFERENCE 64
+#endif
+
     // Callbacks
     // When the callbackfunction returns a negative Integer, its treated as error code.
     // When the length and the bufferpointer is both zero, then this function should return the error Code
     typedef signed char (*SMP_Frame_Ready)(uint8_t *data, uint32_t length); // FrameReadyCallback: Length is the ammount of bytes in the recieveBuffer
+    typedef size_t (*SMP_Write)(void *context, const uint8_t *data, size_t length); // Output callback of SMP_SendMany, returns the number of bytes written
+    typedef void (*SMP_Frame_Handler)(void *context, const uint8_t *data, uint32_t length); // Called by SMP_ReceiveBuffer for every valid frame, context is passed through unchanged
+    /**
+     * Position of one payload in the batch buffer of a decoder object
+     * */
+    typedef struct
+    {
+        uint32_t offset;
+        uint32_t length;
+    } smp_frame_info_t;
+
+    typedef void (*SMP_Batch_Handler)(void *context, const uint8_t *buffer, const smp_frame_info_t *frames, uint32_t count); // Called by SMP_ReceiveBytes with the frames of a batch, the payloads are at buffer + offset
+    typedef struct smp_object smp_object_t; // Heap allocated decoder for language bindings, created with SMP_BuildObject
+
+    typedef uint8_t *(*SMP_Frame_Buffer_Handler)(void *context, uint8_t *data, uint32_t length); // Called by SMP_ReceiveBufferSwap for every valid frame, takes over the framebuffer and returns the framebuffer for the next frame
 
     /**
      * stuct to hold the status flags of the decoder
@@ -58,6 +162,52 @@ typedef enum
         unsigned int padding : 2;
     } smp_flags_t;
 
+    /**
+     * One part of the payload for the scatter/gather send functions
+     * */
+    typedef struct
+    {
+        const void *data;
+        size_t length;
+    } smp_segment_t;
+
+#ifdef SMP_ENABLE_STATS
+    /**
+     * Counters of one decoder, only written by the thread that decodes. Read them with SMP_StatsSnapshot.
+     * */
+    typedef struct
+    {
+        smp_stats_counter_t framesReceived; // Valid frames
+        smp_stats_counter_t crcErrors;
+        smp_stats_counter_t resyncs;        // Frames interrupted by a new framestart
+        smp_stats_counter_t framesDropped;  // Frames with a payload longer than the framebuffer
+        smp_stats_counter_t bytesDiscarded; // Bytes outside of frames
+        smp_stats_counter_t framesSent;
+        smp_stats_counter_t bytesSent;
+        smp_stats_counter_t stuffingBytes; // Bytes added by the bytestuffing of the sent frames
+#ifdef SMP_ENABLE_LATENCY_HISTOGRAM
+        uint64_t framestartTime;
+        smp_stats_counter_t decodeTime[SMP_STATS_HISTOGRAM_BUCKETS];
+#endif
+    } smp_stats_t;
+#endif
+
+    /**
+     * Copy of the statistics returned by SMP_StatsSnapshot, independent of the compile time options
+     * */
+    typedef struct
+    {
+        uint64_t framesReceived;
+        uint64_t crcErrors;
+        uint64_t resyncs;
+        uint64_t framesDropped;
+        uint64_t bytesDiscarded;
+        uint64_t framesSent;
+        uint64_t bytesSent;
+        uint64_t stuffingBytes;
+        uint64_t decodeTime[SMP_STATS_HISTOGRAM_BUCKETS];
+    } smp_stats_snapshot_t;
+
     /**
      * struct to store the current smpobject
      * */
@@ -66,23 +216,93 @@ typedef enum
         unsigned short bytesToRecieve;
         unsigned char crcHighByte;
         unsigned short crc;
+        unsigned short bytesRecieved; // Payload bytes of the current frame written to the framebuffer by SMP_ReceiveBuffer
         smp_flags_t flags;
+        signed char lastError; // Last receiver error of this decoder, see SMP_GetLastError
+#ifdef SMP_ENABLE_STATS
+        SMP_STATS_ALIGN smp_stats_t stats;
+#endif
     } smp_struct_t;
 
+    /**
+     * Lock free single producer single consumer byte ring between the receive interrupt or dma callback and the decoder.
+     * The producer calls SMP_RingPut or SMP_RingWrite, the consumer decodes the received bytes with SMP_Poll.
+     * The indices are free running, the buffer size must be a power of two.
+     * */
+    typedef struct
+    {
+        uint8_t *buffer;
+        size_t size;
+        smp_ring_index_t head; // Written by the producer
+#if SMP_RING_CACHELINE > 0
+        uint8_t padding[SMP_RING_CACHELINE];
+#endif
+        smp_ring_index_t tail; // Written by the consumer
+    } smp_ring_t;
+
+    /**
+     * Resumable encoder for transports that accept only a part of a frame per call.
+     * SMP_EncoderRead produces the next stuffed bytes of the frame into the space the transport offers,
+     * the crc and the bytestuffing state are kept between the calls. The payload isn't copied, it must stay valid until the frame is complete.
+     * */
+    typedef struct
+    {
+        const uint8_t *payload;
+        size_t length;
+        size_t position;     // Next payload byte
+        uint16_t crc;        // Crc over the whole payload
+        uint8_t pending[5];  // Stuffed header or crc bytes that are not written yet
+        uint8_t pendingstart;
+        uint8_t pendinglength;
+        uint8_t phase;
+    } smp_encoder_t;
+
     MODULE_API uint16_t SMP_crc16(uint16_t crc, uint16_t c, uint16_t mask);
+    MODULE_API uint16_t SMP_crc16_block(uint16_t crc, const uint8_t *ptr, size_t len);
 
     // Application functions
     signed char SMP_Init(smp_struct_t *st);
     MODULE_API uint32_t SMP_estimatePacketLength(const uint8_t *buffer, unsigned short length);
     MODULE_API uint32_t SMP_CalculateMinimumSendBufferSize(unsigned short length);
     MODULE_API unsigned int SMP_SendRetIndex(const uint8_t *buffer, unsigned short length, uint8_t *messageBuffer, unsigned short bufferLength, unsigned short *messageStartIndex);
+    MODULE_API size_t SMP_CountFramestarts(const uint8_t *data, size_t length);
+    MODULE_API size_t SMP_EncodedLength(const uint8_t *buffer, size_t length);
+    MODULE_API size_t SMP_Encode(const uint8_t *buffer, size_t length, uint8_t *messageBuffer, size_t bufferLength);
+    MODULE_API size_t SMP_StuffBytes(uint8_t *dest, const uint8_t *src, size_t length);
     MODULE_API unsigned int SMP_Send(const uint8_t *buffer, unsigned short length, uint8_t *messageBuffer, unsigned short bufferLength, uint8_t **messageStartPtr);
+    MODULE_API size_t SMP_SendMany(const smp_segment_t *messages, size_t messagecount, uint8_t *buffer, size_t bufferLength, size_t flushThreshold, SMP_Write write, void *context);
+    MODULE_API size_t SMP_SendV(const smp_segment_t *segments, size_t segmentcount, uint8_t *messageBuffer, size_t bufferLength);
+#ifdef SMP_HAS_IOVEC
+    MODULE_API size_t SMP_SendIovec(const smp_segment_t *segments, size_t segmentcount, uint8_t *scratch, size_t scratchlength, struct iovec *iov, size_t iovlength, size_t *framelength);
+#endif
     MODULE_API uint16_t SMP_PacketGetLength(const uint8_t *data, uint16_t *headerlength);
+    MODULE_API size_t SMP_UnstuffBytes(uint8_t *dest, const uint8_t *src, size_t srclength, size_t count);
+    MODULE_API bool SMP_PacketDecode(const uint8_t *data, size_t datalength, uint8_t *payload, size_t payloadbufferlength, uint16_t *payloadlength);
     MODULE_API bool SMP_PacketValid(const uint8_t *data, uint16_t packetlength, uint16_t headerlength, uint16_t *crclength);
     MODULE_API smp_decoder_stat SMP_RecieveInByte(uint8_t data, uint8_t* decoded, smp_struct_t *st);
+    MODULE_API uint32_t SMP_ReceiveBuffer(smp_struct_t *st, const uint8_t *data, size_t length, uint8_t *framebuffer, size_t framebufferlength, SMP_Frame_Handler handler, void *context);
+    MODULE_API uint32_t SMP_ReceiveBufferSwap(smp_struct_t *st, const uint8_t *data, size_t length, uint8_t **framebuffer, size_t framebufferlength, SMP_Frame_Buffer_Handler handler, void *context);
+    MODULE_API bool SMP_RingInit(smp_ring_t *ring, uint8_t *buffer, size_t size);
+    MODULE_API bool SMP_RingPut(smp_ring_t *ring, uint8_t data);
+    MODULE_API size_t SMP_RingWrite(smp_ring_t *ring, const uint8_t *data, size_t length);
+    MODULE_API size_t SMP_RingAvailable(smp_ring_t *ring);
+    MODULE_API uint32_t SMP_Poll(smp_struct_t *st, smp_ring_t *ring, uint8_t *framebuffer, size_t framebufferlength, SMP_Frame_Handler handler, void *context);
+    MODULE_API smp_object_t *SMP_BuildObject(uint32_t bufferlength, SMP_Frame_Ready frameReadyCallback, SMP_Frame_Ready rogueFrameCallback);
+    MODULE_API void SMP_DestroyObject(smp_object_t *object);
+    MODULE_API bool SMP_SetBatchBuffer(smp_object_t *object, uint8_t *buffer, size_t bufferlength, smp_frame_info_t *frames, uint32_t maxframes, SMP_Batch_Handler handler, void *context);
+    MODULE_API uint32_t SMP_ReceiveBytes(smp_object_t *object, const uint8_t *data, size_t length);
+    MODULE_API void SMP_ResetObject(smp_object_t *object);
+    MODULE_API bool SMP_ObjectStatsSnapshot(const smp_object_t *object, smp_stats_snapshot_t *snapshot);
+    MODULE_API bool SMP_EncoderStart(smp_encoder_t *encoder, const uint8_t *payload, size_t length);
+    MODULE_API size_t SMP_EncoderRead(smp_encoder_t *encoder, uint8_t *dest, size_t space);
+    MODULE_API bool SMP_EncoderBusy(const smp_encoder_t *encoder);
     MODULE_API uint32_t SMP_GetBytesToRecieve(smp_struct_t *st);
     MODULE_API bool SMP_IsRecieving(smp_struct_t *st);
-    MODULE_API signed char SMP_getRecieverError(void);
+    MODULE_API signed char SMP_GetLastError(smp_struct_t *st);
+    MODULE_API signed char SMP_getRecieverError(void); // Deprecated, use SMP_GetLastError
+    MODULE_API bool SMP_StatsSnapshot(const smp_struct_t *st, smp_stats_snapshot_t *snapshot);
+    MODULE_API void SMP_StatsReset(smp_struct_t *st);
+    MODULE_API void SMP_StatsAddSent(smp_struct_t *st, size_t frames, size_t payloadbytes, size_t framebytes);
 
     /**
      * This functions are for internal use only
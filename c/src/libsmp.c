@@ -9,29 +9,74 @@
 #include "libsmp.h"
 #include <string.h>
 
-#define MAX_PAYLOAD 65534
-
 // Helper macro to get the size of a nested struct
 #define sizeof_field(s, m) (sizeof((((s *)0)->m)))
 
-/***********************************************************************
- * @brief Private function definiton to calculate the crc checksum
- ***********************************************************************/
-MODULE_API uint16_t SMP_crc16(uint16_t crc, uint16_t c, uint16_t mask)
+/**
+ * The statistics are only written by the decoding thread, so the counters are incremented with a relaxed load and store
+ * instead of an atomic read-modify-write. Snapshots from other threads read them with relaxed loads.
+ */
+#if defined(SMP_ENABLE_STATS) && defined(SMP_RING_C11_ATOMICS)
+#define STATS_LOAD(counter) atomic_load_explicit(&(counter), memory_order_relaxed)
+#define STATS_STORE(counter, value) atomic_store_explicit(&(counter), (value), memory_order_relaxed)
+#elif defined(SMP_ENABLE_STATS) && defined(__GNUC__)
+#define STATS_LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define STATS_STORE(counter, value) __atomic_store_n(&(counter), (value), __ATOMIC_RELAXED)
+#elif defined(SMP_ENABLE_STATS)
+#define STATS_LOAD(counter) (counter)
+#define STATS_STORE(counter, value) ((counter) = (value))
+#endif
+
+#ifdef SMP_ENABLE_STATS
+#define STATS_ADD(st, counter, n) STATS_STORE((st)->stats.counter, STATS_LOAD((st)->stats.counter) + (size_t)(n))
+#else
+#define STATS_ADD(st, counter, n) ((void)(st))
+#endif
+
+#ifdef SMP_ENABLE_LATENCY_HISTOGRAM
+/**
+ * Define SMP_STATS_CLOCK() to a monotonic timestamp of the target (e.g. a cycle counter) for the latency histogram,
+ * the default is the monotonic clock in nanoseconds.
+ */
+#ifndef SMP_STATS_CLOCK
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+static inline uint64_t private_SMP_Clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#define SMP_STATS_CLOCK() private_SMP_Clock()
+#else
+#error "Define SMP_STATS_CLOCK() to a monotonic timestamp for the latency histogram"
+#endif
+#endif
+
+static inline void private_SMP_RecordDecodeTime(smp_struct_t *st)
 {
-    uint8_t i;
-    uint16_t _crc = crc;
-    for (i = 0; i < 8; i++)
+    uint64_t time = (uint64_t)SMP_STATS_CLOCK() - st->stats.framestartTime;
+    unsigned int bucket = 0;
+    while (time > 0 && bucket < SMP_STATS_HISTOGRAM_BUCKETS - 1)
     {
-        if ((_crc ^ c) & 1)
-        {
-            _crc = (_crc >> 1) ^ mask;
-        }
-        else
-            _crc >>= 1;
-        c >>= 1;
+        time >>= 1;
+        bucket++;
     }
-    return (_crc);
+    STATS_ADD(st, decodeTime[bucket], 1);
+}
+#endif
+
+// Last error of any decoder, only for the deprecated SMP_getRecieverError
+#if defined(SMP_RING_C11_ATOMICS)
+static atomic_schar lastReceiverError;
+#else
+static volatile signed char lastReceiverError;
+#endif
+
+static inline void private_SMP_SetError(smp_struct_t *st, signed char error)
+{
+    st->lastError = error;
+    lastReceiverError = error;
 }
 
 void SMP_ResetDecoderState(smp_struct_t *smp, bool preserveReceivedDelimeter)
@@ -41,6 +86,10 @@ void SMP_ResetDecoderState(smp_struct_t *smp, bool preserveReceivedDelimeter)
     {
         receivedDelimeter = smp->flags.recievedDelimeter;
     }
+    smp->bytesToRecieve = 0;
+    smp->crcHighByte = 0;
+    smp->crc = 0;
+    memset(&smp->flags, 0, sizeof(smp->flags));
     if (preserveReceivedDelimeter)
     {
         smp->flags.recievedDelimeter = receivedDelimeter;
@@ -53,6 +102,9 @@ void SMP_ResetDecoderState(smp_struct_t *smp, bool preserveReceivedDelimeter)
 signed char SMP_Init(smp_struct_t *st)
 {
     SMP_ResetDecoderState(st, false);
+    st->bytesRecieved = 0;
+    st->lastError = 0;
+    SMP_StatsReset(st);
     return 0;
 }
 
@@ -68,16 +120,7 @@ signed char SMP_Init(smp_struct_t *st)
 
 MODULE_API uint32_t SMP_estimatePacketLength(const uint8_t *buffer, unsigned short length)
 {
-    unsigned short overheadCounter = 0;
-    unsigned int ret = 0;
-    unsigned short i;
-    for (i = 0; i < length; i++)
-    {
-        if (buffer[i] == FRAMESTART)
-            overheadCounter++;
-    }
-    ret = length + overheadCounter + 10;
-    return ret;
+    return (uint32_t)(length + SMP_CountFramestarts(buffer, length) + 10);
 }
 
 /**
@@ -113,11 +156,11 @@ MODULE_API unsigned int SMP_SendRetIndex(const uint8_t *buffer, unsigned short l
  ************************************************************************/
 MODULE_API unsigned int SMP_Send(const uint8_t *buffer, unsigned short length, uint8_t *messageBuffer, unsigned short bufferLength, uint8_t **messageStartPtr)
 {
-    unsigned int i = 2;
+    unsigned int i;
     unsigned int offset = 0;
     unsigned short crc = 0;
 
-    if (length > MAX_PAYLOAD)
+    if (length > SMP_MAX_PAYLOAD)
         return 0;
     unsigned char *message = messageBuffer;
     unsigned char *messagePtr = &message[5];
@@ -125,19 +168,9 @@ MODULE_API unsigned int SMP_Send(const uint8_t *buffer, unsigned short length, u
     if (bufferLength < (2 * (length + 2) + 5))
         return 0;
 
-    for (i = 0; i < length; i++)
-    {
-        if (bufferLength <= i + offset + 5)
-            return 0;
-        if (buffer[i] == FRAMESTART)
-        {
-            messagePtr[i + offset] = FRAMESTART;
-            offset++;
-        }
-
-        messagePtr[i + offset] = buffer[i];
-        crc = SMP_crc16(crc, buffer[i], CRC_POLYNOM);
-    }
+    crc = SMP_crc16_block(crc, buffer, length);
+    offset = SMP_StuffBytes(messagePtr, buffer, length) - length;
+    i = length;
 
     messagePtr[i + offset] = crc >> 8; // CRC high byte
     if (messagePtr[i + offset] == FRAMESTART)
@@ -182,6 +215,270 @@ MODULE_API unsigned int SMP_Send(const uint8_t *buffer, unsigned short length, u
     return messageSize;
 }
 
+/**
+ * @brief Write a byte with bytestuffing, returns the number of bytes written
+ */
+static inline size_t private_SMP_PutStuffed(uint8_t *dest, uint8_t data)
+{
+    dest[0] = data;
+    if (data == FRAMESTART)
+    {
+        dest[1] = FRAMESTART;
+        return 2;
+    }
+    return 1;
+}
+
+/**
+ * @brief Write the framestart and the length field (low byte first), returns the number of bytes written
+ */
+static size_t private_SMP_WriteHeader(uint8_t *dest, uint16_t lengthfield)
+{
+    size_t offset = 0;
+    dest[offset++] = FRAMESTART;
+    offset += private_SMP_PutStuffed(dest + offset, lengthfield & 0xFF);
+    offset += private_SMP_PutStuffed(dest + offset, lengthfield >> 8);
+    return offset;
+}
+
+/**
+ * @brief Write the crc (high byte first), returns the number of bytes written
+ */
+static size_t private_SMP_WriteCRC(uint8_t *dest, uint16_t crc)
+{
+    size_t offset = private_SMP_PutStuffed(dest, crc >> 8);
+    offset += private_SMP_PutStuffed(dest + offset, crc & 0xFF);
+    return offset;
+}
+
+/**
+ * @brief Length of the header and the crc including the bytestuffing
+ */
+static size_t private_SMP_ProtocolLength(uint16_t lengthfield, uint16_t crc)
+{
+    return 5 + ((lengthfield & 0xFF) == FRAMESTART) + ((lengthfield >> 8) == FRAMESTART) +
+           ((crc & 0xFF) == FRAMESTART) + ((crc >> 8) == FRAMESTART);
+}
+
+/************************************************************************
+ * @brief Calculate the exact length of the smp packet for the payload in buffer
+ * This is the number of bytes SMP_Encode writes for this payload.
+ * @return The packet length or zero if the payload is too long
+ ************************************************************************/
+MODULE_API size_t SMP_EncodedLength(const uint8_t *buffer, size_t length)
+{
+    if (length > SMP_MAX_PAYLOAD)
+        return 0;
+    uint16_t crc = SMP_crc16_block(0, buffer, length);
+    return length + SMP_CountFramestarts(buffer, length) + private_SMP_ProtocolLength((uint16_t)(length + 2), crc);
+}
+
+/************************************************************************
+ * @brief Create a smp packet that starts at messageBuffer[0]
+ * Unlike SMP_Send the buffer doesn't need to hold the worst case length, SMP_EncodedLength bytes are
+ * sufficient. This allows to write many packets directly behind each other into one buffer.
+ * @return The length of the whole smp packet. Zero if the packet doesn't fit into the buffer.
+ ************************************************************************/
+MODULE_API size_t SMP_Encode(const uint8_t *buffer, size_t length, uint8_t *messageBuffer, size_t bufferLength)
+{
+    if (length > SMP_MAX_PAYLOAD)
+        return 0;
+    uint16_t lengthfield = (uint16_t)(length + 2);
+    uint16_t crc = SMP_crc16_block(0, buffer, length);
+    // Only count the framestarts if the worst case doesn't fit
+    if (bufferLength < SMP_SEND_BUFFER_LENGTH(length) &&
+        bufferLength < length + SMP_CountFramestarts(buffer, length) + private_SMP_ProtocolLength(lengthfield, crc))
+        return 0;
+    uint8_t *out = messageBuffer;
+    out += private_SMP_WriteHeader(out, lengthfield);
+    out += SMP_StuffBytes(out, buffer, length);
+    out += private_SMP_WriteCRC(out, crc);
+    return (size_t)(out - messageBuffer);
+}
+
+/************************************************************************
+ * @brief Encode many messages back to back into one buffer and pass it to the write callback in batches
+ * The buffer is flushed when the next packet doesn't fit anymore, when at least flushThreshold bytes
+ * are buffered and after the last message. A flushThreshold of 0 only flushes full buffers and the rest at the end.
+ * @param messages Payload of every message
+ * @param write Called with the encoded packets, must return the number of bytes written
+ * @return The number of messages that were completely written. Less than messagecount if a message
+ *          doesn't fit into the empty buffer or the write callback didn't write all bytes.
+ ************************************************************************/
+MODULE_API size_t SMP_SendMany(const smp_segment_t *messages, size_t messagecount, uint8_t *buffer, size_t bufferLength, size_t flushThreshold, SMP_Write write, void *context)
+{
+    size_t written = 0;
+    size_t pending = 0;
+    size_t offset = 0;
+    for (size_t i = 0; i < messagecount; i++)
+    {
+        size_t framelength = SMP_Encode((const uint8_t *)messages[i].data, messages[i].length, buffer + offset, bufferLength - offset);
+        if (framelength == 0 && offset > 0)
+        {
+            // Buffer is full, flush and try again at the start of the buffer
+            if (write(context, buffer, offset) != offset)
+                return written;
+            written += pending;
+            pending = 0;
+            offset = 0;
+            framelength = SMP_Encode((const uint8_t *)messages[i].data, messages[i].length, buffer, bufferLength);
+        }
+        if (framelength == 0)
+            break;
+        offset += framelength;
+        pending++;
+        if (flushThreshold > 0 && offset >= flushThreshold)
+        {
+            if (write(context, buffer, offset) != offset)
+                return written;
+            written += pending;
+            pending = 0;
+            offset = 0;
+        }
+    }
+    if (offset > 0 && write(context, buffer, offset) == offset)
+    {
+        written += pending;
+    }
+    return written;
+}
+
+static size_t private_SMP_SegmentLength(const smp_segment_t *segments, size_t segmentcount)
+{
+    size_t length = 0;
+    for (size_t i = 0; i < segmentcount; i++)
+    {
+        length += segments[i].length;
+    }
+    return length;
+}
+
+/************************************************************************
+ * @brief Create one smp packet from the concatenation of several buffers
+ * The crc and the bytestuffing continue across the segment boundaries, so the result is the same
+ * as calling SMP_Send with the segments copied into one buffer.
+ * Unlike SMP_Send the packet starts at messageBuffer[0].
+ * @param bufferLength Must be at least SMP_SEND_BUFFER_LENGTH(sum of the segment lengths)
+ * @return The length of the whole smp packet or zero on error
+ ************************************************************************/
+MODULE_API size_t SMP_SendV(const smp_segment_t *segments, size_t segmentcount, uint8_t *messageBuffer, size_t bufferLength)
+{
+    size_t length = private_SMP_SegmentLength(segments, segmentcount);
+    uint16_t crc = 0;
+    if (length > SMP_MAX_PAYLOAD || bufferLength < SMP_SEND_BUFFER_LENGTH(length))
+        return 0;
+    uint8_t *out = messageBuffer;
+    out += private_SMP_WriteHeader(out, (uint16_t)(length + 2));
+    for (size_t i = 0; i < segmentcount; i++)
+    {
+        const uint8_t *data = (const uint8_t *)segments[i].data;
+        crc = SMP_crc16_block(crc, data, segments[i].length);
+        out += SMP_StuffBytes(out, data, segments[i].length);
+    }
+    out += private_SMP_WriteCRC(out, crc);
+    return (size_t)(out - messageBuffer);
+}
+
+#ifdef SMP_HAS_IOVEC
+/**
+ * Helper to build the iovec list for SMP_SendIovec
+ */
+typedef struct
+{
+    struct iovec *iov;
+    size_t iovlength;
+    size_t used;
+    uint8_t *scratch;
+    uint8_t *scratchend;
+} private_iov_writer_t;
+
+static bool private_iov_reference(private_iov_writer_t *w, const uint8_t *data, size_t length)
+{
+    if (w->used >= w->iovlength)
+        return false;
+    w->iov[w->used].iov_base = (void *)data;
+    w->iov[w->used].iov_len = length;
+    w->used++;
+    return true;
+}
+
+static bool private_iov_copy(private_iov_writer_t *w, const uint8_t *data, size_t length)
+{
+    if ((size_t)(w->scratchend - w->scratch) < length)
+        return false;
+    memcpy(w->scratch, data, length);
+    struct iovec *last = w->used > 0 ? &w->iov[w->used - 1] : NULL;
+    if (last && (uint8_t *)last->iov_base + last->iov_len == w->scratch)
+    {
+        last->iov_len += length; // Extend the previous entry if it ends where the scratch data starts
+    }
+    else if (!private_iov_reference(w, w->scratch, length))
+    {
+        return false;
+    }
+    w->scratch += length;
+    return true;
+}
+
+/************************************************************************
+ * @brief Create one smp packet from several buffers as an iovec list that can be passed to writev
+ * Runs of at least SMP_IOVEC_MIN_REFERENCE payload bytes without a framestart are referenced
+ * from the segments without copying them. The header, the crc, the stuffing bytes and shorter
+ * runs are copied into scratch. The segments and scratch must stay valid until the iovec list is written.
+ * @param scratch Buffer for the copied bytes, SMP_SEND_BUFFER_LENGTH(sum of the segment lengths) bytes are always sufficient
+ * @param framelength Receives the length of the whole smp packet, can be NULL
+ * @return The number of used iovec entries or zero if the packet didn't fit into iov or scratch
+ ************************************************************************/
+MODULE_API size_t SMP_SendIovec(const smp_segment_t *segments, size_t segmentcount, uint8_t *scratch, size_t scratchlength, struct iovec *iov, size_t iovlength, size_t *framelength)
+{
+    static const uint8_t framestart = FRAMESTART;
+    uint8_t protocolbytes[5];
+    uint16_t crc = 0;
+    size_t length = private_SMP_SegmentLength(segments, segmentcount);
+    private_iov_writer_t writer = {iov, iovlength, 0, scratch, scratch + scratchlength};
+    if (length > SMP_MAX_PAYLOAD)
+        return 0;
+
+    if (!private_iov_copy(&writer, protocolbytes, private_SMP_WriteHeader(protocolbytes, (uint16_t)(length + 2))))
+        return 0;
+    for (size_t i = 0; i < segmentcount; i++)
+    {
+        const uint8_t *data = (const uint8_t *)segments[i].data;
+        size_t remaining = segments[i].length;
+        crc = SMP_crc16_block(crc, data, remaining);
+        while (remaining > 0)
+        {
+            const uint8_t *stuffed = (const uint8_t *)memchr(data, FRAMESTART, remaining);
+            size_t run = stuffed ? (size_t)(stuffed - data) + 1 : remaining;
+            bool ok;
+            if (run >= SMP_IOVEC_MIN_REFERENCE)
+                ok = private_iov_reference(&writer, data, run);
+            else
+                ok = private_iov_copy(&writer, data, run);
+            if (ok && stuffed)
+                ok = private_iov_copy(&writer, &framestart, 1);
+            if (!ok)
+                return 0;
+            data += run;
+            remaining -= run;
+        }
+    }
+    if (!private_iov_copy(&writer, protocolbytes, private_SMP_WriteCRC(protocolbytes, crc)))
+        return 0;
+
+    if (framelength)
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < writer.used; i++)
+        {
+            total += iov[i].iov_len;
+        }
+        *framelength = total;
+    }
+    return writer.used;
+}
+#endif
+
 MODULE_API uint16_t SMP_PacketGetLength(const uint8_t *data, uint16_t *headerlength)
 {
     uint16_t protocolbytecounter = 1;    // Initialize with 1 we count the framestart here
@@ -191,9 +488,9 @@ MODULE_API uint16_t SMP_PacketGetLength(const uint8_t *data, uint16_t *headerlen
     if (*lengthptr == FRAMESTART)
     {
         protocolbytecounter++;
+        lengthptr++;
         if (*lengthptr != FRAMESTART)
             return 0;
-        lengthptr++;
     }
     lengthptr++;
     protocolbytecounter++;
@@ -219,14 +516,19 @@ MODULE_API bool SMP_PacketValid(const uint8_t *data, uint16_t packetlength, uint
     const uint8_t *payload = data + headerlength;
     // We only need to check the checksum to validate the data integrety
     uint16_t payloadlength = packetlength - headerlength;
-    for (uint16_t i = 0; i < payloadlength - 2; i++)
+    size_t remaining = payloadlength > 2 ? payloadlength - 2 : 0;
+    // Calculate the crc blockwise over the runs between the stuffed framestarts
+    while (remaining > 0)
     {
-        crc = SMP_crc16(crc, *payload, CRC_POLYNOM);
-        if (*payload == FRAMESTART)
+        const uint8_t *stuffed = (const uint8_t *)memchr(payload, FRAMESTART, remaining);
+        size_t run = stuffed ? (size_t)(stuffed - payload) + 1 : remaining;
+        crc = SMP_crc16_block(crc, payload, run);
+        payload += run;
+        remaining -= run;
+        if (stuffed)
         {
-            payload++;
+            payload++; // Skip the stuffing byte
         }
-        payload++;
     }
     uint16_t transmittedCRC = *payload << 8;
     crccount++;
@@ -260,6 +562,50 @@ MODULE_API bool SMP_PacketValid(const uint8_t *data, uint16_t packetlength, uint
     return crc == transmittedCRC;
 }
 
+/************************************************************************
+ * @brief Validate a complete frame that is already in memory and extract the payload
+ * The bytestuffing is removed with SMP_UnstuffBytes and the crc is calculated over the whole
+ * payload at once, the frame is not passed through the decoder statemachine.
+ * @param data The frame, starting with the framestart
+ * @param datalength Number of bytes available at data, at least the whole stuffed frame
+ * @param payload Receives the payload. May be equal to data to decode in place.
+ * @param payloadbufferlength Size of the payload buffer, frames with a longer payload are rejected
+ * @param payloadlength Receives the length of the payload, can be NULL
+ * @return true if the frame is complete and the crc matches
+ ************************************************************************/
+MODULE_API bool SMP_PacketDecode(const uint8_t *data, size_t datalength, uint8_t *payload, size_t payloadbufferlength, uint16_t *payloadlength)
+{
+    uint16_t headerlength;
+    uint8_t crcbytes[2];
+    if (datalength < 5 || data[0] != FRAMESTART)
+        return false;
+    uint16_t lengthfield = SMP_PacketGetLength(data, &headerlength);
+    if (lengthfield < 2 || headerlength > datalength)
+        return false;
+    size_t count = lengthfield - 2;
+    if (count > payloadbufferlength)
+        return false;
+    const uint8_t *stuffed = data + headerlength;
+    size_t available = datalength - headerlength;
+    size_t consumed = 0;
+    if (count > 0)
+    {
+        consumed = SMP_UnstuffBytes(payload, stuffed, available, count);
+        if (consumed == 0)
+            return false;
+    }
+    if (SMP_UnstuffBytes(crcbytes, stuffed + consumed, available - consumed, sizeof(crcbytes)) == 0)
+        return false;
+    uint16_t transmittedCRC = (uint16_t)(crcbytes[0] << 8) | crcbytes[1];
+    if (SMP_crc16_block(0, payload, count) != transmittedCRC)
+        return false;
+    if (payloadlength)
+    {
+        *payloadlength = (uint16_t)count;
+    }
+    return true;
+}
+
 /**
  *  @brief Private function to process the received bytes without the bytestuffing
  * **/
@@ -342,13 +688,21 @@ static smp_decoder_stat private_SMP_RecieveInByte(uint8_t data, uint8_t* decoded
  * -3: Reserved
  * -4: CRC Error
  ************************************************************************/
-MODULE_API smp_decoder_stat SMP_RecieveInByte(uint8_t data, uint8_t* decoded, smp_struct_t *st)
+static inline smp_decoder_stat private_SMP_RecieveStuffedByte(uint8_t data, uint8_t *decoded, smp_struct_t *st)
 {
     smp_decoder_stat ret = NO_PACKET_START;
     // Remove the bytestuffing from the data
     if (data == FRAMESTART)
     {
-        if (st->flags.recievedDelimeter)
+        if (st->flags.recievedDelimeter && st->flags.decoderstate == 0)
+        {
+            // Outside of a frame two framestarts can only be the framestart followed by
+            // the stuffed low byte 0xFF of the length field. Keep the delimeter for the stuffing byte.
+            SMP_ResetDecoderState(st, true);
+            st->flags.decoderstate = 1;
+            ret = PACKET_START_FOUND;
+        }
+        else if (st->flags.recievedDelimeter)
         {
             st->flags.recievedDelimeter = 0;
             ret = private_SMP_RecieveInByte(data, decoded, st);
@@ -381,6 +735,179 @@ MODULE_API smp_decoder_stat SMP_RecieveInByte(uint8_t data, uint8_t* decoded, sm
     return ret;
 }
 
+/**
+ * @brief Count the result of a decoded byte in the statistics and remember the errors for SMP_GetLastError
+ * @param previousState Decoder state before the byte, to detect the start of a frame
+ */
+static inline void private_SMP_CountResult(smp_struct_t *st, smp_decoder_stat result, unsigned int previousState)
+{
+    switch (result)
+    {
+    case NO_PACKET_START:
+        STATS_ADD(st, bytesDiscarded, 1);
+        break;
+    case REPEATED_FRAMESTART:
+        STATS_ADD(st, resyncs, 1);
+        break;
+    case PACKET_READY:
+        STATS_ADD(st, framesReceived, 1);
+#ifdef SMP_ENABLE_LATENCY_HISTOGRAM
+        private_SMP_RecordDecodeTime(st);
+#endif
+        break;
+    case CRC_ERROR:
+        STATS_ADD(st, crcErrors, 1);
+        private_SMP_SetError(st, -4);
+        break;
+    case ERROR_UNKOWN:
+        private_SMP_SetError(st, -2);
+        break;
+    default:
+        break;
+    }
+#ifdef SMP_ENABLE_LATENCY_HISTOGRAM
+    if (st->flags.decoderstate == 1 && previousState != 1)
+    {
+        st->stats.framestartTime = (uint64_t)SMP_STATS_CLOCK();
+    }
+#else
+    (void)previousState;
+#endif
+}
+
+MODULE_API smp_decoder_stat SMP_RecieveInByte(uint8_t data, uint8_t* decoded, smp_struct_t *st)
+{
+    unsigned int previousState = st->flags.decoderstate;
+    smp_decoder_stat result = private_SMP_RecieveStuffedByte(data, decoded, st);
+    private_SMP_CountResult(st, result, previousState);
+    return result;
+}
+
+/************************************************************************
+ * @brief Common implementation of SMP_ReceiveBuffer and SMP_ReceiveBufferSwap, inlined into both
+ ************************************************************************/
+static inline uint32_t private_SMP_ReceiveBuffer(smp_struct_t *st, const uint8_t *data, size_t length, uint8_t **framebufferptr, size_t framebufferlength,
+                                                 SMP_Frame_Handler handler, SMP_Frame_Buffer_Handler bufferhandler, void *context)
+{
+    uint32_t frames = 0;
+    uint8_t *framebuffer = *framebufferptr;
+    const uint8_t *end = data + length;
+    while (data < end)
+    {
+        if (!st->flags.recievedDelimeter)
+        {
+            if (st->flags.decoderstate == 0)
+            {
+                // Outside of a frame only a framestart can change the state
+                const uint8_t *framestart = (const uint8_t *)memchr(data, FRAMESTART, (size_t)(end - data));
+                STATS_ADD(st, bytesDiscarded, (framestart ? framestart : end) - data);
+                if (!framestart)
+                    break;
+                data = framestart;
+            }
+            else if (st->flags.decoderstate == 2 && st->bytesToRecieve > 2)
+            {
+                // Copy the payload up to the next framestart or the crc in one block
+                size_t run = st->bytesToRecieve - 2;
+                if (run > (size_t)(end - data))
+                    run = (size_t)(end - data);
+                const uint8_t *framestart = (const uint8_t *)memchr(data, FRAMESTART, run);
+                if (framestart)
+                    run = (size_t)(framestart - data);
+                if (run > 0)
+                {
+                    memcpy(framebuffer + st->bytesRecieved, data, run);
+                    st->crc = SMP_crc16_block(st->crc, data, run);
+                    st->bytesRecieved += run;
+                    st->bytesToRecieve -= run;
+                    if (st->bytesToRecieve == 2)
+                    {
+                        st->flags.decoderstate = 3;
+                    }
+                    data += run;
+                    continue;
+                }
+            }
+        }
+
+        unsigned int previousState = st->flags.decoderstate;
+        bool readingLength = previousState == 1;
+        uint8_t decoded;
+        smp_decoder_stat result = private_SMP_RecieveStuffedByte(*data, &decoded, st);
+        private_SMP_CountResult(st, result, previousState);
+        switch (result)
+        {
+        case PACKET_START_FOUND:
+        case REPEATED_FRAMESTART:
+            if (st->flags.decoderstate == 2 && readingLength)
+            {
+                // The length field is complete, check if the payload fits into the framebuffer
+                st->bytesRecieved = 0;
+                if (st->bytesToRecieve < 2 || (size_t)(st->bytesToRecieve - 2) > framebufferlength)
+                {
+                    SMP_ResetDecoderState(st, false);
+                    STATS_ADD(st, framesDropped, 1);
+                    private_SMP_SetError(st, -1);
+                }
+            }
+            break;
+        case RECEIVED_BYTE:
+            framebuffer[st->bytesRecieved++] = decoded;
+            break;
+        case PACKET_READY:
+            frames++;
+            if (bufferhandler)
+            {
+                framebuffer = bufferhandler(context, framebuffer, st->bytesRecieved);
+            }
+            else if (handler)
+            {
+                handler(context, framebuffer, st->bytesRecieved);
+            }
+            st->bytesRecieved = 0;
+            break;
+        default:
+            break;
+        }
+        data++;
+    }
+    *framebufferptr = framebuffer;
+    return frames;
+}
+
+/************************************************************************
+ * @brief Decode a whole buffer of received bytes
+ * This produces the same results as calling SMP_RecieveInByte for every byte of the buffer, but
+ * skips data outside of frames with memchr and copies the runs of payload bytes between framestarts
+ * into the framebuffer in one block and calculates their crc blockwise.
+ * The framebuffer holds the payload of the frame that is currently received and must be the same
+ * buffer for every call on the same smp object, because frames can be split across calls.
+ * Frames with a payload longer than framebufferlength are dropped.
+ * @param handler Called with the payload for every valid frame. The data is only valid during the call.
+ * @param context Passed unchanged to the handler
+ * @return The number of valid frames that were passed to the handler
+ ************************************************************************/
+MODULE_API uint32_t SMP_ReceiveBuffer(smp_struct_t *st, const uint8_t *data, size_t length, uint8_t *framebuffer, size_t framebufferlength, SMP_Frame_Handler handler, void *context)
+{
+    return private_SMP_ReceiveBuffer(st, data, length, &framebuffer, framebufferlength, handler, NULL, context);
+}
+
+/************************************************************************
+ * @brief Decode a whole buffer of received bytes into changing framebuffers
+ * Works like SMP_ReceiveBuffer, but the handler takes over the framebuffer with the payload of every valid
+ * frame and returns the framebuffer for the next frame, e.g. the next free slot of a frame pool. So the
+ * payload can be kept after the call without copying it.
+ * *framebuffer is the buffer of the frame that is currently received and is updated with the buffer
+ * returned by the handler. Every buffer must hold framebufferlength bytes.
+ * @param handler Called with the payload for every valid frame, must return a framebuffer and not NULL
+ * @param context Passed unchanged to the handler
+ * @return The number of valid frames that were passed to the handler
+ ************************************************************************/
+MODULE_API uint32_t SMP_ReceiveBufferSwap(smp_struct_t *st, const uint8_t *data, size_t length, uint8_t **framebuffer, size_t framebufferlength, SMP_Frame_Buffer_Handler handler, void *context)
+{
+    return private_SMP_ReceiveBuffer(st, data, length, framebuffer, framebufferlength, NULL, handler, context);
+}
+
 /**********************************************************************
  * @brief Get the amounts of byte to recieve from the Interface for a full frame
  * This value is only valid if status.recieving is true
@@ -402,3 +929,89 @@ MODULE_API bool SMP_IsRecieving(smp_struct_t *st)
 {
     return st->flags.recieving;
 }
+
+/************************************************************************
+ * @brief Returns the last error of the decoder and clears it
+ * -1: Frame longer than the framebuffer
+ * -2: Possible memorycorruption error
+ * -4: CRC Error
+ * 0: No error since the last call
+ ************************************************************************/
+MODULE_API signed char SMP_GetLastError(smp_struct_t *st)
+{
+    signed char error = st->lastError;
+    st->lastError = 0;
+    return error;
+}
+
+/************************************************************************
+ * @brief Deprecated, use SMP_GetLastError.
+ * Returns the last error of any decoder and clears it, only kept for compatibility.
+ * The error is shared by all decoders, so it can't be assigned to a decoder
+ * if more than one is used.
+ ************************************************************************/
+MODULE_API signed char SMP_getRecieverError(void)
+{
+    signed char error = lastReceiverError;
+    lastReceiverError = 0;
+    return error;
+}
+
+/************************************************************************
+ * @brief Copy the statistics of the decoder, can be called from any thread
+ * @return false if the library was compiled without SMP_ENABLE_STATS, the snapshot is zeroed then
+ ************************************************************************/
+MODULE_API bool SMP_StatsSnapshot(const smp_struct_t *st, smp_stats_snapshot_t *snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+#ifdef SMP_ENABLE_STATS
+    smp_stats_t *stats = (smp_stats_t *)&st->stats;
+    snapshot->framesReceived = STATS_LOAD(stats->framesReceived);
+    snapshot->crcErrors = STATS_LOAD(stats->crcErrors);
+    snapshot->resyncs = STATS_LOAD(stats->resyncs);
+    snapshot->framesDropped = STATS_LOAD(stats->framesDropped);
+    snapshot->bytesDiscarded = STATS_LOAD(stats->bytesDiscarded);
+    snapshot->framesSent = STATS_LOAD(stats->framesSent);
+    snapshot->bytesSent = STATS_LOAD(stats->bytesSent);
+    snapshot->stuffingBytes = STATS_LOAD(stats->stuffingBytes);
+#ifdef SMP_ENABLE_LATENCY_HISTOGRAM
+    for (size_t i = 0; i < SMP_STATS_HISTOGRAM_BUCKETS; i++)
+    {
+        snapshot->decodeTime[i] = STATS_LOAD(stats->decodeTime[i]);
+    }
+#endif
+    return true;
+#else
+    (void)st;
+    return false;
+#endif
+}
+
+/************************************************************************
+ * @brief Clear the statistics, only from the decoding thread
+ ************************************************************************/
+MODULE_API void SMP_StatsReset(smp_struct_t *st)
+{
+#ifdef SMP_ENABLE_STATS
+    memset(&st->stats, 0, sizeof(st->stats));
+#else
+    (void)st;
+#endif
+}
+
+/************************************************************************
+ * @brief Count sent frames in the statistics of the smp object
+ * The encoder functions don't know the smp object, call this after the frames were written.
+ * @param framebytes Length of the frames including the protocol bytes and the bytestuffing
+ ************************************************************************/
+MODULE_API void SMP_StatsAddSent(smp_struct_t *st, size_t frames, size_t payloadbytes, size_t framebytes)
+{
+    STATS_ADD(st, framesSent, frames);
+    STATS_ADD(st, bytesSent, framebytes);
+    STATS_ADD(st, stuffingBytes, framebytes - payloadbytes - 5 * frames);
+#ifndef SMP_ENABLE_STATS
+    (void)frames;
+    (void)payloadbytes;
+    (void)framebytes;
+#endif
+}
@@ -0,0 +1,149 @@
+/*****************************************************************************************************
+ File: smp_encoder
+ Autor: Peter Kremsner
+
+ Resumable frame encoder for back-pressured transports like SPI or USB endpoints that accept only a
+ few hundred bytes per call. Instead of encoding the whole frame into a worst case buffer up front,
+ SMP_EncoderRead produces the next stuffed bytes of the frame into whatever space is offered. The
+ encoder only keeps the crc and its position in the frame, so the memory needed is constant and
+ independent of the payload length. A framestart in the payload whose stuffing byte doesn't fit
+ anymore is finished with the next call.
+
+ ******************************************************************************************************/
+#include "libsmp.h"
+#include <string.h>
+
+enum
+{
+    ENCODER_IDLE,
+    ENCODER_HEADER,
+    ENCODER_PAYLOAD,
+    ENCODER_CRC
+};
+
+static uint8_t private_SMP_PendStuffed(smp_encoder_t *encoder, uint8_t data)
+{
+    encoder->pending[encoder->pendinglength++] = data;
+    if (data == FRAMESTART)
+    {
+        encoder->pending[encoder->pendinglength++] = FRAMESTART;
+    }
+    return encoder->pendinglength;
+}
+
+/**
+ * @brief Write as many pending header or crc bytes as fit, returns the number of bytes written
+ */
+static size_t private_SMP_WritePending(smp_encoder_t *encoder, uint8_t *dest, size_t space)
+{
+    size_t count = (size_t)(encoder->pendinglength - encoder->pendingstart);
+    if (count > space)
+        count = space;
+    memcpy(dest, encoder->pending + encoder->pendingstart, count);
+    encoder->pendingstart += (uint8_t)count;
+    return count;
+}
+
+/************************************************************************
+ * @brief Start a new frame with the payload
+ * The payload isn't copied and must stay valid until SMP_EncoderBusy returns false.
+ * A frame that is still in progress is abandoned.
+ * @return false if the payload is too long
+ ************************************************************************/
+MODULE_API bool SMP_EncoderStart(smp_encoder_t *encoder, const uint8_t *payload, size_t length)
+{
+    encoder->phase = ENCODER_IDLE;
+    if (length > SMP_MAX_PAYLOAD)
+        return false;
+    uint16_t lengthfield = (uint16_t)(length + 2);
+    encoder->payload = payload;
+    encoder->length = length;
+    encoder->position = 0;
+    // One pass over the whole payload, the block crc is much slower on the short pieces written per call
+    encoder->crc = SMP_crc16_block(0, payload, length);
+    encoder->pendingstart = 0;
+    encoder->pendinglength = 0;
+    encoder->pending[encoder->pendinglength++] = FRAMESTART;
+    private_SMP_PendStuffed(encoder, lengthfield & 0xFF);
+    private_SMP_PendStuffed(encoder, lengthfield >> 8);
+    encoder->phase = ENCODER_HEADER;
+    return true;
+}
+
+/************************************************************************
+ * @brief Write the next bytes of the frame into dest
+ * Every byte that fits into space is written, a short write is not an error. Call the function again
+ * with new space until SMP_EncoderBusy returns false.
+ * @return The number of bytes written, zero if the frame is complete
+ ************************************************************************/
+MODULE_API size_t SMP_EncoderRead(smp_encoder_t *encoder, uint8_t *dest, size_t space)
+{
+    size_t written = 0;
+    while (written < space && encoder->phase != ENCODER_IDLE)
+    {
+        if (encoder->pendingstart < encoder->pendinglength)
+        {
+            written += private_SMP_WritePending(encoder, dest + written, space - written);
+            if (encoder->phase == ENCODER_CRC && encoder->pendingstart == encoder->pendinglength)
+            {
+                encoder->phase = ENCODER_IDLE;
+            }
+            continue;
+        }
+        switch (encoder->phase)
+        {
+        case ENCODER_HEADER:
+            encoder->phase = ENCODER_PAYLOAD;
+            break;
+        case ENCODER_PAYLOAD:
+            if (encoder->position < encoder->length)
+            {
+                const uint8_t *data = encoder->payload + encoder->position;
+                size_t run = encoder->length - encoder->position;
+                size_t left = space - written;
+                if (run > left)
+                    run = left;
+                // Stuff as many bytes as fit, the framestarts in the run tell how much space the stuffing needs
+                size_t stuffing = SMP_CountFramestarts(data, run);
+                if (run + stuffing > left)
+                    run = stuffing < left ? left - stuffing : left / 2;
+                if (run > 0)
+                {
+                    written += SMP_StuffBytes(dest + written, data, run);
+                }
+                else
+                {
+                    // Only one byte left for a framestart, its stuffing byte is written with the next call
+                    run = 1;
+                    dest[written++] = FRAMESTART;
+                    // The first of the two pending framestarts is already written
+                    encoder->pendingstart = 1;
+                    encoder->pendinglength = 0;
+                    private_SMP_PendStuffed(encoder, FRAMESTART);
+                }
+                encoder->position += run;
+            }
+            else
+            {
+                encoder->pendingstart = 0;
+                encoder->pendinglength = 0;
+                private_SMP_PendStuffed(encoder, encoder->crc >> 8);
+                private_SMP_PendStuffed(encoder, encoder->crc & 0xFF);
+                encoder->phase = ENCODER_CRC;
+            }
+            break;
+        default: // The crc is written together with the pending bytes
+            encoder->phase = ENCODER_IDLE;
+            break;
+        }
+    }
+    return written;
+}
+
+/************************************************************************
+ * @brief True as long as the frame isn't completely written
+ ************************************************************************/
+MODULE_API bool SMP_EncoderBusy(const smp_encoder_t *encoder)
+{
+    return encoder->phase != ENCODER_IDLE;
+}
@@ -0,0 +1,190 @@
+/*****************************************************************************************************
+ File: smp_object
+ Autor: Peter Kremsner
+
+ Heap allocated decoder objects for language bindings like the C# NativeSMP class, which can't embed
+ a smp_struct_t and a framebuffer. The object is passed as an opaque handle.
+
+ SMP_ReceiveBytes decodes a whole buffer per call. Without a batch buffer every frame is passed to the
+ frame ready callback. With a batch buffer supplied by the caller (e.g. a pinned managed array) the
+ payloads are decoded directly into it, one behind the other, and the batch handler is called once per
+ call or when the buffer is full with the offsets and lengths of all frames. So a binding only
+ crosses the native boundary once per batch and can read the payloads in place.
+
+ This file uses malloc, leave it out on targets without a heap.
+
+ ******************************************************************************************************/
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L // posix_memalign with -std=c11
+#endif
+#include "libsmp.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct smp_object
+{
+    smp_struct_t st;
+    uint32_t maxmessagelength;
+    SMP_Frame_Ready frameReady;
+    uint8_t *framebuffer; // Used without a batch buffer
+    uint8_t *batch;
+    size_t batchlength;
+    size_t batchused; // The payload of the frame that is currently received starts at batch + batchused
+    smp_frame_info_t *frames;
+    uint32_t maxframes;
+    uint32_t framecount;
+    SMP_Batch_Handler batchhandler;
+    void *batchcontext;
+};
+
+/**
+ * @brief The statistics in smp_struct_t may require an alignment beyond malloc
+ */
+static smp_object_t *private_SMP_AllocObject(void)
+{
+#if defined(_WIN32)
+    return (smp_object_t *)_aligned_malloc(sizeof(smp_object_t), __alignof(smp_object_t));
+#elif defined(__unix__) || defined(__APPLE__)
+    void *object = NULL;
+    size_t alignment = _Alignof(smp_object_t) > sizeof(void *) ? _Alignof(smp_object_t) : sizeof(void *);
+    if (posix_memalign(&object, alignment, sizeof(smp_object_t)) != 0)
+        return NULL;
+    return (smp_object_t *)object;
+#else
+    return (smp_object_t *)malloc(sizeof(smp_object_t));
+#endif
+}
+
+static void private_SMP_FreeObject(smp_object_t *object)
+{
+#if defined(_WIN32)
+    _aligned_free(object);
+#else
+    free(object);
+#endif
+}
+
+/**
+ * @brief Pass the frames of the batch to the handler and move the partially received frame to the start of the batch buffer
+ */
+static void private_SMP_FlushBatch(smp_object_t *object, size_t partial)
+{
+    object->batchhandler(object->batchcontext, object->batch, object->frames, object->framecount);
+    object->framecount = 0;
+    if (partial > 0)
+    {
+        memmove(object->batch, object->batch + object->batchused, partial);
+    }
+    object->batchused = 0;
+}
+
+static uint8_t *private_SMP_ObjectFrame(void *context, uint8_t *data, uint32_t length)
+{
+    smp_object_t *object = (smp_object_t *)context;
+    if (!object->batchhandler)
+    {
+        if (object->frameReady)
+        {
+            object->frameReady(data, length);
+        }
+        return data;
+    }
+    object->frames[object->framecount].offset = (uint32_t)object->batchused;
+    object->frames[object->framecount].length = length;
+    object->framecount++;
+    object->batchused += length;
+    // The next frame must fit behind the last one
+    if (object->framecount == object->maxframes || object->batchlength - object->batchused < object->maxmessagelength)
+    {
+        private_SMP_FlushBatch(object, 0);
+    }
+    return object->batch + object->batchused;
+}
+
+/************************************************************************
+ * @brief Create a decoder object for frames with up to bufferlength bytes of payload
+ * @param frameReadyCallback Called for every valid frame while no batch buffer is set, can be NULL
+ * @param rogueFrameCallback Not used anymore, kept for compatibility
+ * @return The object or NULL if the memory couldn't be allocated
+ ************************************************************************/
+MODULE_API smp_object_t *SMP_BuildObject(uint32_t bufferlength, SMP_Frame_Ready frameReadyCallback, SMP_Frame_Ready rogueFrameCallback)
+{
+    (void)rogueFrameCallback;
+    smp_object_t *object = private_SMP_AllocObject();
+    if (!object)
+        return NULL;
+    memset(object, 0, sizeof(*object));
+    object->framebuffer = (uint8_t *)malloc(bufferlength > 0 ? bufferlength : 1);
+    if (!object->framebuffer)
+    {
+        private_SMP_FreeObject(object);
+        return NULL;
+    }
+    SMP_Init(&object->st);
+    object->maxmessagelength = bufferlength;
+    object->frameReady = frameReadyCallback;
+    return object;
+}
+
+MODULE_API void SMP_DestroyObject(smp_object_t *object)
+{
+    if (object)
+    {
+        free(object->framebuffer);
+        private_SMP_FreeObject(object);
+    }
+}
+
+/************************************************************************
+ * @brief Decode into the batch buffer of the caller instead of calling the frame ready callback
+ * The buffer and the frames array are owned by the object until they are replaced or the object is destroyed,
+ * the caller may only read them in the batch handler. The frame that is currently received is dropped.
+ * @param bufferlength Must hold at least one frame with the maximum payload length
+ * @param handler Called with the completed frames, NULL switches back to the frame ready callback
+ * @return false if the buffer is too small
+ ************************************************************************/
+MODULE_API bool SMP_SetBatchBuffer(smp_object_t *object, uint8_t *buffer, size_t bufferlength, smp_frame_info_t *frames, uint32_t maxframes, SMP_Batch_Handler handler, void *context)
+{
+    if (handler && (!buffer || !frames || maxframes == 0 || bufferlength < object->maxmessagelength))
+        return false;
+    SMP_ResetObject(object);
+    object->batch = buffer;
+    object->batchlength = bufferlength;
+    object->frames = frames;
+    object->maxframes = maxframes;
+    object->batchhandler = handler;
+    object->batchcontext = context;
+    return true;
+}
+
+/************************************************************************
+ * @brief Decode received bytes, frames can be split across calls
+ * With a batch buffer the handler is called before the function returns if at least one frame was completed.
+ * @return The number of valid frames
+ ************************************************************************/
+MODULE_API uint32_t SMP_ReceiveBytes(smp_object_t *object, const uint8_t *data, size_t length)
+{
+    uint8_t *framebuffer = object->batchhandler ? object->batch + object->batchused : object->framebuffer;
+    uint32_t frames = SMP_ReceiveBufferSwap(&object->st, data, length, &framebuffer, object->maxmessagelength, &private_SMP_ObjectFrame, object);
+    if (object->batchhandler && object->framecount > 0)
+    {
+        private_SMP_FlushBatch(object, SMP_IsRecieving(&object->st) ? object->st.bytesRecieved : 0);
+    }
+    return frames;
+}
+
+/************************************************************************
+ * @brief Drop the frame that is currently received, the statistics are kept
+ ************************************************************************/
+MODULE_API void SMP_ResetObject(smp_object_t *object)
+{
+    SMP_ResetDecoderState(&object->st, false);
+    object->st.bytesRecieved = 0;
+    object->batchused = 0;
+    object->framecount = 0;
+}
+
+MODULE_API bool SMP_ObjectStatsSnapshot(const smp_object_t *object, smp_stats_snapshot_t *snapshot)
+{
+    return SMP_StatsSnapshot(&object->st, snapshot);
+}
@@ -0,0 +1,114 @@
+/*****************************************************************************************************
+ File: smp_ring
+ Autor: Peter Kremsner
+
+ Lock free single producer single consumer ring between the receive interrupt and the decoder.
+ The interrupt or dma callback only copies the received bytes into the ring, the decoding with the crc
+ calculation runs in task context with SMP_Poll. The producer owns the head index and the consumer the
+ tail index, so no locks are needed. With C11 atomics the indices are published with release/acquire
+ ordering, gcc and clang without C11 use the equivalent builtins. Other compilers fall back to volatile
+ accesses, which is only sufficient on single core microcontrollers.
+
+ ******************************************************************************************************/
+#include "libsmp.h"
+#include <string.h>
+
+#if defined(SMP_RING_C11_ATOMICS)
+#define RING_LOAD_ACQUIRE(index) atomic_load_explicit(&(index), memory_order_acquire)
+#define RING_LOAD_RELAXED(index) atomic_load_explicit(&(index), memory_order_relaxed)
+#define RING_STORE_RELEASE(index, value) atomic_store_explicit(&(index), (value), memory_order_release)
+#define RING_INIT(index, value) atomic_init(&(index), (value))
+#elif defined(__GNUC__)
+#define RING_LOAD_ACQUIRE(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define RING_LOAD_RELAXED(index) __atomic_load_n(&(index), __ATOMIC_RELAXED)
+#define RING_STORE_RELEASE(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+#define RING_INIT(index, value) ((index) = (value))
+#else
+#define RING_LOAD_ACQUIRE(index) (index)
+#define RING_LOAD_RELAXED(index) (index)
+#define RING_STORE_RELEASE(index, value) ((index) = (value))
+#define RING_INIT(index, value) ((index) = (value))
+#endif
+
+/************************************************************************
+ * @brief Initialize an empty ring on the buffer
+ * @param size Length of the buffer, must be a power of two
+ * @return false if the size is not a power of two
+ ************************************************************************/
+MODULE_API bool SMP_RingInit(smp_ring_t *ring, uint8_t *buffer, size_t size)
+{
+    if (size == 0 || (size & (size - 1)) != 0)
+        return false;
+    ring->buffer = buffer;
+    ring->size = size;
+    RING_INIT(ring->head, 0);
+    RING_INIT(ring->tail, 0);
+    return true;
+}
+
+/************************************************************************
+ * @brief Append one received byte, called by the producer e.g. in the uart interrupt
+ * @return false if the ring is full and the byte was dropped
+ ************************************************************************/
+MODULE_API bool SMP_RingPut(smp_ring_t *ring, uint8_t data)
+{
+    size_t head = RING_LOAD_RELAXED(ring->head);
+    if (head - RING_LOAD_ACQUIRE(ring->tail) >= ring->size)
+        return false;
+    ring->buffer[head & (ring->size - 1)] = data;
+    RING_STORE_RELEASE(ring->head, head + 1);
+    return true;
+}
+
+/************************************************************************
+ * @brief Append a block of received bytes, called by the producer e.g. in the dma callback
+ * @return The number of bytes written. The remaining bytes didn't fit into the ring and were dropped.
+ ************************************************************************/
+MODULE_API size_t SMP_RingWrite(smp_ring_t *ring, const uint8_t *data, size_t length)
+{
+    size_t head = RING_LOAD_RELAXED(ring->head);
+    size_t space = ring->size - (head - RING_LOAD_ACQUIRE(ring->tail));
+    if (length > space)
+        length = space;
+    size_t index = head & (ring->size - 1);
+    size_t first = ring->size - index;
+    if (first > length)
+        first = length;
+    memcpy(ring->buffer + index, data, first);
+    memcpy(ring->buffer, data + first, length - first);
+    RING_STORE_RELEASE(ring->head, head + length);
+    return length;
+}
+
+/************************************************************************
+ * @brief Number of bytes in the ring that were not consumed yet
+ ************************************************************************/
+MODULE_API size_t SMP_RingAvailable(smp_ring_t *ring)
+{
+    return RING_LOAD_ACQUIRE(ring->head) - RING_LOAD_RELAXED(ring->tail);
+}
+
+/************************************************************************
+ * @brief Decode the bytes in the ring, called by the consumer from task context
+ * The bytes that are in the ring when the function is called are passed to SMP_ReceiveBuffer in at most
+ * two contiguous blocks. Bytes written during the call are decoded by the next call.
+ * @return The number of valid frames that were passed to the handler
+ ************************************************************************/
+MODULE_API uint32_t SMP_Poll(smp_struct_t *st, smp_ring_t *ring, uint8_t *framebuffer, size_t framebufferlength, SMP_Frame_Handler handler, void *context)
+{
+    uint32_t frames = 0;
+    size_t tail = RING_LOAD_RELAXED(ring->tail);
+    size_t head = RING_LOAD_ACQUIRE(ring->head);
+    while (tail != head)
+    {
+        size_t index = tail & (ring->size - 1);
+        size_t run = head - tail;
+        if (run > ring->size - index)
+            run = ring->size - index;
+        frames += SMP_ReceiveBuffer(st, ring->buffer + index, run, framebuffer, framebufferlength, handler, context);
+        tail += run;
+        // Release the block after it was decoded, the framebuffer holds the payload from here on
+        RING_STORE_RELEASE(ring->tail, tail);
+    }
+    return frames;
+}
@@ -0,0 +1,206 @@
+/*****************************************************************************************************
+ File: smp_stuffing
+ Autor: Peter Kremsner
+
+ Bytestuffing of the smp payload. Every FRAMESTART inside a frame is doubled.
+ The stuffing scans 16 (SSE2, NEON) or 32 (AVX2) bytes at once for framestarts and copies the clean
+ runs between them in blocks. The instruction set is selected at compile time, without any vector
+ extension the runs are searched with memchr.
+
+ ******************************************************************************************************/
+#include "libsmp.h"
+#include <string.h>
+
+#if defined(SMP_STUFFING_SCALAR)
+// Vector extensions disabled
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SMP_STUFFING_AVX2 1
+#define SMP_STUFFING_VECTORLENGTH 32
+#define SMP_STUFFING_MASKBITS 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SMP_STUFFING_SSE2 1
+#define SMP_STUFFING_VECTORLENGTH 16
+#define SMP_STUFFING_MASKBITS 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SMP_STUFFING_NEON 1
+#define SMP_STUFFING_VECTORLENGTH 16
+#define SMP_STUFFING_MASKBITS 4
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#ifdef SMP_STUFFING_VECTORLENGTH
+/**
+ * @brief Returns a mask with SMP_STUFFING_MASKBITS set bits for every framestart in the SMP_STUFFING_VECTORLENGTH bytes at ptr
+ */
+static inline uint64_t private_framestart_mask(const uint8_t *ptr)
+{
+#if defined(SMP_STUFFING_AVX2)
+    __m256i v = _mm256_loadu_si256((const __m256i *)ptr);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)FRAMESTART)));
+#elif defined(SMP_STUFFING_SSE2)
+    __m128i v = _mm_loadu_si128((const __m128i *)ptr);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)FRAMESTART)));
+#else
+    uint8x16_t eq = vceqq_u8(vld1q_u8(ptr), vdupq_n_u8(FRAMESTART));
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+#endif
+}
+
+/**
+ * @brief Index of the first framestart in a mask returned by private_framestart_mask. mask must not be zero.
+ */
+static inline unsigned int private_first_framestart(uint64_t mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (unsigned int)index / SMP_STUFFING_MASKBITS;
+#else
+    return (unsigned int)__builtin_ctzll(mask) / SMP_STUFFING_MASKBITS;
+#endif
+}
+#endif
+
+/************************************************************************
+ * @brief Count the framestarts in the data, this is the number of bytes the bytestuffing adds
+ ************************************************************************/
+MODULE_API size_t SMP_CountFramestarts(const uint8_t *data, size_t length)
+{
+    size_t count = 0;
+#ifdef SMP_STUFFING_VECTORLENGTH
+    while (length >= SMP_STUFFING_VECTORLENGTH)
+    {
+        uint64_t mask = private_framestart_mask(data);
+        if (mask != 0)
+        {
+#if defined(_MSC_VER) && !defined(__clang__)
+            count += (size_t)__popcnt64(mask) / SMP_STUFFING_MASKBITS;
+#else
+            count += (size_t)__builtin_popcountll(mask) / SMP_STUFFING_MASKBITS;
+#endif
+        }
+        data += SMP_STUFFING_VECTORLENGTH;
+        length -= SMP_STUFFING_VECTORLENGTH;
+    }
+#endif
+    while (length > 0)
+    {
+        if (*data == FRAMESTART)
+            count++;
+        data++;
+        length--;
+    }
+    return count;
+}
+
+/************************************************************************
+ * @brief Copy the data to dest and double every framestart
+ * @param dest Destination buffer, must hold at least 2 * length bytes for the worst case.
+ * @return The number of bytes written to dest
+ ************************************************************************/
+MODULE_API size_t SMP_StuffBytes(uint8_t *dest, const uint8_t *src, size_t length)
+{
+    uint8_t *out = dest;
+#ifdef SMP_STUFFING_VECTORLENGTH
+    while (length >= SMP_STUFFING_VECTORLENGTH)
+    {
+        uint64_t mask = private_framestart_mask(src);
+        if (mask == 0)
+        {
+            memcpy(out, src, SMP_STUFFING_VECTORLENGTH);
+            out += SMP_STUFFING_VECTORLENGTH;
+        }
+        else
+        {
+            size_t copied = 0;
+            while (mask)
+            {
+                unsigned int framestart = private_first_framestart(mask);
+                size_t run = framestart - copied + 1; // Clean bytes including the framestart
+                memcpy(out, src + copied, run);
+                out += run;
+                *out++ = FRAMESTART;
+                copied = framestart + 1;
+                mask &= ~((((uint64_t)1 << SMP_STUFFING_MASKBITS) - 1) << (framestart * SMP_STUFFING_MASKBITS));
+            }
+            memcpy(out, src + copied, SMP_STUFFING_VECTORLENGTH - copied);
+            out += SMP_STUFFING_VECTORLENGTH - copied;
+        }
+        src += SMP_STUFFING_VECTORLENGTH;
+        length -= SMP_STUFFING_VECTORLENGTH;
+    }
+#endif
+    while (length > 0)
+    {
+        const uint8_t *framestart = (const uint8_t *)memchr(src, FRAMESTART, length);
+        size_t run = framestart ? (size_t)(framestart - src) + 1 : length;
+        memcpy(out, src, run);
+        out += run;
+        if (framestart)
+        {
+            *out++ = FRAMESTART;
+        }
+        src += run;
+        length -= run;
+    }
+    return (size_t)(out - dest);
+}
+
+/************************************************************************
+ * @brief Remove the bytestuffing from src until count bytes are decoded
+ * dest may be equal to src to remove the stuffing in place.
+ * @return The number of bytes consumed from src. 0 if src ended before count bytes were decoded
+ *          or a framestart wasn't followed by the stuffing byte.
+ ************************************************************************/
+MODULE_API size_t SMP_UnstuffBytes(uint8_t *dest, const uint8_t *src, size_t srclength, size_t count)
+{
+    const uint8_t *start = src;
+    const uint8_t *end = src + srclength;
+    while (count > 0)
+    {
+        size_t run;
+#ifdef SMP_STUFFING_VECTORLENGTH
+        if (count >= SMP_STUFFING_VECTORLENGTH && (size_t)(end - src) >= SMP_STUFFING_VECTORLENGTH)
+        {
+            uint64_t mask = private_framestart_mask(src);
+            if (mask == 0)
+            {
+                memmove(dest, src, SMP_STUFFING_VECTORLENGTH);
+                dest += SMP_STUFFING_VECTORLENGTH;
+                src += SMP_STUFFING_VECTORLENGTH;
+                count -= SMP_STUFFING_VECTORLENGTH;
+                continue;
+            }
+            run = private_first_framestart(mask) + 1; // Clean bytes including the framestart
+        }
+        else
+#endif
+        {
+            size_t available = (size_t)(end - src);
+            if (available == 0)
+                return 0;
+            if (available > count)
+                available = count;
+            const uint8_t *framestart = (const uint8_t *)memchr(src, FRAMESTART, available);
+            run = framestart ? (size_t)(framestart - src) + 1 : available;
+        }
+        memmove(dest, src, run);
+        dest += run;
+        src += run;
+        count -= run;
+        if (dest[-1] == FRAMESTART)
+        {
+            // Skip the stuffing byte
+            if (src >= end || *src != FRAMESTART)
+                return 0;
+            src++;
+        }
+    }
+    return (size_t)(src - start);
+}
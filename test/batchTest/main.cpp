@@ -0,0 +1,213 @@
+#include "libsmp.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+// SMP_SendMany and SMP::TransmitBatch have to flush at the threshold and when the buffer is full,
+// write the same bytes as SMP_Encode for every message and stop at the first short write
+
+constexpr size_t MaxPayload = 200;
+
+static int failed = 0;
+
+static void Check(bool condition, const char *message)
+{
+    if (!condition)
+    {
+        printf("%s\n", message);
+        failed++;
+    }
+}
+
+/**
+ * @brief Records every write, the write with the index shortWrite only writes all but one byte
+ */
+struct Sink
+{
+    std::vector<std::vector<uint8_t>> writes;
+    size_t shortWrite = SIZE_MAX;
+
+    size_t operator()(const uint8_t *data, size_t length)
+    {
+        bool isShort = writes.size() == shortWrite;
+        writes.emplace_back(data, data + length);
+        return isShort ? length - 1 : length;
+    }
+
+    static size_t Write(void *context, const uint8_t *data, size_t length)
+    {
+        return (*static_cast<Sink *>(context))(data, length);
+    }
+};
+
+struct Batch
+{
+    std::vector<std::vector<uint8_t>> payloads;
+    std::vector<smp_segment_t> messages;
+    std::vector<std::vector<uint8_t>> frames;
+
+    void Add(size_t length)
+    {
+        std::vector<uint8_t> payload(length);
+        for (auto &b : payload)
+        {
+            b = rand() % 8 == 0 ? 0xFF : rand() & 0xFF;
+        }
+        std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(length));
+        frame.resize(SMP_Encode(payload.data(), length, frame.data(), frame.size()));
+        frames.push_back(std::move(frame));
+        payloads.push_back(std::move(payload));
+    }
+
+    const smp_segment_t *Messages()
+    {
+        messages.clear();
+        for (const auto &payload : payloads)
+        {
+            messages.push_back(smp_segment_t{payload.data(), payload.size()});
+        }
+        return messages.data();
+    }
+
+    /**
+     * @brief The writes that are expected for the first count messages
+     */
+    std::vector<std::vector<uint8_t>> ExpectedWrites(size_t count, size_t bufferLength, size_t flushThreshold) const
+    {
+        std::vector<std::vector<uint8_t>> writes;
+        std::vector<uint8_t> pending;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (pending.size() + frames[i].size() > bufferLength)
+            {
+                writes.push_back(std::move(pending));
+                pending.clear();
+            }
+            pending.insert(pending.end(), frames[i].begin(), frames[i].end());
+            if (flushThreshold > 0 && pending.size() >= flushThreshold)
+            {
+                writes.push_back(std::move(pending));
+                pending.clear();
+            }
+        }
+        if (!pending.empty())
+            writes.push_back(std::move(pending));
+        return writes;
+    }
+};
+
+static Batch RandomBatch(size_t count)
+{
+    Batch batch;
+    for (size_t i = 0; i < count; i++)
+    {
+        batch.Add(rand() % (MaxPayload + 1));
+    }
+    return batch;
+}
+
+static void TestSendMany()
+{
+    const size_t bufferLength = 1024;
+    std::vector<uint8_t> buffer(bufferLength);
+    // The batches are several times longer than the buffer, so full buffers are flushed as well
+    for (size_t flushThreshold : {size_t(0), size_t(1), size_t(300), bufferLength - 10, bufferLength})
+    {
+        for (int i = 0; i < 50; i++)
+        {
+            Batch batch = RandomBatch(1 + rand() % 40);
+            Sink sink;
+            size_t written = SMP_SendMany(batch.Messages(), batch.payloads.size(), buffer.data(), bufferLength, flushThreshold, &Sink::Write, &sink);
+            Check(written == batch.payloads.size(), "SMP_SendMany didn't write all messages");
+            Check(sink.writes == batch.ExpectedWrites(batch.payloads.size(), bufferLength, flushThreshold), "SMP_SendMany flushed at the wrong position");
+        }
+    }
+
+    // A message that doesn't fit into the empty buffer stops the batch after the messages before it were flushed
+    Batch batch;
+    batch.Add(10);
+    batch.Add(20);
+    batch.Add(MaxPayload);
+    batch.Add(10);
+    Sink sink;
+    size_t smallBuffer = SMP_SEND_BUFFER_LENGTH(20);
+    Check(SMP_SendMany(batch.Messages(), 4, buffer.data(), smallBuffer, 0, &Sink::Write, &sink) == 2, "SMP_SendMany didn't stop at a too long message");
+    Check(sink.writes == batch.ExpectedWrites(2, smallBuffer, 0), "SMP_SendMany didn't flush the messages before the too long message");
+}
+
+static void TestShortWrite()
+{
+    const size_t bufferLength = 512;
+    std::vector<uint8_t> buffer(bufferLength);
+    for (size_t flushThreshold : {size_t(0), size_t(200)})
+    {
+        Batch batch = RandomBatch(30);
+        std::vector<std::vector<uint8_t>> expected = batch.ExpectedWrites(batch.payloads.size(), bufferLength, flushThreshold);
+        Check(expected.size() > 2, "Batch too short for the short write test");
+        for (size_t shortWrite = 0; shortWrite < expected.size(); shortWrite++)
+        {
+            Sink sink;
+            sink.shortWrite = shortWrite;
+            size_t written = SMP_SendMany(batch.Messages(), batch.payloads.size(), buffer.data(), bufferLength, flushThreshold, &Sink::Write, &sink);
+            // Only the messages of the writes before the short one count and nothing is written after it
+            size_t bytes = 0;
+            for (size_t i = 0; i < shortWrite; i++)
+            {
+                bytes += expected[i].size();
+            }
+            size_t messages = 0;
+            for (size_t framebytes = 0; framebytes < bytes; messages++)
+            {
+                framebytes += batch.frames[messages].size();
+            }
+            Check(written == messages, "SMP_SendMany counted the messages of a short write");
+            Check(sink.writes.size() == shortWrite + 1, "SMP_SendMany continued after a short write");
+        }
+    }
+}
+
+static void TestTransmitBatch()
+{
+    constexpr size_t bufferLength = 1024;
+    SMP<MaxPayload> smp;
+    for (size_t flushThreshold : {size_t(0), size_t(400)})
+    {
+        Batch batch = RandomBatch(40);
+        Sink sink;
+        Check(smp.TransmitBatch<bufferLength>(std::ref(sink), batch.Messages(), batch.payloads.size(), flushThreshold) == batch.payloads.size(),
+              "TransmitBatch didn't write all messages");
+        Check(sink.writes == batch.ExpectedWrites(batch.payloads.size(), bufferLength, flushThreshold), "TransmitBatch flushed at the wrong position");
+    }
+
+    // Messages longer than the maximum payload end the batch
+    Batch batch = RandomBatch(5);
+    batch.Add(MaxPayload + 1);
+    batch.Add(10);
+    Sink sink;
+    Check(smp.TransmitBatch<bufferLength>(std::ref(sink), batch.Messages(), batch.payloads.size()) == 5 &&
+              sink.writes == batch.ExpectedWrites(5, bufferLength, 0),
+          "TransmitBatch sent a too long message");
+
+    sink = Sink{};
+    sink.shortWrite = 0;
+    const uint8_t first[] = {0x01, 0xFF};
+    const uint8_t second[] = {0x02};
+    Check(smp.TransmitBatch(std::ref(sink), {{first, sizeof(first)}, {second, sizeof(second)}}) == 0 && sink.writes.size() == 1,
+          "TransmitBatch ignored a short write");
+}
+
+int main()
+{
+    srand(8);
+    TestSendMany();
+    TestShortWrite();
+    TestTransmitBatch();
+
+    if (failed)
+    {
+        printf("%d checks failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,272 @@
+#include "smpchannel.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <thread>
+
+// Request/response over two channels connected by byte queues of limited capacity, so the senders have to wait for the transport.
+// After the first exchanges neither the channels nor the tasks may allocate.
+// The frame pool has to limit its free lists and fall back to the global allocator during thread exit.
+
+static size_t allocations = 0;
+static size_t deallocations = 0;
+
+void *operator new(size_t length)
+{
+    allocations++;
+    if (void *memory = std::malloc(length ? length : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+    deallocations++;
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+    deallocations++;
+    std::free(memory);
+}
+
+/**
+ * @brief Byte queue of one direction, accepts at most Capacity bytes until the event loop moves them to the receiver
+ */
+struct Pipe
+{
+    static constexpr size_t Capacity = 300;
+    uint8_t data[Capacity];
+    size_t used = 0;
+
+    size_t Write(const uint8_t *bytes, size_t length)
+    {
+        size_t accepted = length < Capacity - used ? length : Capacity - used;
+        std::memcpy(data + used, bytes, accepted);
+        used += accepted;
+        return accepted;
+    }
+};
+
+using Channel = smp::Channel<512>;
+
+static Pipe toDevice;
+static Pipe toHost;
+static Channel host([](const uint8_t *data, size_t length)
+                    { return toDevice.Write(data, length); });
+static Channel device([](const uint8_t *data, size_t length)
+                      { return toHost.Write(data, length); });
+
+static int failed = 0;
+
+/**
+ * @brief The device answers every request with the reversed payload, until the channel is closed
+ */
+static smp::Task<size_t> Device()
+{
+    uint8_t response[512];
+    size_t answered = 0;
+    while (true)
+    {
+        std::optional<std::span<const uint8_t>> request = co_await device.Receive();
+        if (!request)
+            break;
+        for (size_t i = 0; i < request->size(); i++)
+        {
+            response[i] = (*request)[request->size() - 1 - i];
+        }
+        if (!co_await device.Send(std::span<const uint8_t>(response, request->size())))
+            break;
+        answered++;
+    }
+    co_return answered;
+}
+
+static smp::Task<bool> Exchange(const uint8_t *request, size_t length)
+{
+    if (!co_await host.Send(std::span<const uint8_t>(request, length)))
+        co_return false;
+    std::optional<std::span<const uint8_t>> response = co_await host.Receive();
+    if (!response || response->size() != length)
+        co_return false;
+    for (size_t i = 0; i < length; i++)
+    {
+        if ((*response)[i] != request[length - 1 - i])
+            co_return false;
+    }
+    co_return true;
+}
+
+static smp::Task<bool> Notify(Channel &channel, const uint8_t *payload, size_t length)
+{
+    co_return co_await channel.Send(std::span<const uint8_t>(payload, length));
+}
+
+static size_t steadyAllocations = 0;
+
+static smp::Task<> Host(size_t exchanges)
+{
+    uint8_t request[512];
+    for (size_t i = 0; i < exchanges; i++)
+    {
+        if (i == 10)
+        {
+            steadyAllocations = allocations;
+        }
+        // Up to 512 bytes, more than the pipe holds, and many framestarts. Empty requests must not close the device.
+        size_t length = i % 50 == 0 ? 0 : 1 + rand() % 512;
+        for (size_t j = 0; j < length; j++)
+        {
+            request[j] = rand() % 5 == 0 ? 0xFF : rand() & 0xFF;
+        }
+        if (!co_await Exchange(request, length))
+        {
+            printf("Exchange %zu failed\n", i);
+            failed++;
+            co_return;
+        }
+    }
+    steadyAllocations = allocations - steadyAllocations;
+}
+
+/**
+ * @brief Move the bytes of one pipe to the receiving channel in random pieces and tell the sender that there is space again
+ */
+static bool Transfer(Pipe &pipe, Channel &receiver, Channel &sender)
+{
+    if (pipe.used == 0)
+        return false;
+    uint8_t bytes[Pipe::Capacity];
+    size_t count = 1 + rand() % pipe.used;
+    std::memcpy(bytes, pipe.data, count);
+    std::memmove(pipe.data, pipe.data + count, pipe.used - count);
+    pipe.used -= count;
+    receiver.Feed(bytes, count);
+    sender.Writable();
+    return true;
+}
+
+using FramePool = smp::detail::FramePool;
+
+static size_t overflowFreed = 0;
+static size_t exitFreed = 0;
+
+/**
+ * @brief Frees a frame in the destructor. Constructed before the frame pool of the thread, so it is destroyed after it.
+ */
+struct ExitFrame
+{
+    void *memory = nullptr;
+
+    ~ExitFrame()
+    {
+        size_t before = deallocations;
+        FramePool::Free(memory, 100);
+        exitFreed = deallocations - before;
+    }
+};
+
+static void TestFramePool()
+{
+    // On a new thread, so the free lists start empty
+    std::thread thread([]()
+                       {
+                           thread_local ExitFrame exitframe;
+                           exitframe.memory = nullptr;
+                           exitframe.memory = FramePool::Allocate(100);
+
+                           static void *frames[FramePool::MaxBlocksPerClass + 10];
+                           for (auto &frame : frames)
+                           {
+                               frame = FramePool::Allocate(100);
+                           }
+                           size_t before = deallocations;
+                           for (auto &frame : frames)
+                           {
+                               FramePool::Free(frame, 100);
+                           }
+                           overflowFreed = deallocations - before; });
+    thread.join();
+    if (overflowFreed != 10)
+    {
+        printf("%zu frames above the limit of the free list were freed, expected 10\n", overflowFreed);
+        failed++;
+    }
+    if (exitFreed != 1)
+    {
+        printf("Frame freed after the pool was destroyed wasn't returned to the global allocator\n");
+        failed++;
+    }
+}
+
+int main()
+{
+    srand(24);
+    const size_t exchanges = 2000;
+    auto deviceTask = Device();
+    auto hostTask = Host(exchanges);
+    deviceTask.Start();
+    hostTask.Start();
+    while (!hostTask.Done())
+    {
+        bool moved = Transfer(toDevice, device, host);
+        moved = Transfer(toHost, host, device) || moved;
+        if (!moved)
+        {
+            printf("Deadlock, no data in flight\n");
+            failed++;
+            break;
+        }
+    }
+    if (steadyAllocations != 0)
+    {
+        printf("%zu allocations after the first exchanges\n", steadyAllocations);
+        failed++;
+    }
+
+    // Frames without a waiting receiver are dropped, closing resumes the waiting device with std::nullopt
+    uint8_t unsolicited[] = {1, 2, 3};
+    auto notification = Notify(device, unsolicited, sizeof(unsolicited));
+    notification.Start();
+    if (!notification.Done() || !notification.Result())
+    {
+        printf("Notification not sent\n");
+        failed++;
+    }
+    host.Feed(toHost.data, toHost.used);
+    toHost.used = 0;
+    if (host.DroppedFrames() != 1)
+    {
+        printf("Unsolicited frame not dropped\n");
+        failed++;
+    }
+    device.Close();
+    if (!deviceTask.Done() || deviceTask.Result() != exchanges)
+    {
+        printf("Device answered %zu requests\n", deviceTask.Done() ? deviceTask.Result() : 0);
+        failed++;
+    }
+
+    // After closing, every send fails immediately
+    auto late = Notify(host, unsolicited, sizeof(unsolicited));
+    host.Close();
+    late.Start();
+    if (!late.Done() || late.Result())
+    {
+        printf("Send on a closed channel succeeded\n");
+        failed++;
+    }
+
+    TestFramePool();
+
+    if (failed)
+    {
+        printf("%d checks failed\n", failed);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
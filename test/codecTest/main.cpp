@@ -0,0 +1,157 @@
+#include "libsmp.h"
+#include "libsmp.hpp"
+#include "smpcodec.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+constexpr size_t MaxMessageLength = 600;
+
+// The frames of fixed messages can be generated and decoded at compile time
+constexpr bool ConstexprRoundTrip()
+{
+    const uint8_t payload[] = {0x01, 0xFF, 0x02, 0xFF, 0xFF};
+    uint8_t frame[32] = {};
+    size_t framelength = smp::Encode(payload, sizeof(payload), frame, sizeof(frame));
+    if (framelength != smp::EncodedLength(payload, sizeof(payload)))
+        return false;
+    smp::Decoder<16> decoder;
+    bool valid = false;
+    for (size_t i = 0; i < framelength; i++)
+    {
+        valid = decoder.Push(frame[i]);
+    }
+    if (!valid || decoder.Size() != sizeof(payload))
+        return false;
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        if (decoder.Data()[i] != payload[i])
+            return false;
+    }
+    return true;
+}
+
+static_assert(ConstexprRoundTrip(), "Compile time round trip failed");
+
+constexpr auto &StaticFrame = smp::MakeFrame<0x01, 0xFF, 0x02>();
+static_assert(StaticFrame.size() == 9 && StaticFrame[0] == 0xFF && StaticFrame[4] == 0xFF && StaticFrame[5] == 0xFF,
+              "The static frame has to hold the stuffed payload");
+
+struct Frames
+{
+    std::vector<std::vector<uint8_t>> frames;
+    void Add(const uint8_t *data, size_t length)
+    {
+        frames.emplace_back(data, data + length);
+    }
+};
+
+static void CHandler(void *context, const uint8_t *data, uint32_t length)
+{
+    static_cast<Frames *>(context)->Add(data, length);
+}
+
+int main()
+{
+    int failed = 0;
+    const char *check = "123456789";
+    if (smp::CRC16(0, reinterpret_cast<const uint8_t *>(check), 9) != 0xBB3D)
+    {
+        printf("CRC check value missmatch\n");
+        failed++;
+    }
+
+    const uint8_t staticpayload[] = {0x01, 0xFF, 0x02};
+    uint8_t staticframe[16];
+    if (SMP_Encode(staticpayload, sizeof(staticpayload), staticframe, sizeof(staticframe)) != StaticFrame.size() ||
+        memcmp(staticframe, StaticFrame.data(), StaticFrame.size()) != 0)
+    {
+        printf("Static frame missmatch\n");
+        failed++;
+    }
+
+    // A const callback gets the static frame itself, a callback with a writable pointer a copy that it may change
+    SMP<16> smp;
+    const uint8_t *sentframe = nullptr;
+    size_t sent = smp.TransmitFrame([&sentframe](const uint8_t *data, size_t length)
+                                    {
+                                        sentframe = data;
+                                        return length; },
+                                    StaticFrame);
+    if (sent != StaticFrame.size() || sentframe != StaticFrame.data())
+    {
+        printf("TransmitFrame didn't pass the static frame to the const callback\n");
+        failed++;
+    }
+    std::vector<uint8_t> written;
+    sent = smp.TransmitFrame([&written](uint8_t *data, size_t length)
+                             {
+                                 written.assign(data, data + length);
+                                 data[0] = 0;
+                                 return length; },
+                             StaticFrame);
+    if (sent != StaticFrame.size() || written != std::vector<uint8_t>(StaticFrame.begin(), StaticFrame.end()) || StaticFrame[0] != 0xFF)
+    {
+        printf("TransmitFrame didn't pass a copy to the writable callback\n");
+        failed++;
+    }
+
+    // The encoder has to produce the same frames as the C library
+    std::vector<uint8_t> payload(MaxMessageLength + 50);
+    std::vector<uint8_t> cframe(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    std::vector<uint8_t> cppframe(cframe.size());
+    std::vector<uint8_t> stream;
+    for (int run = 0; run < 2000; run++)
+    {
+        size_t length = 1 + rand() % payload.size();
+        int density = rand() % 4;
+        for (size_t i = 0; i < length; i++)
+        {
+            payload[i] = (density == 0 || rand() % (density * 8) == 0) ? 0xFF : rand() & 0xFF;
+        }
+        size_t clength = SMP_Encode(payload.data(), length, cframe.data(), cframe.size());
+        size_t cpplength = smp::Encode(payload.data(), length, cppframe.data(), cppframe.size());
+        if (clength != cpplength || memcmp(cframe.data(), cppframe.data(), clength) != 0 ||
+            cpplength != smp::EncodedLength(payload.data(), length))
+        {
+            printf("Encoder missmatch for payload length %zu\n", length);
+            failed++;
+        }
+        stream.insert(stream.end(), cppframe.begin(), cppframe.begin() + cpplength);
+        // Noise and corrupted bytes between and inside the frames
+        if (rand() % 4 == 0)
+        {
+            stream.push_back(rand() % 2 ? 0xFF : rand() & 0xFF);
+        }
+        if (rand() % 8 == 0)
+        {
+            stream[stream.size() - 1 - rand() % cpplength] ^= 1 << (rand() % 8);
+        }
+    }
+
+    // The decoder has to accept the same frames as the C library for every split of the stream
+    for (size_t chunk : {size_t(1), size_t(7), size_t(64), size_t(4096), stream.size()})
+    {
+        Frames cframes;
+        Frames cppframes;
+        smp_struct_t st;
+        SMP_Init(&st);
+        std::vector<uint8_t> framebuffer(MaxMessageLength);
+        smp::Decoder<MaxMessageLength> decoder;
+        for (size_t offset = 0; offset < stream.size(); offset += chunk)
+        {
+            size_t length = std::min(chunk, stream.size() - offset);
+            SMP_ReceiveBuffer(&st, stream.data() + offset, length, framebuffer.data(), framebuffer.size(), &CHandler, &cframes);
+            decoder.Receive([&](const uint8_t *data, size_t length)
+                            { cppframes.Add(data, length); },
+                            stream.data() + offset, length);
+        }
+        if (cframes.frames != cppframes.frames || cframes.frames.empty())
+        {
+            printf("Decoder missmatch with chunks of %zu bytes: %zu frames expected, got %zu\n", chunk, cframes.frames.size(), cppframes.frames.size());
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
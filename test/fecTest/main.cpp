@@ -0,0 +1,300 @@
+#include "smpfec.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Reed solomon codewords with errors and erasures up to the correction capability, the interleaved (vector) parity and syndromes
+// against the single codeword functions, and fec frames with bursts, bit errors and noise between the frames.
+
+static const size_t MaxPayload = 1000;
+static const uint8_t Depth = 4;
+static int failed = 0;
+
+static void Check(bool condition, const char *message)
+{
+    if (!condition)
+    {
+        printf("%s\n", message);
+        failed++;
+    }
+}
+
+static std::vector<uint8_t> RandomBytes(size_t length)
+{
+    std::vector<uint8_t> data(length);
+    for (auto &b : data)
+    {
+        b = rand() % 8 == 0 ? 0xFF : rand() & 0xFF;
+    }
+    return data;
+}
+
+static void TestCodewords(ecc_t &ecc)
+{
+    for (int trial = 0; trial < 3000; trial++)
+    {
+        size_t length = NPAR + 1 + rand() % (FEC_BLOCKSIZE - NPAR);
+        std::vector<uint8_t> codeword = RandomBytes(length);
+        encode_calcParity(codeword.data(), length - NPAR, codeword.data() + length - NPAR, &ecc);
+        decode_data(codeword.data(), length, &ecc);
+        if (check_syndrome(&ecc))
+        {
+            Check(false, "Syndromes of a valid codeword");
+            continue;
+        }
+
+        // Distinct positions, the first ones are erased
+        int erasurecount = rand() % (NPAR + 1);
+        int errorcount = rand() % ((NPAR - erasurecount) / 2 + 1);
+        if (static_cast<size_t>(erasurecount + errorcount) > length)
+            continue;
+        std::vector<int> positions(length);
+        for (size_t i = 0; i < length; i++)
+        {
+            positions[i] = static_cast<int>(i);
+        }
+        for (int i = 0; i < erasurecount + errorcount; i++)
+        {
+            std::swap(positions[i], positions[i + rand() % (length - i)]);
+        }
+        std::vector<uint8_t> received = codeword;
+        for (int i = 0; i < erasurecount + errorcount; i++)
+        {
+            received[positions[i]] ^= i < erasurecount ? rand() & 0xFF : 1 + rand() % 255;
+        }
+        decode_data(received.data(), length, &ecc);
+        bool corrected = correct_errors_erasures(received.data(), length, erasurecount, positions.data(), &ecc);
+        if (!corrected || received != codeword)
+        {
+            printf("Codeword of %zu bytes with %d errors and %d erasures not corrected\n", length, errorcount, erasurecount);
+            failed++;
+        }
+    }
+}
+
+static void TestInterleaved(ecc_t &ecc)
+{
+    for (size_t depth : {1, 3, 16, 17, 31, 32, 33, 40, 100, 255})
+    {
+        size_t length = depth * (1 + rand() % FEC_BLOCK_DATA_LENGTH) - rand() % depth;
+        std::vector<uint8_t> data = RandomBytes(length);
+        std::vector<uint8_t> parity(NPAR * depth);
+        FEC_InterleavedParity(data.data(), length, depth, parity.data(), &ecc);
+        size_t rows = (length + depth - 1) / depth;
+
+        // Corrupt some of the codewords
+        for (size_t i = 0; i < depth / 2 + 1; i++)
+        {
+            data[rand() % length] ^= 0x10;
+        }
+
+        uint8_t syndromes[FEC_SYNDROME_LANES * NPAR];
+        for (size_t lane = 0; lane < depth;)
+        {
+            size_t count = FEC_InterleavedSyndromes(data.data(), length, parity.data(), depth, lane, syndromes, &ecc);
+            for (size_t l = 0; l < count; l++)
+            {
+                std::vector<uint8_t> codeword;
+                for (size_t r = 0; r < rows; r++)
+                {
+                    size_t offset = r * depth + lane + l;
+                    codeword.push_back(offset < length ? data[offset] : 0);
+                }
+                uint8_t expectedParity[NPAR];
+                encode_calcParity(codeword.data(), rows, expectedParity, &ecc);
+                for (size_t j = 0; j < NPAR; j++)
+                {
+                    codeword.push_back(parity[j * depth + lane + l]);
+                }
+                decode_data(codeword.data(), codeword.size(), &ecc);
+                if (memcmp(ecc.syndromes, syndromes + l * NPAR, NPAR) != 0)
+                {
+                    printf("Syndromes of codeword %zu of %zu differ\n", lane + l, depth);
+                    failed++;
+                }
+                // The corrupted data changes the parity of the single codeword function, so compare on the original only when it's clean
+                if (!check_syndrome(&ecc) && memcmp(expectedParity, codeword.data() + rows, NPAR) != 0)
+                {
+                    printf("Parity of codeword %zu of %zu differs\n", lane + l, depth);
+                    failed++;
+                }
+            }
+            lane += count;
+        }
+    }
+}
+
+/**
+ * @brief Flip random bits with the probability rate
+ */
+static void AddBitErrors(std::vector<uint8_t> &data, size_t start, double rate)
+{
+    for (size_t i = start; i < data.size(); i++)
+    {
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (rand() < rate * RAND_MAX)
+            {
+                data[i] ^= 1 << bit;
+            }
+        }
+    }
+}
+
+static void TestFrames()
+{
+    static SMPFec<MaxPayload, Depth> sender;
+    static SMPFec<MaxPayload, Depth> receiver;
+    std::vector<std::vector<uint8_t>> sent;
+    std::vector<std::vector<uint8_t>> received;
+    std::vector<uint8_t> stream;
+    const size_t framecount = 1500;
+    for (size_t i = 0; i < framecount; i++)
+    {
+        size_t length = rand() % 4 == 0 ? rand() % (MaxPayload + 1) : rand() % 64;
+        sent.push_back(RandomBytes(length));
+        std::vector<uint8_t> frame;
+        sender.Transmit([&frame](uint8_t *data, size_t length)
+                        { frame.assign(data, data + length);
+                          return length; },
+                        sent.back().data(), length);
+        size_t body = FEC_SYNC_LENGTH + FEC_HEADER_LENGTH;
+        switch (i % 4)
+        {
+        case 0:
+        {
+            // Burst over the data and the parity, within the capability of the interleaving
+            size_t burst = 1 + rand() % (Depth * NPAR / 2);
+            size_t start = body + rand() % (frame.size() - body - burst + 1);
+            for (size_t b = start; b < start + burst; b++)
+            {
+                frame[b] ^= 1 + rand() % 255;
+            }
+            break;
+        }
+        case 1:
+            // Bit errors in the sync word and wrong bytes in the header
+            frame[rand() % FEC_SYNC_LENGTH] ^= 1 << (rand() % 8);
+            frame[rand() % FEC_SYNC_LENGTH] ^= 1 << (rand() % 8);
+            for (int e = 0; e < NPAR / 2; e++)
+            {
+                frame[FEC_SYNC_LENGTH + e * 2] ^= 0x81;
+            }
+            break;
+        case 2:
+            AddBitErrors(frame, 0, 0.001);
+            break;
+        }
+        stream.insert(stream.end(), frame.begin(), frame.end());
+        std::vector<uint8_t> noise = RandomBytes(rand() % 16);
+        stream.insert(stream.end(), noise.begin(), noise.end());
+    }
+
+    size_t offset = 0;
+    while (offset < stream.size())
+    {
+        size_t chunk = std::min(stream.size() - offset, static_cast<size_t>(1 + rand() % 700));
+        receiver.Receive([&received](const uint8_t *data, size_t length)
+                         { received.emplace_back(data, data + length); },
+                         stream.data() + offset, chunk);
+        offset += chunk;
+    }
+
+    // Only the random bit errors may exceed the capability, the frames must arrive in order and without errors
+    const libfecmp_stats_t &stats = receiver.Statistics();
+    size_t next = 0;
+    for (const auto &frame : received)
+    {
+        while (next < sent.size() && sent[next] != frame)
+        {
+            if (next % 4 != 2)
+            {
+                printf("Frame %zu lost\n", next);
+                failed++;
+            }
+            next++;
+        }
+        if (next == sent.size())
+        {
+            Check(false, "Received frame that wasn't sent");
+            break;
+        }
+        next++;
+    }
+    Check(received.size() > framecount * 99 / 100, "Less than 99% of the frames received");
+    Check(stats.framesReceived == received.size(), "Frame count of the statistics");
+    Check(stats.framesCorrected >= framecount / 4, "Corrections not counted");
+    printf("%zu of %zu frames received, %llu corrected with %llu bytes, %llu failed codewords, %llu lost frames, %llu failed headers\n",
+           received.size(), framecount, static_cast<unsigned long long>(stats.framesCorrected),
+           static_cast<unsigned long long>(stats.bytesCorrected), static_cast<unsigned long long>(stats.blocksFailed),
+           static_cast<unsigned long long>(stats.framesLost), static_cast<unsigned long long>(stats.headersFailed));
+}
+
+static void CountFrame(void *context, const uint8_t *data, uint32_t length)
+{
+    (void)data;
+    (void)length;
+    (*static_cast<int *>(context))++;
+}
+
+static void TestCInterface()
+{
+    // A frame longer than the receive buffer is dropped after the header, the next one is received
+    static uint8_t buffer[FEC_RECEIVE_BUFFER_LENGTH(100, 1)];
+    int frames = 0;
+    libfecmp_settings_t settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.data = buffer;
+    settings.bufferlength = sizeof(buffer);
+    settings.frameHandler = CountFrame;
+    settings.context = &frames;
+    libfecmp_t fec;
+    Check(fec_Init(&fec, &settings), "fec_Init failed");
+
+    std::vector<uint8_t> stream;
+    for (size_t length : {300, 100})
+    {
+        std::vector<uint8_t> payload = RandomBytes(length);
+        std::vector<uint8_t> frame(FEC_SEND_BUFFER_LENGTH(length, 1));
+        size_t framelength = fec_encode(payload.data(), length, frame.data(), frame.size(), &fec);
+        Check(framelength == fec_encodedLength(payload.data(), length, &fec), "fec_encodedLength differs from the frame");
+        Check(fec_encode(payload.data(), length, frame.data(), framelength - 1, &fec) == 0, "Frame encoded into a short buffer");
+        stream.insert(stream.end(), frame.begin(), frame.begin() + framelength);
+    }
+    Check(fec_processBytes(stream.data(), stream.size(), &fec) == 1 && frames == 1, "Frame after the dropped frame not received");
+    Check(fec.stats.headersFailed == 1, "Dropped frame not counted");
+}
+
+int main()
+{
+#if defined(__GNUC__) && defined(__AVX2__) && (defined(__x86_64__) || defined(__i386__))
+    if (!__builtin_cpu_supports("avx2"))
+    {
+        printf("AVX2 not supported, skipped\n");
+        return 77;
+    }
+#elif defined(__GNUC__) && defined(__SSSE3__) && (defined(__x86_64__) || defined(__i386__))
+    if (!__builtin_cpu_supports("ssse3"))
+    {
+        printf("SSSE3 not supported, skipped\n");
+        return 77;
+    }
+#endif
+    srand(25);
+    ecc_t ecc;
+    initialize_ecc(&ecc);
+    TestCodewords(ecc);
+    TestInterleaved(ecc);
+    TestFrames();
+    TestCInterface();
+
+    if (failed)
+    {
+        printf("%d checks failed\n", failed);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include "libsmp.hpp"
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <vector>
 
 std::array<uint32_t, 10> test;
 uint8_t received[sizeof(decltype(test)::value_type) * test.size()];
@@ -22,6 +25,49 @@ size_t Receive(const void* buffer, size_t length)
     return length;
 }
 
+/**
+ * Every instance keeps its own receive state: a frame split over two Receive calls must not be disturbed by
+ * another instance that decodes a frame in between.
+ */
+static bool TestSplitFrames()
+{
+    SMP<300> first;
+    SMP<300> second;
+    std::vector<uint8_t> payloads[2];
+    std::vector<uint8_t> frames[2];
+    for (int i = 0; i < 2; i++)
+    {
+        payloads[i].resize(200 + i * 50);
+        for (auto &b : payloads[i])
+        {
+            b = rand() % 8 == 0 ? 0xFF : rand() & 0xFF;
+        }
+        frames[i].resize(SMP_SEND_BUFFER_LENGTH(payloads[i].size()));
+        frames[i].resize(SMP_Encode(payloads[i].data(), payloads[i].size(), frames[i].data(), frames[i].size()));
+    }
+
+    for (size_t split = 1; split < frames[0].size(); split++)
+    {
+        std::vector<std::vector<uint8_t>> firstFrames;
+        std::vector<std::vector<uint8_t>> secondFrames;
+        auto firstCallback = [&firstFrames](const uint8_t *data, size_t length)
+        { firstFrames.emplace_back(data, data + length); };
+        auto secondCallback = [&secondFrames](const uint8_t *data, size_t length)
+        { secondFrames.emplace_back(data, data + length); };
+
+        // Both the contiguous and the element wise path, which collects the bytes in its own chunks
+        std::deque<uint8_t> head(frames[0].begin(), frames[0].begin() + split);
+        std::deque<uint8_t> other(frames[1].begin(), frames[1].end());
+        first.Receive(firstCallback, head.begin(), head.end());
+        second.Receive(secondCallback, other.begin(), other.end());
+        first.Receive(firstCallback, frames[0].data() + split, frames[0].size() - split);
+
+        if (firstFrames.size() != 1 || firstFrames[0] != payloads[0] || secondFrames.size() != 1 || secondFrames[0] != payloads[1])
+            return false;
+    }
+    return true;
+}
+
 int main()
 {
     for(auto& b : test)
@@ -32,5 +78,7 @@ int main()
     smp.Transmit(callback, test.begin(), test.end());
     decltype(test) testrecv;
     memcpy(testrecv.data(), received, sizeof(received));
-    return 0;
+    if (!(testrecv == test))
+        return 1;
+    return TestSplitFrames() ? 0 : 1;
 }
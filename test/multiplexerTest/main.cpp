@@ -0,0 +1,183 @@
+#include "smpmultiplexer.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+// Interleaved chunks of several channels, Drain with a fake read function and Reset of a single channel
+
+constexpr size_t MaxPayload = 500;
+constexpr size_t ChannelCount = 4;
+
+static int failed = 0;
+
+static void Check(bool condition, const char *message)
+{
+    if (!condition)
+    {
+        printf("%s\n", message);
+        failed++;
+    }
+}
+
+struct Channel
+{
+    std::vector<uint8_t> stream;
+    std::vector<std::vector<uint8_t>> sent;
+    std::vector<std::vector<uint8_t>> received;
+};
+
+static void AddFrame(Channel &channel, size_t length, bool framestarts = true)
+{
+    std::vector<uint8_t> payload(length);
+    for (auto &b : payload)
+    {
+        b = framestarts ? (rand() % 8 == 0 ? 0xFF : rand() & 0xFF) : rand() % 0xFF;
+    }
+    std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(length));
+    frame.resize(SMP_Encode(payload.data(), length, frame.data(), frame.size()));
+    channel.stream.insert(channel.stream.end(), frame.begin(), frame.end());
+    channel.sent.push_back(std::move(payload));
+}
+
+static void TestInterleaved()
+{
+    SMPMultiplexer<MaxPayload> multiplexer(ChannelCount);
+    Check(multiplexer.ChannelCount() == ChannelCount, "Wrong channel count");
+    std::vector<Channel> channels(ChannelCount);
+    for (auto &channel : channels)
+    {
+        for (int i = 0; i < 200; i++)
+        {
+            AddFrame(channel, 1 + rand() % MaxPayload);
+        }
+    }
+    auto callback = [&channels](size_t channel, const uint8_t *data, size_t length)
+    { channels[channel].received.emplace_back(data, data + length); };
+
+    // Random chunks of random channels, so the frames of all channels are split across many calls
+    std::vector<size_t> offsets(ChannelCount, 0);
+    size_t remaining = ChannelCount;
+    while (remaining > 0)
+    {
+        size_t c = rand() % ChannelCount;
+        Channel &channel = channels[c];
+        if (offsets[c] == channel.stream.size())
+            continue;
+        size_t chunk = std::min(channel.stream.size() - offsets[c], static_cast<size_t>(1 + rand() % 300));
+        multiplexer.Receive(c, callback, channel.stream.data() + offsets[c], chunk);
+        offsets[c] += chunk;
+        if (offsets[c] == channel.stream.size())
+            remaining--;
+    }
+    for (const auto &channel : channels)
+    {
+        Check(channel.received == channel.sent, "Frames of a channel differ");
+    }
+}
+
+/**
+ * @brief Fake read function that returns the scripted results, a positive result copies that many bytes of the stream.
+ * After the last result it reports that no data is available.
+ */
+struct FakeRead
+{
+    const std::vector<uint8_t> &stream;
+    std::deque<ptrdiff_t> results;
+    size_t offset = 0;
+    size_t calls = 0;
+
+    ptrdiff_t operator()(uint8_t *buffer, size_t length)
+    {
+        calls++;
+        if (results.empty())
+            return -1;
+        ptrdiff_t result = results.front();
+        results.pop_front();
+        if (result > 0)
+        {
+            result = std::min<ptrdiff_t>({result, static_cast<ptrdiff_t>(length), static_cast<ptrdiff_t>(stream.size() - offset)});
+            memcpy(buffer, stream.data() + offset, static_cast<size_t>(result));
+            offset += static_cast<size_t>(result);
+        }
+        return result;
+    }
+};
+
+static void TestDrain()
+{
+    using Multiplexer = SMPMultiplexer<MaxPayload>;
+    Multiplexer multiplexer(2);
+    Channel channel;
+    while (channel.stream.size() < 4 * Multiplexer::ReadChunkLength)
+    {
+        AddFrame(channel, 1 + rand() % MaxPayload);
+    }
+    auto callback = [&channel](size_t index, const uint8_t *data, size_t length)
+    {
+        Check(index == 1, "Frame on the wrong channel");
+        channel.received.emplace_back(data, data + length);
+    };
+
+    // Full reads continue, the short read stops the drain
+    const ptrdiff_t full = static_cast<ptrdiff_t>(Multiplexer::ReadChunkLength);
+    FakeRead read{channel.stream, {full, full, 100, full}};
+    Check(multiplexer.Drain(1, read, callback) == 2 * full + 100 && read.calls == 3, "Drain didn't stop at the short read");
+
+    // No data available (negative result) returns the bytes that were read before
+    read.results = {full, -1};
+    read.calls = 0;
+    Check(multiplexer.Drain(1, read, callback) == full && read.calls == 2, "Drain didn't stop when no data was available");
+
+    // The rest of the stream and the end of the stream, an empty result list reports no data available
+    while (read.offset < channel.stream.size())
+    {
+        read.results = {full};
+        multiplexer.Drain(1, read, callback);
+    }
+    read.results = {0};
+    Check(multiplexer.Drain(1, read, callback) == -1, "End of the stream not reported");
+    Check(read.offset == channel.stream.size() && channel.received == channel.sent, "Drained frames differ");
+}
+
+static void TestReset()
+{
+    SMPMultiplexer<MaxPayload> multiplexer(2);
+    std::vector<Channel> channels(2);
+    for (auto &channel : channels)
+    {
+        // Without framestarts in the first frame its second half can't start a frame
+        AddFrame(channel, 100, false);
+        AddFrame(channel, 200);
+    }
+    auto callback = [&channels](size_t channel, const uint8_t *data, size_t length)
+    { channels[channel].received.emplace_back(data, data + length); };
+
+    // Half of the first frame on both channels, reset channel 0 and continue both
+    size_t half = SMP_EncodedLength(channels[0].sent[0].data(), channels[0].sent[0].size()) / 2;
+    multiplexer.Receive(0, callback, channels[0].stream.data(), half);
+    multiplexer.Receive(1, callback, channels[1].stream.data(), half);
+    multiplexer.Reset(0);
+    multiplexer.Receive(0, callback, channels[0].stream.data() + half, channels[0].stream.size() - half);
+    multiplexer.Receive(1, callback, channels[1].stream.data() + half, channels[1].stream.size() - half);
+
+    Check(channels[0].received.size() == 1 && channels[0].received[0] == channels[0].sent[1], "Reset channel received the dropped frame");
+    Check(channels[1].received == channels[1].sent, "Reset changed another channel");
+}
+
+int main()
+{
+    srand(10);
+    TestInterleaved();
+    TestDrain();
+    TestReset();
+
+    if (failed)
+    {
+        printf("%d checks failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
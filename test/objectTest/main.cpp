@@ -0,0 +1,160 @@
+#include "libsmp.h"
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+// The decoder objects have to deliver the same frames as SMP_ReceiveBuffer, with and without a batch buffer and for any split of the stream
+
+static const uint32_t MaxPayload = 300;
+static std::vector<std::vector<uint8_t>> received;
+static size_t batches = 0;
+
+static signed char FrameReady(uint8_t *data, uint32_t length)
+{
+    received.emplace_back(data, data + length);
+    return 0;
+}
+
+static void BatchReady(void *context, const uint8_t *buffer, const smp_frame_info_t *frames, uint32_t count)
+{
+    uint32_t maxframes = *static_cast<uint32_t *>(context);
+    if (count == 0 || count > maxframes)
+    {
+        printf("Batch with %u frames\n", count);
+    }
+    batches++;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        received.emplace_back(buffer + frames[i].offset, buffer + frames[i].offset + frames[i].length);
+    }
+}
+
+static void ExpectedFrame(void *context, const uint8_t *data, uint32_t length)
+{
+    static_cast<std::vector<std::vector<uint8_t>> *>(context)->emplace_back(data, data + length);
+}
+
+int main()
+{
+    int failed = 0;
+    srand(21);
+    std::vector<uint8_t> stream;
+    for (size_t i = 0; i < 3000; i++)
+    {
+        // Short and long frames with framestarts in the payload, some of them corrupted, and noise between them
+        size_t length = rand() % 4 == 0 ? rand() % (MaxPayload + 1) : rand() % 16;
+        std::vector<uint8_t> payload(length);
+        for (auto &b : payload)
+        {
+            b = rand() % 8 == 0 ? 0xFF : rand() & 0xFF;
+        }
+        std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(length));
+        frame.resize(SMP_Encode(payload.data(), length, frame.data(), frame.size()));
+        if (i % 13 == 5 && frame.size() > 4)
+        {
+            frame[frame.size() - 1] ^= 0x01;
+        }
+        stream.insert(stream.end(), frame.begin(), frame.end());
+        if (i % 7 == 3)
+        {
+            stream.push_back(rand() & 0x7F);
+        }
+    }
+
+    std::vector<std::vector<uint8_t>> expected;
+    smp_struct_t st;
+    SMP_Init(&st);
+    std::vector<uint8_t> framebuffer(MaxPayload);
+    SMP_ReceiveBuffer(&st, stream.data(), stream.size(), framebuffer.data(), framebuffer.size(), &ExpectedFrame, &expected);
+
+    smp_object_t *object = SMP_BuildObject(MaxPayload, &FrameReady, nullptr);
+    if (!object)
+    {
+        printf("Object not created\n");
+        return 1;
+    }
+
+    // Frame ready callback
+    received.clear();
+    for (size_t offset = 0; offset < stream.size();)
+    {
+        size_t length = std::min<size_t>(1 + rand() % 600, stream.size() - offset);
+        SMP_ReceiveBytes(object, stream.data() + offset, length);
+        offset += length;
+    }
+    if (received != expected)
+    {
+        printf("Callback: %zu frames received, %zu expected\n", received.size(), expected.size());
+        failed++;
+    }
+
+    std::vector<uint8_t> batch(MaxPayload);
+    std::vector<smp_frame_info_t> frames(4);
+    uint32_t maxframes = 4;
+    if (SMP_SetBatchBuffer(object, batch.data(), MaxPayload - 1, frames.data(), maxframes, &BatchReady, &maxframes))
+    {
+        printf("Batch buffer shorter than a frame accepted\n");
+        failed++;
+    }
+
+    // Batch buffers from a single frame up to many frames, the whole stream or random splits
+    const size_t batchlengths[] = {MaxPayload, MaxPayload + 17, 2 * MaxPayload, 16 * MaxPayload};
+    const uint32_t framecounts[] = {1, 3, 64};
+    for (size_t batchlength : batchlengths)
+    {
+        for (uint32_t count : framecounts)
+        {
+            for (int split = 0; split < 2; split++)
+            {
+                batch.assign(batchlength, 0);
+                frames.assign(count, smp_frame_info_t{});
+                maxframes = count;
+                if (!SMP_SetBatchBuffer(object, batch.data(), batch.size(), frames.data(), maxframes, &BatchReady, &maxframes))
+                {
+                    printf("Batch buffer of %zu bytes rejected\n", batchlength);
+                    failed++;
+                    continue;
+                }
+                received.clear();
+                batches = 0;
+                uint32_t total = 0;
+                for (size_t offset = 0; offset < stream.size();)
+                {
+                    size_t length = split ? std::min<size_t>(1 + rand() % 600, stream.size() - offset) : stream.size();
+                    total += SMP_ReceiveBytes(object, stream.data() + offset, length);
+                    offset += length;
+                }
+                if (received != expected || total != expected.size())
+                {
+                    printf("Batch %zu bytes, %u frames, split %d: %zu frames received, %zu expected\n", batchlength, count, split, received.size(), expected.size());
+                    failed++;
+                }
+                if (count == 64 && batchlength == 16 * MaxPayload && split == 0 && batches * 8 > expected.size())
+                {
+                    printf("Frames not batched: %zu batches for %zu frames\n", batches, expected.size());
+                    failed++;
+                }
+            }
+        }
+    }
+
+    // Back to the frame ready callback
+    SMP_SetBatchBuffer(object, nullptr, 0, nullptr, 0, nullptr, nullptr);
+    received.clear();
+    SMP_ReceiveBytes(object, stream.data(), stream.size());
+    if (received != expected)
+    {
+        printf("Callback after batch: %zu frames received, %zu expected\n", received.size(), expected.size());
+        failed++;
+    }
+    SMP_DestroyObject(object);
+
+    if (failed)
+    {
+        printf("%d checks failed\n", failed);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "libsmp.h"
+#include "smpoffline.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// The chunked decoder has to find the same frames as SMP_ReceiveBuffer for every chunk length
+
+constexpr size_t MaxMessageLength = 600;
+constexpr size_t FrameCount = 3000;
+
+struct Frame
+{
+    uint64_t offset;
+    std::vector<uint8_t> payload;
+
+    bool operator==(const Frame &other) const
+    {
+        return offset == other.offset && payload == other.payload;
+    }
+};
+
+static std::vector<uint8_t> CreateStream()
+{
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> payload(MaxMessageLength + 50);
+    std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    srand(3);
+    for (size_t i = 0; i < FrameCount; i++)
+    {
+        // Include the lengths with the low byte 0xFF in the length field and empty frames, which SMP_ReceiveBuffer drops
+        size_t length = rand() % 8 == 0 ? 253 + 256 * (rand() % 2) : rand() % 20 == 0 ? 0 : 1 + rand() % payload.size();
+        int density = rand() % 4;
+        for (size_t j = 0; j < length; j++)
+        {
+            payload[j] = (density == 0 || rand() % (density * 8) == 0) ? 0xFF : rand() & 0xFF;
+        }
+        size_t framelength = SMP_Encode(payload.data(), length, frame.data(), frame.size());
+        stream.insert(stream.end(), frame.begin(), frame.begin() + framelength);
+        for (int noise = rand() % 4 == 0 ? rand() % 5 : 0; noise > 0; noise--)
+        {
+            stream.push_back(rand() % 2 ? 0xFF : rand() & 0xFF);
+        }
+        if (rand() % 8 == 0)
+        {
+            stream[stream.size() - 1 - rand() % framelength] ^= 1 << (rand() % 8);
+        }
+    }
+    return stream;
+}
+
+static void CHandler(void *context, const uint8_t *data, uint32_t length)
+{
+    static_cast<std::vector<std::vector<uint8_t>> *>(context)->emplace_back(data, data + length);
+}
+
+static std::vector<Frame> Decode(const std::vector<uint8_t> &stream, size_t threads, size_t chunklength)
+{
+    std::vector<Frame> frames;
+    SMPOfflineDecoder<MaxMessageLength> decoder(threads, chunklength);
+    decoder.Decode(stream.data(), stream.size(), [&frames](uint64_t offset, const uint8_t *data, size_t length)
+                   { frames.push_back(Frame{offset, std::vector<uint8_t>(data, data + length)}); });
+    return frames;
+}
+
+int main()
+{
+    int failed = 0;
+    auto stream = CreateStream();
+
+    std::vector<std::vector<uint8_t>> expected;
+    smp_struct_t st;
+    SMP_Init(&st);
+    std::vector<uint8_t> framebuffer(MaxMessageLength);
+    SMP_ReceiveBuffer(&st, stream.data(), stream.size(), framebuffer.data(), framebuffer.size(), &CHandler, &expected);
+
+    auto reference = Decode(stream, 1, stream.size());
+    bool match = reference.size() == expected.size();
+    for (size_t i = 0; match && i < reference.size(); i++)
+    {
+        match = reference[i].payload == expected[i] && stream[reference[i].offset] == 0xFF;
+    }
+    if (!match)
+    {
+        printf("Single chunk: %zu frames expected, got %zu\n", expected.size(), reference.size());
+        failed++;
+    }
+
+    for (size_t chunklength : {size_t(1), size_t(2), size_t(3), size_t(61), size_t(256), size_t(4096)})
+    {
+        auto frames = Decode(stream, 4, chunklength);
+        if (!(frames == reference))
+        {
+            printf("Chunks of %zu bytes: %zu frames expected, got %zu\n", chunklength, reference.size(), frames.size());
+            failed++;
+        }
+    }
+
+    // The chunks are joined while the others are scanned, only twice the number of threads chunks are in flight
+    for (size_t threads : {size_t(1), size_t(2), size_t(3), size_t(8)})
+    {
+        auto frames = Decode(stream, threads, 61);
+        if (!(frames == reference))
+        {
+            printf("%zu threads: %zu frames expected, got %zu\n", threads, reference.size(), frames.size());
+            failed++;
+        }
+    }
+
+#ifdef SMP_OFFLINE_HAS_MMAP
+    char path[] = "/tmp/smpofflineXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, stream.data(), stream.size()) != static_cast<ssize_t>(stream.size()))
+    {
+        printf("Can't write the capture file\n");
+        failed++;
+    }
+    else
+    {
+        std::vector<Frame> frames;
+        SMPOfflineDecoder<MaxMessageLength> decoder(4, 1000);
+        ptrdiff_t count = decoder.DecodeFile(path, [&frames](uint64_t offset, const uint8_t *data, size_t length)
+                                             { frames.push_back(Frame{offset, std::vector<uint8_t>(data, data + length)}); });
+        if (count != static_cast<ptrdiff_t>(reference.size()) || !(frames == reference))
+        {
+            printf("Memory mapped file: %zu frames expected, got %td\n", reference.size(), count);
+            failed++;
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+        unlink(path);
+    }
+#endif
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+#include "libsmp.h"
+#include "smppipeline.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// The pipeline has to deliver the same frames as SMP_ReceiveBuffer for a noisy stream
+
+constexpr size_t MaxMessageLength = 400;
+constexpr size_t FrameCount = 3000;
+
+using Frames = std::vector<std::vector<uint8_t>>;
+
+static std::vector<uint8_t> CreateStream()
+{
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> payload(MaxMessageLength + 50);
+    std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    srand(2);
+    for (size_t i = 0; i < FrameCount; i++)
+    {
+        // SMP_ReceiveBuffer drops empty frames, so the pipeline has to drop them as well
+        size_t length = rand() % 20 == 0 ? 0 : 1 + rand() % payload.size();
+        for (size_t j = 0; j < length; j++)
+        {
+            payload[j] = rand() % 8 == 0 ? 0xFF : rand() & 0xFF;
+        }
+        size_t framelength = SMP_Encode(payload.data(), length, frame.data(), frame.size());
+        stream.insert(stream.end(), frame.begin(), frame.begin() + framelength);
+        if (rand() % 4 == 0)
+        {
+            stream.push_back(rand() % 2 ? 0xFF : rand() & 0xFF);
+        }
+        if (rand() % 8 == 0)
+        {
+            stream[stream.size() - 1 - rand() % framelength] ^= 1 << (rand() % 8);
+        }
+    }
+    return stream;
+}
+
+static void CHandler(void *context, const uint8_t *data, uint32_t length)
+{
+    static_cast<Frames *>(context)->emplace_back(data, data + length);
+}
+
+int main()
+{
+    int failed = 0;
+    auto stream = CreateStream();
+
+    Frames expected;
+    smp_struct_t st;
+    SMP_Init(&st);
+    std::vector<uint8_t> framebuffer(MaxMessageLength);
+    SMP_ReceiveBuffer(&st, stream.data(), stream.size(), framebuffer.data(), framebuffer.size(), &CHandler, &expected);
+
+    for (size_t chunk : {size_t(1), size_t(13), size_t(4096), stream.size()})
+    {
+        Frames ordered;
+        {
+            SMPPipeline<MaxMessageLength> pipeline([&ordered](const uint8_t *data, size_t length)
+                                                   { ordered.emplace_back(data, data + length); },
+                                                   4, true, 16);
+            for (size_t offset = 0; offset < stream.size(); offset += chunk)
+            {
+                pipeline.Receive(stream.data() + offset, std::min(chunk, stream.size() - offset));
+            }
+            pipeline.Flush();
+            if (pipeline.ValidFrames() != expected.size())
+            {
+                printf("Chunks of %zu bytes: %llu valid frames counted, expected %zu\n", chunk, (unsigned long long)pipeline.ValidFrames(), expected.size());
+                failed++;
+            }
+        }
+        if (ordered != expected)
+        {
+            printf("Chunks of %zu bytes: ordered delivery missmatch, %zu frames expected, got %zu\n", chunk, expected.size(), ordered.size());
+            failed++;
+        }
+    }
+
+    // Without ordered delivery every frame arrives, but in any order
+    Frames unordered;
+    std::mutex mutex;
+    {
+        SMPPipeline<MaxMessageLength> pipeline([&](const uint8_t *data, size_t length)
+                                               {
+                                                   std::lock_guard<std::mutex> lock(mutex);
+                                                   unordered.emplace_back(data, data + length); },
+                                               3, false);
+        pipeline.Receive(stream.data(), stream.size());
+    }
+    Frames sortedExpected = expected;
+    std::sort(sortedExpected.begin(), sortedExpected.end());
+    std::sort(unordered.begin(), unordered.end());
+    if (unordered != sortedExpected)
+    {
+        printf("Unordered delivery missmatch, %zu frames expected, got %zu\n", expected.size(), unordered.size());
+        failed++;
+    }
+    return failed ? 1 : 0;
+}
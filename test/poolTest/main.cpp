@@ -0,0 +1,189 @@
+#include "libsmp.h"
+#include "smpframepool.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The pool receiver has to deliver the same frames as SMP_ReceiveBuffer, also if the frames are kept or released on another thread
+
+constexpr size_t MaxMessageLength = 400;
+constexpr size_t FrameCount = 3000;
+
+using Frames = std::vector<std::vector<uint8_t>>;
+using Pool = SMPFramePool<MaxMessageLength, 8>;
+
+static std::vector<uint8_t> CreateStream()
+{
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> payload(MaxMessageLength + 50);
+    std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    srand(4);
+    for (size_t i = 0; i < FrameCount; i++)
+    {
+        size_t length = 1 + rand() % payload.size();
+        for (size_t j = 0; j < length; j++)
+        {
+            payload[j] = rand() % 8 == 0 ? 0xFF : rand() & 0xFF;
+        }
+        size_t framelength = SMP_Encode(payload.data(), length, frame.data(), frame.size());
+        stream.insert(stream.end(), frame.begin(), frame.begin() + framelength);
+        if (rand() % 4 == 0)
+        {
+            stream.push_back(rand() % 2 ? 0xFF : rand() & 0xFF);
+        }
+        if (rand() % 8 == 0)
+        {
+            stream[stream.size() - 1 - rand() % framelength] ^= 1 << (rand() % 8);
+        }
+    }
+    return stream;
+}
+
+static void CHandler(void *context, const uint8_t *data, uint32_t length)
+{
+    static_cast<Frames *>(context)->emplace_back(data, data + length);
+}
+
+int main()
+{
+    int failed = 0;
+    auto stream = CreateStream();
+
+    Frames expected;
+    smp_struct_t st;
+    SMP_Init(&st);
+    std::vector<uint8_t> framebuffer(MaxMessageLength);
+    SMP_ReceiveBuffer(&st, stream.data(), stream.size(), framebuffer.data(), framebuffer.size(), &CHandler, &expected);
+
+    // Keep the last few frames alive, so the frames are decoded into different slots
+    for (size_t chunk : {size_t(1), size_t(13), size_t(4096)})
+    {
+        auto pool = std::make_unique<Pool>();
+        Frames received;
+        std::deque<Pool::Frame> kept;
+        for (size_t offset = 0; offset < stream.size(); offset += chunk)
+        {
+            pool->Receive([&](Pool::Frame frame)
+                          {
+                              received.emplace_back(frame.begin(), frame.end());
+                              kept.push_back(std::move(frame));
+                              if (kept.size() > 5)
+                                  kept.pop_front(); },
+                          stream.data() + offset, std::min(chunk, stream.size() - offset));
+        }
+        for (size_t i = 0; i < kept.size(); i++)
+        {
+            if (!std::equal(kept[i].begin(), kept[i].end(), expected[expected.size() - kept.size() + i].begin(), expected[expected.size() - kept.size() + i].end()))
+            {
+                printf("Chunks of %zu bytes: kept frame %zu was overwritten\n", chunk, i);
+                failed++;
+            }
+        }
+        if (received != expected || pool->DroppedFrames() != 0)
+        {
+            printf("Chunks of %zu bytes: %zu frames expected, got %zu, %llu dropped\n", chunk, expected.size(), received.size(), (unsigned long long)pool->DroppedFrames());
+            failed++;
+        }
+    }
+
+    // Keep every frame, the pool runs out of slots and drops the frames until the kept frames are released
+    {
+        auto pool = std::make_unique<Pool>();
+        std::vector<Pool::Frame> kept;
+        size_t next = 0;
+        size_t checked = 0;
+        size_t offset = 0;
+        while (offset < stream.size() && next < expected.size())
+        {
+            size_t chunk = std::min<size_t>(200, stream.size() - offset);
+            pool->Receive([&](Pool::Frame frame)
+                          { kept.push_back(frame); },
+                          stream.data() + offset, chunk);
+            offset += chunk;
+            for (; checked < kept.size(); checked++)
+            {
+                auto &frame = kept[checked];
+                while (next < expected.size() && !std::equal(frame.begin(), frame.end(), expected[next].begin(), expected[next].end()))
+                    next++;
+                if (next == expected.size())
+                {
+                    printf("Kept frames: received a frame that is not in the stream\n");
+                    failed++;
+                    break;
+                }
+                next++;
+            }
+            if (kept.size() > 8)
+            {
+                printf("Kept frames: %zu frames in a pool of 8 slots\n", kept.size());
+                failed++;
+            }
+            if (offset > stream.size() / 2)
+            {
+                kept.clear();
+                checked = 0;
+            }
+        }
+        if (pool->DroppedFrames() == 0)
+        {
+            printf("Kept frames: no frame was dropped\n");
+            failed++;
+        }
+    }
+
+    // Release the frames on another thread
+    {
+        auto pool = std::make_unique<Pool>();
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<Pool::Frame> queue;
+        bool done = false;
+        Frames received;
+        std::thread consumer([&]()
+                             {
+                                 std::unique_lock<std::mutex> lock(mutex);
+                                 while (true)
+                                 {
+                                     ready.wait(lock, [&]()
+                                                { return !queue.empty() || done; });
+                                     if (queue.empty())
+                                         return;
+                                     Pool::Frame frame = std::move(queue.front());
+                                     queue.pop_front();
+                                     lock.unlock();
+                                     received.emplace_back(frame.begin(), frame.end());
+                                     frame.Release();
+                                     lock.lock();
+                                 } });
+        for (size_t offset = 0; offset < stream.size(); offset += 512)
+        {
+            pool->Receive([&](Pool::Frame frame)
+                          {
+                              {
+                                  std::lock_guard<std::mutex> lock(mutex);
+                                  queue.push_back(std::move(frame));
+                              }
+                              ready.notify_one(); },
+                          stream.data() + offset, std::min<size_t>(512, stream.size() - offset));
+            std::this_thread::yield();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        ready.notify_one();
+        consumer.join();
+        if (received.size() + pool->DroppedFrames() != expected.size())
+        {
+            printf("Consumer thread: %zu frames expected, got %zu and %llu dropped\n", expected.size(), received.size(), (unsigned long long)pool->DroppedFrames());
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
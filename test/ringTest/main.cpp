@@ -0,0 +1,153 @@
+#include "libsmp.hpp"
+#include "smpring.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// A producer thread writes the frames in chunks of random length into the ring while the main thread decodes them
+
+constexpr size_t FrameCount = 5000;
+constexpr size_t MaxPayload = 300;
+
+static std::vector<uint8_t> CreateStream()
+{
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> payload(MaxPayload);
+    std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(MaxPayload));
+    srand(1);
+    for (uint32_t i = 0; i < FrameCount; i++)
+    {
+        size_t length = sizeof(i) + rand() % (MaxPayload - sizeof(i));
+        memcpy(payload.data(), &i, sizeof(i));
+        for (size_t j = sizeof(i); j < length; j++)
+        {
+            payload[j] = rand() % 4 == 0 ? 0xFF : rand() & 0xFF;
+        }
+        size_t framelength = SMP_Encode(payload.data(), length, frame.data(), frame.size());
+        stream.insert(stream.end(), frame.begin(), frame.begin() + framelength);
+    }
+    return stream;
+}
+
+struct Checker
+{
+    uint32_t expected = 0;
+    bool failed = false;
+
+    void Frame(const uint8_t *data, size_t length)
+    {
+        uint32_t sequence;
+        if (length < sizeof(sequence))
+        {
+            failed = true;
+            return;
+        }
+        memcpy(&sequence, data, sizeof(sequence));
+        if (sequence != expected)
+        {
+            failed = true;
+        }
+        expected = sequence + 1;
+    }
+};
+
+static void FrameHandler(void *context, const uint8_t *data, uint32_t length)
+{
+    static_cast<Checker *>(context)->Frame(data, length);
+}
+
+static bool TestCRing(const std::vector<uint8_t> &stream)
+{
+    static uint8_t ringbuffer[256];
+    smp_ring_t ring;
+    if (!SMP_RingInit(&ring, ringbuffer, sizeof(ringbuffer)) || SMP_RingInit(&ring, ringbuffer, 100))
+        return false;
+    SMP_RingInit(&ring, ringbuffer, sizeof(ringbuffer));
+
+    std::thread producer([&]()
+                         {
+        size_t offset = 0;
+        while (offset < stream.size())
+        {
+            size_t length = std::min<size_t>(1 + rand() % 64, stream.size() - offset);
+            size_t written;
+            if (length == 1)
+                written = SMP_RingPut(&ring, stream[offset]) ? 1 : 0;
+            else
+                written = SMP_RingWrite(&ring, stream.data() + offset, length);
+            if (written == 0)
+                std::this_thread::yield();
+            offset += written;
+        } });
+
+    smp_struct_t st;
+    SMP_Init(&st);
+    uint8_t framebuffer[MaxPayload];
+    Checker checker;
+    uint32_t frames = 0;
+    while (frames < FrameCount)
+    {
+        if (SMP_RingAvailable(&ring) == 0)
+            std::this_thread::yield();
+        frames += SMP_Poll(&st, &ring, framebuffer, sizeof(framebuffer), &FrameHandler, &checker);
+    }
+    producer.join();
+    if (checker.failed || checker.expected != FrameCount || SMP_RingAvailable(&ring) != 0)
+    {
+        printf("C ring: %u of %zu frames received in order\n", checker.expected, FrameCount);
+        return false;
+    }
+    return true;
+}
+
+static bool TestCppRing(const std::vector<uint8_t> &stream)
+{
+    static SMPRing<512> ring;
+    static SMP<MaxPayload> smp;
+
+    std::thread producer([&]()
+                         {
+        size_t offset = 0;
+        while (offset < stream.size())
+        {
+            size_t written;
+            if (offset % 3 == 0)
+                written = ring.Put(stream[offset]) ? 1 : 0;
+            else
+                written = ring.Write(stream.data() + offset, std::min<size_t>(1 + rand() % 64, stream.size() - offset));
+            if (written == 0)
+                std::this_thread::yield();
+            offset += written;
+        } });
+
+    Checker checker;
+    size_t received = 0;
+    while (received < stream.size())
+    {
+        if (ring.Available() == 0)
+            std::this_thread::yield();
+        received += smp.Poll([&checker](const uint8_t *data, size_t length)
+                             { checker.Frame(data, length); },
+                             ring);
+    }
+    producer.join();
+    if (checker.failed || checker.expected != FrameCount || ring.Available() != 0)
+    {
+        printf("C++ ring: %u of %zu frames received in order\n", checker.expected, FrameCount);
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    auto stream = CreateStream();
+    int failed = 0;
+    if (!TestCRing(stream))
+        failed++;
+    if (!TestCppRing(stream))
+        failed++;
+    return failed ? 1 : 0;
+}
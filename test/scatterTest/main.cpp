@@ -0,0 +1,205 @@
+#include "libsmp.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+// The scatter/gather functions have to create the same frame as SMP_Encode with the segments copied into one buffer
+
+constexpr size_t MaxPayload = 700;
+
+static int failed = 0;
+
+static void Check(bool condition, const char *message)
+{
+    if (!condition)
+    {
+        printf("%s\n", message);
+        failed++;
+    }
+}
+
+static std::vector<uint8_t> Encode(const std::vector<uint8_t> &payload)
+{
+    std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    frame.resize(SMP_Encode(payload.data(), payload.size(), frame.data(), frame.size()));
+    return frame;
+}
+
+/**
+ * @brief Split the payload at random positions, including empty segments
+ */
+static std::vector<smp_segment_t> Split(const std::vector<uint8_t> &payload)
+{
+    std::vector<smp_segment_t> segments;
+    size_t offset = 0;
+    while (offset < payload.size() || rand() % 4 == 0)
+    {
+        size_t length = std::min(payload.size() - offset, static_cast<size_t>(rand() % 3 == 0 ? 0 : rand() % 200));
+        segments.push_back(smp_segment_t{payload.data() + offset, length});
+        offset += length;
+    }
+    return segments;
+}
+
+static std::vector<uint8_t> RandomPayload(size_t length)
+{
+    std::vector<uint8_t> payload(length);
+    int density = rand() % 4;
+    for (auto &b : payload)
+    {
+        b = (density == 0 || rand() % (density * 16) == 0) ? 0xFF : rand() & 0xFF;
+    }
+    return payload;
+}
+
+static void CheckSegments(const std::vector<uint8_t> &payload, const std::vector<smp_segment_t> &segments)
+{
+    std::vector<uint8_t> expected = Encode(payload);
+
+    std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    size_t framelength = SMP_SendV(segments.data(), segments.size(), frame.data(), frame.size());
+    frame.resize(framelength);
+    Check(frame == expected, "SMP_SendV differs from SMP_Encode");
+
+#ifdef SMP_HAS_IOVEC
+    std::vector<uint8_t> scratch(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    std::vector<struct iovec> iov(2 * payload.size() + 4);
+    size_t length = 0;
+    size_t count = SMP_SendIovec(segments.data(), segments.size(), scratch.data(), scratch.size(), iov.data(), iov.size(), &length);
+    std::vector<uint8_t> gathered;
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *base = static_cast<const uint8_t *>(iov[i].iov_base);
+        gathered.insert(gathered.end(), base, base + iov[i].iov_len);
+    }
+    Check(count > 0 && gathered == expected && length == expected.size(), "SMP_SendIovec differs from SMP_Encode");
+
+    // Every smaller iovec list or scratch buffer has to be rejected
+    if (count > 0)
+    {
+        size_t scratchused = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            const uint8_t *base = static_cast<const uint8_t *>(iov[i].iov_base);
+            if (base >= scratch.data() && base < scratch.data() + scratch.size())
+                scratchused += iov[i].iov_len;
+        }
+        Check(SMP_SendIovec(segments.data(), segments.size(), scratch.data(), scratch.size(), iov.data(), count - 1, nullptr) == 0,
+              "SMP_SendIovec overflowed the iovec list");
+        Check(SMP_SendIovec(segments.data(), segments.size(), scratch.data(), scratchused - 1, iov.data(), iov.size(), nullptr) == 0,
+              "SMP_SendIovec overflowed the scratch buffer");
+        Check(SMP_SendIovec(segments.data(), segments.size(), scratch.data(), scratchused, iov.data(), count, nullptr) == count,
+              "SMP_SendIovec failed with the exact iovec list and scratch length");
+    }
+#endif
+}
+
+static void TestBoundaries()
+{
+    // Framestarts at the end and the start of the segments and segments that only contain framestarts
+    const uint8_t first[] = {0x01, 0xFF};
+    const uint8_t second[] = {0xFF, 0xFF, 0x02};
+    const uint8_t third[] = {0xFF};
+    std::vector<uint8_t> payload;
+    payload.insert(payload.end(), std::begin(first), std::end(first));
+    payload.insert(payload.end(), std::begin(second), std::end(second));
+    payload.insert(payload.end(), std::begin(third), std::end(third));
+    CheckSegments(payload, {{first, sizeof(first)}, {nullptr, 0}, {second, sizeof(second)}, {third, sizeof(third)}});
+
+    // A long run without framestarts is referenced from the segment instead of copied
+    std::vector<uint8_t> clean(3 * SMP_IOVEC_MIN_REFERENCE, 0x11);
+    clean[SMP_IOVEC_MIN_REFERENCE] = 0xFF;
+    CheckSegments(clean, {{clean.data(), SMP_IOVEC_MIN_REFERENCE}, {clean.data() + SMP_IOVEC_MIN_REFERENCE, clean.size() - SMP_IOVEC_MIN_REFERENCE}});
+#ifdef SMP_HAS_IOVEC
+    uint8_t scratch[64];
+    struct iovec iov[8];
+    smp_segment_t segment{clean.data(), clean.size()};
+    size_t count = SMP_SendIovec(&segment, 1, scratch, sizeof(scratch), iov, 8, nullptr);
+    bool referenced = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        referenced = referenced || iov[i].iov_base == clean.data() + SMP_IOVEC_MIN_REFERENCE + 1;
+    }
+    Check(count > 0 && referenced, "Long payload run not referenced");
+#endif
+}
+
+static void TestOverflow()
+{
+    std::vector<uint8_t> payload = RandomPayload(100);
+    smp_segment_t segments[] = {{payload.data(), 60}, {payload.data() + 60, 40}};
+    std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(payload.size()));
+    Check(SMP_SendV(segments, 2, frame.data(), frame.size() - 1) == 0, "SMP_SendV accepted a short buffer");
+
+    // The length field holds the payload length + 2, so SMP_MAX_PAYLOAD is the longest payload
+    std::vector<uint8_t> longest = RandomPayload(SMP_MAX_PAYLOAD);
+    CheckSegments(longest, Split(longest));
+    std::vector<uint8_t> large(70000);
+    std::vector<uint8_t> largeFrame(SMP_SEND_BUFFER_LENGTH(large.size()));
+    for (size_t length : {size_t(SMP_MAX_PAYLOAD + 1), large.size()})
+    {
+        smp_segment_t tooLong[] = {{large.data(), 40000}, {large.data() + 40000, length - 40000}};
+        Check(SMP_SendV(tooLong, 2, largeFrame.data(), largeFrame.size()) == 0, "SMP_SendV accepted a payload longer than SMP_MAX_PAYLOAD");
+#ifdef SMP_HAS_IOVEC
+        struct iovec iov[8];
+        Check(SMP_SendIovec(tooLong, 2, largeFrame.data(), largeFrame.size(), iov, 8, nullptr) == 0,
+              "SMP_SendIovec accepted a payload longer than SMP_MAX_PAYLOAD");
+#endif
+    }
+}
+
+static void TestTransmitV()
+{
+    SMP<MaxPayload> smp;
+    std::vector<uint8_t> sent;
+    auto write = [&sent](const uint8_t *data, size_t length)
+    {
+        sent.assign(data, data + length);
+        return length;
+    };
+    for (int i = 0; i < 200; i++)
+    {
+        std::vector<uint8_t> payload = RandomPayload(rand() % (MaxPayload + 1));
+        std::vector<smp_segment_t> segments = Split(payload);
+        sent.clear();
+        Check(smp.TransmitV(write, segments.data(), segments.size()) == payload.size() && sent == Encode(payload), "TransmitV differs from SMP_Encode");
+    }
+
+    const uint8_t header[] = {0x10, 0xFF};
+    const uint8_t body[] = {0xFF, 0x20};
+    sent.clear();
+    Check(smp.TransmitV(write, {{header, sizeof(header)}, {body, sizeof(body)}}) == 4 && sent == Encode({0x10, 0xFF, 0xFF, 0x20}),
+          "TransmitV with an initializer list differs from SMP_Encode");
+
+    // Too long payloads and short writes are errors
+    std::vector<uint8_t> payload = RandomPayload(MaxPayload);
+    sent.clear();
+    Check(smp.TransmitV(write, {{payload.data(), payload.size()}, {header, 1}}) == 0 && sent.empty(), "TransmitV sent a too long payload");
+    Check(smp.TransmitV([](const uint8_t *, size_t length)
+                        { return length - 1; },
+                        {{header, sizeof(header)}}) == 0,
+          "TransmitV ignored a short write");
+}
+
+int main()
+{
+    srand(6);
+    for (int i = 0; i < 2000; i++)
+    {
+        std::vector<uint8_t> payload = RandomPayload(rand() % (MaxPayload + 1));
+        CheckSegments(payload, Split(payload));
+    }
+    TestBoundaries();
+    TestOverflow();
+    TestTransmitV();
+
+    if (failed)
+    {
+        printf("%d checks failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "libsmp.h"
+#include "libsmp.hpp"
+#include "smpframepool.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// The decoder statistics have to count the frames and errors of a stream with known faults,
+// the bytewise and the bulk decoder have to agree
+
+constexpr size_t MaxMessageLength = 100;
+
+static std::vector<uint8_t> Frame(size_t length, uint8_t seed)
+{
+    // Payload without framestarts, so a flipped bit in the payload is a crc error
+    std::vector<uint8_t> payload(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        payload[i] = (seed + i * 7) & 0x7F;
+    }
+    std::vector<uint8_t> frame(SMP_SEND_BUFFER_LENGTH(length));
+    frame.resize(SMP_Encode(payload.data(), length, frame.data(), frame.size()));
+    return frame;
+}
+
+static void Append(std::vector<uint8_t> &stream, const std::vector<uint8_t> &data)
+{
+    stream.insert(stream.end(), data.begin(), data.end());
+}
+
+static bool Equal(const smp_stats_snapshot_t &a, const smp_stats_snapshot_t &b)
+{
+    return a.framesReceived == b.framesReceived && a.crcErrors == b.crcErrors && a.resyncs == b.resyncs &&
+           a.bytesDiscarded == b.bytesDiscarded && a.framesSent == b.framesSent && a.bytesSent == b.bytesSent &&
+           a.stuffingBytes == b.stuffingBytes;
+}
+
+int main()
+{
+    int failed = 0;
+    std::vector<uint8_t> stream = {1, 2, 3, 4, 5, 6, 7};
+    size_t noise = 7;
+    size_t good = 0;
+    for (uint8_t i = 0; i < 20; i++)
+    {
+        auto frame = Frame(10 + i * 3, i);
+        if (i % 5 == 1)
+        {
+            // Flip a payload bit
+            frame[5] ^= 0x01;
+        }
+        else if (i % 5 == 3)
+        {
+            // Interrupted by the next frame
+            frame.resize(6);
+        }
+        else
+        {
+            good++;
+        }
+        Append(stream, frame);
+        if (i % 4 == 0 && i % 5 != 3)
+        {
+            Append(stream, {0x10, 0x20, 0x30});
+            noise += 3;
+        }
+    }
+
+    SMP<MaxMessageLength> smp;
+    size_t received = 0;
+    smp.Receive([&received](const uint8_t *, size_t)
+                { received++; },
+                stream.data(), stream.size());
+    auto stats = smp.Statistics();
+    uint64_t histogram = 0;
+    for (auto count : stats.decodeTime)
+    {
+        histogram += count;
+    }
+    if (stats.framesReceived != good || received != good || stats.crcErrors != 4 || stats.resyncs != 4 || stats.bytesDiscarded != noise || histogram != good)
+    {
+        printf("Bulk decoder: frames %llu (%zu), crc errors %llu (4), resyncs %llu (4), discarded %llu (%zu), histogram %llu\n",
+               (unsigned long long)stats.framesReceived, good, (unsigned long long)stats.crcErrors, (unsigned long long)stats.resyncs,
+               (unsigned long long)stats.bytesDiscarded, noise, (unsigned long long)histogram);
+        failed++;
+    }
+    if (smp.LastError() != -4 || smp.LastError() != 0 || SMP_getRecieverError() != -4 || SMP_getRecieverError() != 0)
+    {
+        printf("The crc error wasn't reported by LastError and SMP_getRecieverError\n");
+        failed++;
+    }
+
+    smp_struct_t st;
+    SMP_Init(&st);
+    for (auto b : stream)
+    {
+        uint8_t decoded;
+        SMP_RecieveInByte(b, &decoded, &st);
+    }
+    smp_stats_snapshot_t bytewise;
+    SMP_StatsSnapshot(&st, &bytewise);
+    if (!Equal(bytewise, stats))
+    {
+        printf("The bytewise decoder counted different statistics\n");
+        failed++;
+    }
+
+    // The errors are stored per decoder
+    SMP<MaxMessageLength> other;
+    auto valid = Frame(10, 3);
+    other.Receive([](const uint8_t *, size_t) {}, valid.data(), valid.size());
+    if (SMP_GetLastError(&st) != -4 || other.LastError() != 0)
+    {
+        printf("The error of the bytewise decoder wasn't stored in its own state\n");
+        failed++;
+    }
+
+    // A frame longer than the receive buffer is dropped
+    auto toolong = Frame(MaxMessageLength + 1, 0);
+    smp.ResetReceiver();
+    smp.Receive([](const uint8_t *, size_t) {}, toolong.data(), toolong.size());
+    if (smp.Statistics().framesDropped != 1 || smp.Statistics().framesReceived != good || smp.LastError() != -1)
+    {
+        printf("The frame longer than the receive buffer wasn't counted\n");
+        failed++;
+    }
+
+    // Resetting the pool receiver drops the started frame but keeps the statistics
+    SMPFramePool<MaxMessageLength, 2> pool;
+    auto first = Frame(20, 1);
+    auto second = Frame(30, 2);
+    size_t poolframes = 0;
+    auto count = [&poolframes](SMPFramePool<MaxMessageLength, 2>::Frame) { poolframes++; };
+    pool.Receive(count, first.data(), first.size());
+    pool.Receive(count, second.data(), second.size() / 2);
+    pool.ResetReceiver();
+    pool.Receive(count, second.data() + second.size() / 2, second.size() - second.size() / 2);
+    pool.Receive(count, first.data(), first.size());
+    if (poolframes != 2 || pool.Statistics().framesReceived != 2)
+    {
+        printf("Pool reset: frames %zu (2), counted %llu (2)\n", poolframes, (unsigned long long)pool.Statistics().framesReceived);
+        failed++;
+    }
+
+    // Sent frames and the bytestuffing
+    uint8_t payload[] = {1, 0xFF, 2, 0xFF, 0xFF};
+    size_t framelength = SMP_EncodedLength(payload, sizeof(payload));
+    size_t written = 0;
+    auto write = [&written](uint8_t *, size_t length)
+    {
+        written += length;
+        return length;
+    };
+    smp.Transmit(write, payload, sizeof(payload));
+    smp.TransmitBatch(write, {smp_segment_t{payload, sizeof(payload)}, smp_segment_t{payload, sizeof(payload)}});
+    stats = smp.Statistics();
+    if (stats.framesSent != 3 || stats.bytesSent != written || stats.bytesSent != 3 * framelength || stats.stuffingBytes != 3 * (framelength - sizeof(payload) - 5))
+    {
+        printf("Sent: frames %llu (3), bytes %llu (%zu), stuffing %llu\n", (unsigned long long)stats.framesSent,
+               (unsigned long long)stats.bytesSent, 3 * framelength, (unsigned long long)stats.stuffingBytes);
+        failed++;
+    }
+    return failed ? 1 : 0;
+}
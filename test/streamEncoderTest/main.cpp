@@ -0,0 +1,100 @@
+#include "libsmp.h"
+#include "smpstreamencoder.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// The resumable encoder has to produce the same frames as SMP_Encode for any split of the output
+
+int main()
+{
+    int failed = 0;
+    srand(5);
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> expected;
+    for (size_t test = 0; test < 2000; test++)
+    {
+        // Include empty payloads and the lengths with 0xFF in the length field
+        size_t length = test % 10 == 0 ? 253 + 256 * (rand() % 2) : rand() % 700;
+        int density = rand() % 4;
+        payload.resize(length);
+        for (auto &b : payload)
+        {
+            b = (density == 0 || rand() % (density * 8) == 0) ? 0xFF : rand() & 0xFF;
+        }
+        expected.resize(SMP_SEND_BUFFER_LENGTH(length));
+        expected.resize(SMP_Encode(payload.data(), length, expected.data(), expected.size()));
+
+        // Read with random space down to a single byte
+        SMPStreamEncoder<16> encoder;
+        std::vector<uint8_t> frame;
+        if (!encoder.Start(payload.data(), length))
+        {
+            printf("Payload of %zu bytes rejected\n", length);
+            failed++;
+            continue;
+        }
+        uint8_t space[40];
+        while (encoder.Busy())
+        {
+            size_t written = encoder.Read(space, 1 + rand() % sizeof(space));
+            frame.insert(frame.end(), space, space + written);
+            if (frame.size() > expected.size())
+                break;
+        }
+        if (frame != expected)
+        {
+            printf("Read: frame missmatch for payload length %zu\n", length);
+            failed++;
+        }
+
+        // Transport that accepts only a few bytes per call, mixed with reads
+        frame.clear();
+        encoder.Start(payload.data(), length);
+        size_t calls = 0;
+        while (encoder.Busy() && calls++ < 10 * expected.size())
+        {
+            if (rand() % 4 == 0)
+            {
+                size_t written = encoder.Read(space, 1 + rand() % sizeof(space));
+                frame.insert(frame.end(), space, space + written);
+                continue;
+            }
+            size_t limit = rand() % 24;
+            encoder.Write([&frame, limit](uint8_t *data, size_t count)
+                          {
+                              count = count < limit ? count : limit;
+                              frame.insert(frame.end(), data, data + count);
+                              return count; });
+        }
+        if (frame != expected)
+        {
+            printf("Write: frame missmatch for payload length %zu\n", length);
+            failed++;
+        }
+    }
+
+    // The length field holds the payload length + 2, so SMP_MAX_PAYLOAD is the longest payload
+    SMPStreamEncoder<> encoder;
+    payload.assign(SMP_MAX_PAYLOAD + 1, 0xFF);
+    expected.resize(SMP_SEND_BUFFER_LENGTH(SMP_MAX_PAYLOAD));
+    expected.resize(SMP_Encode(payload.data(), SMP_MAX_PAYLOAD, expected.data(), expected.size()));
+    std::vector<uint8_t> frame(expected.size() + 1);
+    if (!encoder.Start(payload.data(), SMP_MAX_PAYLOAD) || encoder.Read(frame.data(), frame.size()) != expected.size() ||
+        !std::equal(expected.begin(), expected.end(), frame.begin()))
+    {
+        printf("Payload of %u bytes not encoded\n", SMP_MAX_PAYLOAD);
+        failed++;
+    }
+    for (size_t length : {size_t(SMP_MAX_PAYLOAD + 1), size_t(65535)})
+    {
+        std::vector<uint8_t> toolong(length);
+        if (encoder.Start(toolong.data(), toolong.size()) || encoder.Busy())
+        {
+            printf("Payload of %zu bytes longer than the length field accepted\n", length);
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
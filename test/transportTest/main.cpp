@@ -0,0 +1,163 @@
+#include "smptransport.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// End to end test of the transport over PTY pairs: the masters are the links of one transport and the slaves
+// the links of a second one, both transports run on this thread and exchange frames in both directions.
+
+using Transport = SMPTransport<512>;
+using Frame = std::vector<uint8_t>;
+
+static const size_t LinkCount = 8;
+static const size_t FramesPerLink = 300;
+
+static bool OpenPty(int &master, int &slave)
+{
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+        return false;
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (slave < 0)
+        return false;
+    termios tty;
+    tcgetattr(slave, &tty);
+    cfmakeraw(&tty);
+    return tcsetattr(slave, TCSANOW, &tty) == 0;
+}
+
+static Frame RandomFrame()
+{
+    // The decoders don't deliver empty payloads, many framestarts in the payload to exercise the stuffing
+    Frame frame(1 + rand() % 512);
+    for (auto &b : frame)
+    {
+        b = rand() % 6 == 0 ? 0xFF : rand() & 0xFF;
+    }
+    return frame;
+}
+
+static int RunBackend(Transport::Backend backend, const char *name)
+{
+    std::vector<std::vector<Frame>> received[2] = {std::vector<std::vector<Frame>>(LinkCount), std::vector<std::vector<Frame>>(LinkCount)};
+    Transport masters(LinkCount, [&received](size_t link, const uint8_t *data, size_t length)
+                      { received[0][link].emplace_back(data, data + length); },
+                      backend);
+    Transport slaves(LinkCount, [&received](size_t link, const uint8_t *data, size_t length)
+                     { received[1][link].emplace_back(data, data + length); },
+                     backend);
+    if (!masters.Valid() || !slaves.Valid())
+    {
+        printf("%s: not available, skipped\n", name);
+        return 0;
+    }
+    if (masters.ActiveBackend() != backend)
+    {
+        printf("%s: wrong backend selected\n", name);
+        return 1;
+    }
+    Transport *transports[2] = {&masters, &slaves};
+    for (size_t link = 0; link < LinkCount; link++)
+    {
+        int master, slave;
+        if (!OpenPty(master, slave) || !masters.Attach(link, master) || !slaves.Attach(link, slave))
+        {
+            printf("%s: PTY %zu not attached: %s\n", name, link, strerror(errno));
+            return 1;
+        }
+    }
+
+    // sent[0] from the masters to the slaves, sent[1] from the slaves to the masters
+    std::vector<std::vector<Frame>> sent[2] = {std::vector<std::vector<Frame>>(LinkCount), std::vector<std::vector<Frame>>(LinkCount)};
+    for (int side = 0; side < 2; side++)
+    {
+        for (auto &frames : sent[side])
+        {
+            for (size_t i = 0; i < FramesPerLink; i++)
+            {
+                frames.push_back(RandomFrame());
+            }
+        }
+    }
+
+    // Queue the frames as fast as the queue limits allow, the PTY buffers are much smaller than the data
+    size_t next[2][LinkCount] = {};
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        bool done = true;
+        for (int side = 0; side < 2; side++)
+        {
+            for (size_t link = 0; link < LinkCount; link++)
+            {
+                while (next[side][link] < FramesPerLink)
+                {
+                    const Frame &frame = sent[side][link][next[side][link]];
+                    if (!transports[side]->Send(link, frame.data(), frame.size()))
+                        break;
+                    next[side][link]++;
+                }
+                done = done && received[1 - side][link].size() >= FramesPerLink;
+            }
+        }
+        if (done)
+            break;
+        if (masters.Poll(1) < 0 || slaves.Poll(1) < 0)
+        {
+            printf("%s: Poll failed: %s\n", name, strerror(errno));
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    for (int side = 0; side < 2; side++)
+    {
+        for (size_t link = 0; link < LinkCount; link++)
+        {
+            if (received[1 - side][link] != sent[side][link])
+            {
+                printf("%s: link %zu side %d: %zu of %zu frames received\n", name, link, side, received[1 - side][link].size(), FramesPerLink);
+                failed++;
+            }
+        }
+    }
+
+    // Closing the slave is seen by the master as the end of the stream
+    slaves.Detach(3);
+    uint8_t byte = 0x55;
+    if (slaves.IsOpen(3) || slaves.Send(3, &byte, 1))
+    {
+        printf("%s: detached link still open\n", name);
+        failed++;
+    }
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (masters.IsOpen(3) && std::chrono::steady_clock::now() < deadline)
+    {
+        masters.Poll(10);
+    }
+    if (masters.IsOpen(3) || !masters.IsOpen(2))
+    {
+        printf("%s: closed PTY not detected\n", name);
+        failed++;
+    }
+    if (!failed)
+    {
+        printf("%s: %zu frames exchanged\n", name, 2 * LinkCount * FramesPerLink);
+    }
+    return failed;
+}
+
+int main()
+{
+    srand(23);
+    int failed = RunBackend(Transport::Backend::Epoll, "epoll");
+    failed += RunBackend(Transport::Backend::IoUring, "io_uring");
+    if (failed)
+    {
+        printf("%d checks failed\n", failed);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "smpoffline.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+// Decode a captured smp stream and print every valid frame as "offset<TAB>length[<TAB>payload in hex]"
+
+constexpr size_t MaxMessageLength = 0xFEFF - 2; // Longest payload that fits into the length field, same as smp::MaximumMessageLength
+
+static void Usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-j threads] [-c chunk length in MiB] [-x] capture\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    size_t threads = 0;
+    size_t chunklength = SMPOfflineDecoder<MaxMessageLength>::DefaultChunkLength;
+    bool hex = false;
+    int option;
+    while ((option = getopt(argc, argv, "j:c:x")) != -1)
+    {
+        switch (option)
+        {
+        case 'j':
+            threads = strtoul(optarg, nullptr, 10);
+            break;
+        case 'c':
+            chunklength = strtoul(optarg, nullptr, 10) * 1024 * 1024;
+            break;
+        case 'x':
+            hex = true;
+            break;
+        default:
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    SMPOfflineDecoder<MaxMessageLength> decoder(threads, chunklength);
+    ptrdiff_t frames = decoder.DecodeFile(argv[optind], [hex](uint64_t offset, const uint8_t *data, size_t length)
+                                          {
+                                              printf("%llu\t%zu", static_cast<unsigned long long>(offset), length);
+                                              if (hex)
+                                              {
+                                                  putchar('\t');
+                                                  for (size_t i = 0; i < length; i++)
+                                                  {
+                                                      printf("%02x", data[i]);
+                                                  }
+                                              }
+                                              putchar('\n'); });
+    if (frames < 0)
+    {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "%td valid frames, %zu invalid frames\n", frames, decoder.InvalidFrames());
+    return 0;
+}